@@ -0,0 +1,226 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../Image3dAPI/ComSupport.hpp"
+#include "../Image3dAPI/IImage3d.h"
+
+
+/** Parameters of a GetFrameInterpolated call. */
+struct FrameRequest {
+    unsigned int      index = 0;
+    Cart3dGeom        geom = {};
+    unsigned short    max_res[3] = {0,0,0};
+    InterpolationMode interpolation = INTERPOLATION_NEAREST;
+
+    bool operator == (const FrameRequest & other) const {
+        return (index == other.index) && (memcmp(&geom, &other.geom, sizeof(geom)) == 0) && (memcmp(max_res, other.max_res, sizeof(max_res)) == 0) && (interpolation == other.interpolation);
+    }
+};
+
+
+/** Background resampling of frames on a dedicated thread, that in turn spreads each frame across the loader thread pool.
+    Serves explicit asynchronous requests (identified by a handle) first, followed by prefetch of frames that are expected to be requested soon. */
+class AsyncFrameQueue {
+public:
+    typedef std::function<HRESULT(const FrameRequest & request, Image3d & result)> ResampleFn;
+
+    /** Max number of prefetched frames kept. */
+    static const unsigned int MAX_PREFETCH_FRAMES = 8;
+
+    /** Timeout value for waiting indefinitely. */
+    static const unsigned int WAIT_INFINITE = 0xFFFFFFFF;
+
+    explicit AsyncFrameQueue (ResampleFn resample) : m_resample(resample) {
+    }
+
+    /** Discards pending requests. Waits for a frame in progress to complete. */
+    ~AsyncFrameQueue () {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    /** Queue a frame for background resampling. Returns a non-zero request handle. */
+    unsigned int Submit (const FrameRequest & request) {
+        auto entry = std::make_shared<Entry>(request);
+        unsigned int handle = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            do {
+                handle = m_next_handle++;
+            } while ((handle == 0) || m_requests.count(handle)); // skip 0 and handles still in use after wrap-around
+            m_requests[handle] = entry;
+            m_queue.push_back(entry);
+            StartThread();
+        }
+        m_wake.notify_all();
+        return handle;
+    }
+
+    /** Wait up to "timeout_ms" for a submitted frame. Returns E_PENDING on timeout, and E_INVALIDARG for unknown handles.
+        The handle is released when the frame is returned. */
+    HRESULT Wait (unsigned int handle, unsigned int timeout_ms, Image3d & result) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        auto it = m_requests.find(handle);
+        if (it == m_requests.end())
+            return E_INVALIDARG;
+
+        std::shared_ptr<Entry> entry = it->second;
+        auto is_done = [&entry]() { return entry->state == Entry::DONE; };
+        if (timeout_ms == WAIT_INFINITE)
+            m_done.wait(lock, is_done);
+        else if (!m_done.wait_for(lock, std::chrono::milliseconds(timeout_ms), is_done))
+            return E_PENDING;
+
+        m_requests.erase(handle); // "it" might have been invalidated while waiting
+        result = std::move(entry->result);
+        return entry->hr;
+    }
+
+    /** Release a request handle without waiting. A frame already in progress is discarded when completed. */
+    bool Cancel (unsigned int handle) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_requests.find(handle);
+        if (it == m_requests.end())
+            return false;
+
+        if (it->second->state == Entry::QUEUED)
+            m_queue.erase(std::find(m_queue.begin(), m_queue.end(), it->second));
+        m_requests.erase(it);
+        return true;
+    }
+
+    /** Replace the set of frames to prefetch. Frames already prefetched or in progress are kept if still requested. */
+    void Prefetch (const std::vector<FrameRequest> & requests) {
+        std::vector<std::shared_ptr<Entry>> prefetch;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const FrameRequest & request : requests) {
+                if (prefetch.size() >= MAX_PREFETCH_FRAMES)
+                    break;
+                auto it = std::find_if(m_prefetch.begin(), m_prefetch.end(), [&request](const std::shared_ptr<Entry> & e) { return e->request == request; });
+                prefetch.push_back((it != m_prefetch.end()) ? *it : std::make_shared<Entry>(request));
+            }
+            std::swap(m_prefetch, prefetch); // frames no longer requested are released below, outside the lock
+            if (!m_prefetch.empty())
+                StartThread();
+        }
+        m_wake.notify_all();
+    }
+
+    /** Retrieve a prefetched frame, waiting for it if in progress. Returns false if the frame was not prefetched. */
+    bool TakePrefetched (const FrameRequest & request, Image3d & result, HRESULT & hr) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto it = std::find_if(m_prefetch.begin(), m_prefetch.end(), [&request](const std::shared_ptr<Entry> & e) { return e->request == request; });
+            if (it == m_prefetch.end())
+                return false;
+
+            entry = *it;
+            m_prefetch.erase(it);
+            if (entry->state == Entry::QUEUED)
+                return false; // not started, so faster to resample in the calling thread
+
+            m_done.wait(lock, [&entry]() { return entry->state == Entry::DONE; });
+        }
+
+        result = std::move(entry->result);
+        hr = entry->hr;
+        return true;
+    }
+
+private:
+    AsyncFrameQueue (const AsyncFrameQueue &) = delete;
+    AsyncFrameQueue & operator = (const AsyncFrameQueue &) = delete;
+
+    struct Entry {
+        enum State {
+            QUEUED,
+            RUNNING,
+            DONE,
+        };
+
+        explicit Entry (const FrameRequest & _request) : request(_request) {
+        }
+
+        const FrameRequest request;
+        State              state = QUEUED; ///< protected by m_mutex
+        HRESULT            hr = E_FAIL;
+        Image3d            result;
+    };
+
+    /** Start background thread on first use, so that synchronous clients don't pay for it. Call with m_mutex locked. */
+    void StartThread () {
+        if (!m_thread.joinable())
+            m_thread = std::thread(&AsyncFrameQueue::ThreadLoop, this);
+    }
+
+    /** Next entry to process. Explicit requests take priority over prefetching. Call with m_mutex locked. */
+    std::shared_ptr<Entry> NextEntry () {
+        if (!m_queue.empty()) {
+            std::shared_ptr<Entry> entry = m_queue.front();
+            m_queue.pop_front();
+            return entry;
+        }
+        for (auto & entry : m_prefetch) {
+            if (entry->state == Entry::QUEUED)
+                return entry;
+        }
+        return nullptr;
+    }
+
+    void ThreadLoop () {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            std::shared_ptr<Entry> entry;
+            m_wake.wait(lock, [&]() { return m_stop || (entry = NextEntry()); });
+            if (m_stop)
+                return;
+
+            entry->state = Entry::RUNNING;
+            lock.unlock();
+            Image3d result;
+            HRESULT hr = E_FAIL;
+            try {
+                hr = m_resample(entry->request, result);
+            } catch (const std::bad_alloc &) {
+                hr = E_OUTOFMEMORY;
+            }
+            lock.lock();
+
+            entry->result = std::move(result);
+            entry->hr = hr;
+            entry->state = Entry::DONE;
+            m_done.notify_all();
+        }
+    }
+
+    const ResampleFn                                m_resample;
+    std::mutex                                      m_mutex;
+    std::condition_variable                         m_wake;      ///< signals new work to the background thread
+    std::condition_variable                         m_done;      ///< signals completed frames to waiting clients
+    std::map<unsigned int, std::shared_ptr<Entry>>  m_requests;  ///< outstanding request handles
+    std::deque<std::shared_ptr<Entry>>              m_queue;     ///< requests not yet started, in submission order
+    std::vector<std::shared_ptr<Entry>>             m_prefetch;  ///< prefetched frames, in expected request order
+    unsigned int                                    m_next_handle = 1;
+    bool                                            m_stop = false;
+    std::thread                                     m_thread;
+};
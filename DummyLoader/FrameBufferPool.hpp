@@ -0,0 +1,93 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include "../Image3dAPI/ComSupport.hpp"
+
+
+/** Thread-safe pool of BYTE SAFEARRAY frame buffers, keyed by size.
+    Buffers handed back by the client through RecycleFrame are reused by subsequent GetFrame calls,
+    so that steady-state cine playback doesn't allocate any frame buffers. */
+class FrameBufferPool {
+public:
+    /** Max number of idle buffers kept. Oldest buffers are released first when exceeded. */
+    static const size_t MAX_IDLE_BUFFERS = 8;
+
+    FrameBufferPool () {
+    }
+
+    ~FrameBufferPool () {
+        for (SAFEARRAY * buf : m_idle)
+            SafeArrayDestroy(buf);
+    }
+
+    /** Get a 1D BYTE array with "size" elements. Reuses a recycled buffer if available.
+        Buffer content is undefined. Throws std::bad_alloc on allocation failure. */
+    SAFEARRAY * Acquire (unsigned int size) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto it = m_idle.rbegin(); it != m_idle.rend(); ++it) {
+                if ((*it)->rgsabound[0].cElements == size) {
+                    SAFEARRAY * buf = *it;
+                    m_idle.erase(std::next(it).base()); // prefer most recently recycled buffer (cache-warm)
+                    ++m_reuses;
+                    return buf;
+                }
+            }
+        }
+
+        SAFEARRAY * buf = SafeArrayCreateVector(VT_UI1, 0, size);
+        if (!buf)
+            throw std::bad_alloc();
+        ++m_allocations;
+        return buf;
+    }
+
+    /** Hand a buffer back for reuse. Takes ownership.
+        Returns false, without taking ownership, if the buffer is not an unlocked 1D BYTE array. */
+    bool Recycle (SAFEARRAY * buf) {
+        VARTYPE type = VT_EMPTY;
+        if (!buf || (SafeArrayGetDim(buf) != 1) || FAILED(SafeArrayGetVartype(buf, &type)) || (type != VT_UI1))
+            return false;
+        if (buf->cLocks || (buf->fFeatures & (FADF_AUTO | FADF_STATIC | FADF_EMBEDDED | FADF_FIXEDSIZE)))
+            return false; // not owned by the OLE allocator, or still in use
+
+        SAFEARRAY * evicted = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_idle.push_back(buf);
+            if (m_idle.size() > MAX_IDLE_BUFFERS) {
+                evicted = m_idle.front();
+                m_idle.pop_front();
+            }
+        }
+        if (evicted)
+            SafeArrayDestroy(evicted); // release outside lock
+        return true;
+    }
+
+    /** Number of frame buffers allocated from the heap. */
+    unsigned int Allocations () const {
+        return m_allocations;
+    }
+
+    /** Number of frame buffers served from recycled buffers. */
+    unsigned int Reuses () const {
+        return m_reuses;
+    }
+
+private:
+    FrameBufferPool (const FrameBufferPool &) = delete;
+    FrameBufferPool & operator = (const FrameBufferPool &) = delete;
+
+    std::mutex                m_mutex;
+    std::deque<SAFEARRAY*>    m_idle;            ///< recycled buffers, oldest first
+    std::atomic<unsigned int> m_allocations{0};
+    std::atomic<unsigned int> m_reuses{0};
+};
@@ -0,0 +1,62 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "../Image3dAPI/ComSupport.hpp"
+#include "../Image3dAPI/IImage3d.h"
+#include "../Image3dCore/MipPyramid.hpp"
+
+
+/** Frame ready for resampling, together with its resolution pyramid. */
+struct StoredFrame {
+    std::vector<uint8_t>        buffer;  ///< voxel storage, unless "view" refers to external memory (e.g. a file mapping)
+    Image3dView                 view;    ///< no voxel data if the pyramid holds a compressed copy instead
+    std::unique_ptr<MipPyramid> pyramid; ///< refers to "view"
+};
+
+
+/** Frame storage backend of Image3dSource. All frames share the same format and geometry.
+    Implementations must be thread-safe. */
+class FrameStore {
+public:
+    virtual ~FrameStore () {
+    }
+
+    virtual unsigned int Count () const = 0;
+
+    virtual ImageFormat Format () const = 0;
+
+    /** Time of a frame [seconds]. */
+    virtual double Time (unsigned int index) const = 0;
+
+    /** Duration of the frame loop [seconds], i.e. the frame count times the frame interval. */
+    virtual double Duration () const = 0;
+
+    virtual Cart3dGeom Geometry () const = 0;
+
+    /** Get a frame for resampling. The frame remains valid as long as the returned pointer is held.
+        Returns nullptr if no longer available (live stores). Throws std::bad_alloc if out of memory. */
+    virtual std::shared_ptr<const StoredFrame> Get (unsigned int index, ThreadPool & pool) = 0;
+
+    /** Live acquisition, where frames are appended over time and only a window of recent frames is kept. */
+    virtual bool Live () const {
+        return false;
+    }
+
+    /** Oldest frame still available. */
+    virtual unsigned int First () const {
+        return 0;
+    }
+
+    /** Wait up to "timeout_ms" milliseconds for Count() to exceed "known_count". Returns false if no more frames will be appended. */
+    virtual bool WaitForFrames (unsigned int /*known_count*/, unsigned int /*timeout_ms*/) {
+        return false;
+    }
+
+    /** ECG recorded in step with the frames of a live store, covering frames [First(), Count()). Throws std::bad_alloc. */
+    virtual void GetECG (EcgSeries & /*ecg*/) const {
+    }
+};
@@ -1,4 +1,5 @@
 #include "Image3dFileLoader.hpp"
+#include <cwctype>
 
 
 Image3dFileLoader::Image3dFileLoader() {
@@ -8,13 +9,54 @@ Image3dFileLoader::~Image3dFileLoader() {
 }
 
 
+/** Case-insensitive check of the file name extension. */
+static bool HasExtension (const std::wstring & file_name, const std::wstring & ext) {
+    if (file_name.size() < ext.size())
+        return false;
+    for (size_t i = 0; i < ext.size(); ++i) {
+        if (static_cast<wchar_t>(towlower(file_name[file_name.size() - ext.size() + i])) != ext[i])
+            return false;
+    }
+    return true;
+}
+
+
 HRESULT Image3dFileLoader::LoadFile(BSTR file_name, /*out*/Image3dError *err_type, /*out*/BSTR *err_msg) {
     if (!err_type || !err_msg)
         return E_INVALIDARG;
 
+    const std::wstring name = file_name ? file_name : L"";
+    m_header.reset();
+    m_data_file.reset();
+    try {
+        if (HasExtension(name, L".mhd") || HasExtension(name, L".mha")) {
+            // parse the header, and map the data file without reading it
+            auto header_file = std::make_shared<const MappedFile>(name);
+            const MetaImageHeader header = MetaImageHeader::Parse(reinterpret_cast<const char*>(header_file->Data()), header_file->Size(), name);
+            std::shared_ptr<const MappedFile> data_file = (header.data_file == name) ? header_file : std::make_shared<const MappedFile>(header.data_file);
+            header.DataOffset(data_file->Size()); // fail early if truncated
+
+            m_header.reset(new MetaImageHeader(header));
+            m_data_file = data_file;
+        } else {
+            // other file content is synthesized, but the dataset can be configured through parameters appended to the file name
+            m_params = SyntheticParams::Parse(name);
+        }
+    } catch (const std::invalid_argument & err) {
+        *err_type = Image3d_VALIDATION_FAILURE;
+        *err_msg  = CComBSTR(err.what()).Detach();
+        return E_FAIL;
+    } catch (const std::runtime_error & err) {
+        *err_type = Image3d_ACCESS_FAILURE;
+        *err_msg  = CComBSTR(err.what()).Detach();
+        return E_FAIL;
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+
     *err_type = Image3d_SUCCESS;
     *err_msg  = CComBSTR().Detach();
-    return S_OK; // no operation
+    return S_OK;
 }
 
 HRESULT Image3dFileLoader::GetImageSource(/*out*/IImage3dSource **img_src) {
@@ -22,6 +64,16 @@ HRESULT Image3dFileLoader::GetImageSource(/*out*/IImage3dSource **img_src) {
         return E_INVALIDARG;
 
     CComPtr<Image3dSource> obj = CreateLocalInstance<Image3dSource>();
+    try {
+        if (m_header)
+            obj->Initialize(*m_header, m_data_file);
+        else
+            obj->Initialize(m_params);
+    } catch (const std::invalid_argument &) {
+        return E_FAIL; // already validated by LoadFile
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
     *img_src = obj.Detach();
     return S_OK;
 }
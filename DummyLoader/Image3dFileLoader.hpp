@@ -28,6 +28,11 @@ public:
     BEGIN_COM_MAP(Image3dFileLoader)
         COM_INTERFACE_ENTRY(IImage3dFileLoader)
     END_COM_MAP()
+
+private:
+    SyntheticParams                   m_params;    ///< synthetic dataset parameters from LoadFile
+    std::unique_ptr<MetaImageHeader>  m_header;    ///< MetaImage file from LoadFile, if any
+    std::shared_ptr<const MappedFile> m_data_file; ///< mapped MetaImage data, shared by all image sources
 };
 
 OBJECT_ENTRY_AUTO(__uuidof(Image3dFileLoader), Image3dFileLoader)
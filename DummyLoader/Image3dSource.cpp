@@ -1,31 +1,75 @@
 #include "Image3dSource.hpp"
-#include "LinAlg.hpp"
 
 
-static const uint8_t OUTSIDE_VAL = 0;   // black outside image volume
-static const uint8_t PROBE_PLANE = 127; // gray value for plane closest to probe
+/** Frames are sampled from row-major storage by default. Bricked storage speeds up reslicing across rows (e.g. YZ planes)
+    at some cost for row-aligned planes (see ResampleBenchmark -layout), and is selected with DUMMYLOADER_LAYOUT=bricked.
+    Only applies to synthesized frames, since frames of a mapped file are sampled in place. */
+static bool UseBrickedLayout () {
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4996) // function or variable may be unsafe
+#endif
+    const char * env = std::getenv("DUMMYLOADER_LAYOUT");
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+    return env && (strcmp(env, "bricked") == 0);
+}
 
 
-Image3dSource::Image3dSource() {
+Image3dSource::Image3dSource() : m_pool(ThreadPool::Shared()), m_async([this](const FrameRequest & request, Image3d & result) { return ResampleFrame(request, result); }) {
     m_probe.type = PROBE_External;
     m_probe.name = L"4V";
 
-    // One second loop starting at t = 10
-    const size_t numFrames = 25;
-    const double duration = 1.0; // ECG duration in seconds (the sum of the duration of individual ECG samples)
-    const double startTime = 10.0;
+    {
+        // flat gray tissue scale
+        for (size_t i = 0; i < m_color_map_tissue.size(); ++i)
+            m_color_map_tissue[i] = R8G8B8A8(static_cast<unsigned char>(i), static_cast<unsigned char>(i), static_cast<unsigned char>(i), 0xFF);
+    }
+    m_buffer_baseline[0] = 0;
+    m_buffer_baseline[1] = 0;
+
+    Initialize(SyntheticParams());
+}
+
+void Image3dSource::Initialize(const SyntheticParams & params) {
+    if (params.rate > 0) {
+        // checker board image data acquired over time
+        Initialize(std::unique_ptr<FrameStore>(new LiveFrames(params, m_pool)));
+        return;
+    }
+
+    // checker board image data (synthesized on demand, so that opening large datasets is instant)
+    Initialize(std::unique_ptr<FrameStore>(new SyntheticFrames(params, UseBrickedLayout())));
+}
+
+void Image3dSource::Initialize(const MetaImageHeader & header, std::shared_ptr<const MappedFile> file) {
+    Initialize(std::unique_ptr<FrameStore>(new MappedFrames(header, file)));
+}
+
+void Image3dSource::Initialize(std::unique_ptr<FrameStore> frames) {
+    if (frames->Live()) {
+        // ECG recorded together with the frames
+        m_ecg = EcgSeries();
+        m_img_geom = frames->Geometry();
+        m_frames = std::move(frames);
+        return;
+    }
+
+    // loop matching the frames
+    const double duration = frames->Duration(); // ECG duration in seconds (the sum of the duration of individual ECG samples)
+    const double startTime = frames->Time(0);
 
     {
-        // simulate sine-wave ECG
-        const int N = 128;
+        // simulate sine-wave ECG (128 samples per second)
+        const int N = std::max(static_cast<int>(128*duration + 0.5), 1);
         CComSafeArray<float> samples(N);
         for (int i = 0; i < N; ++i)
-            samples[i] = static_cast<float>(sin(4 * i*M_PI / N));
+            samples[i] = static_cast<float>(sin(4 * i*M_PI*duration / N));
 
         CComSafeArray<double> trig_times;
-        trig_times.Add(startTime); // trig every 1/2 sec
-        trig_times.Add(startTime + duration / 2);
-        trig_times.Add(startTime + duration);
+        for (double t = 0; t <= duration; t += 0.5)
+            trig_times.Add(startTime + t); // trig every 1/2 sec
 
         EcgSeries ecg;
         ecg.start_time = startTime;
@@ -34,52 +78,9 @@ Image3dSource::Image3dSource() {
         ecg.trig_times = trig_times.Detach();
         m_ecg = EcgSeries(ecg);
     }
-    {
-        // flat gray tissue scale
-        for (size_t i = 0; i < m_color_map_tissue.size(); ++i)
-            m_color_map_tissue[i] = R8G8B8A8(static_cast<unsigned char>(i), static_cast<unsigned char>(i), static_cast<unsigned char>(i), 0xFF);
-    }
-    {
-        // image geometry    X     Y       Z
-        Cart3dGeom geom = { -0.1f, 0,     -0.075f,// origin
-                             0.20f,0,      0,     // dir1 (width)
-                             0,    0.10f,  0,     // dir2 (depth)
-                             0,    0,      0.15f};// dir3 (elevation)
-        m_img_geom = geom;
-    }
-    {
-        // checker board image data
-        unsigned short dims[] = { 20, 15, 10 }; // matches length of dir1, dir2 & dir3, so that the image squares become quadratic
-        std::vector<byte> img_buf(dims[0] * dims[1] * dims[2]);
-        for (size_t frameNumber = 0; frameNumber < numFrames; ++frameNumber) {
-            for (unsigned int z = 0; z < dims[2]; ++z) {
-                for (unsigned int y = 0; y < dims[1]; ++y) {
-                    for (unsigned int x = 0; x < dims[0]; ++x) {
-                        bool even_f = (frameNumber / 2 % 2) == 0;
-                        bool even_x = (x / 2 % 2) == 0;
-                        bool even_y = (y / 2 % 2) == 0;
-                        bool even_z = (z / 2 % 2) == 0;
-                        byte & out_sample = img_buf[x + y*dims[0] + z*dims[0] * dims[1]];
-                        if (even_f ^ even_x ^ even_y ^ even_z)
-                            out_sample = 255;
-                        else
-                            out_sample = 0;
-                    }
-                }
-            }
 
-            // special grayscale value for plane closest to probe
-            for (unsigned int z = 0; z < dims[2]; ++z) {
-                for (unsigned int x = 0; x < dims[0]; ++x) {
-                    unsigned int y = 0;
-                    byte & out_sample = img_buf[x + y*dims[0] + z*dims[0] * dims[1]];
-                    out_sample = PROBE_PLANE;
-                }
-            }
-
-            m_frames.push_back(CreateImage3d(frameNumber*(duration/numFrames) + startTime, FORMAT_U8, dims, img_buf));
-        }
-    }
+    m_img_geom = frames->Geometry();
+    m_frames = std::move(frames);
 }
 
 Image3dSource::~Image3dSource() {
@@ -90,7 +91,7 @@ HRESULT Image3dSource::GetFrameCount(/*out*/unsigned int *size) {
     if (!size)
         return E_INVALIDARG;
 
-    *size = static_cast<unsigned int>(m_frames.size());
+    *size = m_frames->Count();
     return S_OK;
 }
 
@@ -98,33 +99,415 @@ HRESULT Image3dSource::GetFrameTimes(/*out*/SAFEARRAY * *frame_times) {
     if (!frame_times)
         return E_INVALIDARG;
 
-    const unsigned int N = static_cast<unsigned int>(m_frames.size());
+    const unsigned int N = m_frames->Count();
     CComSafeArray<double> result(N);
     if (N > 0) {
         double * time_arr = &result.GetAt(0);
         for (unsigned int i = 0; i < N; ++i)
-            time_arr[i] = m_frames[i].time;
+            time_arr[i] = m_frames->Time(i);
     }
 
     *frame_times = result.Detach();
     return S_OK;
 }
 
+bool Image3dSource::Available(unsigned int index) const {
+    return (index >= m_frames->First()) && (index < m_frames->Count());
+}
+
 
 HRESULT Image3dSource::GetFrame(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], /*out*/Image3d *data) {
+    return GetFrameInterpolated(index, out_geom, max_res, INTERPOLATION_NEAREST, data);
+}
+
+HRESULT Image3dSource::GetFrameInterpolated(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3d *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_FRAME);
     if (!data)
         return E_INVALIDARG;
-    if (index >= m_frames.size())
+    FrameRequest request;
+    HRESULT hr = MakeFrameRequest(index, out_geom, max_res, interpolation, request);
+    if (FAILED(hr))
+        return hr;
+
+    // served from the background thread if previously hinted through PrefetchFrames
+    Image3d result;
+    if (!m_async.TakePrefetched(request, result, hr))
+        hr = ResampleFrame(request, result);
+    if (FAILED(hr))
+        return hr;
+
+    *data = std::move(result);
+    return S_OK;
+}
+
+HRESULT Image3dSource::MakeFrameRequest(unsigned int index, Cart3dGeom out_geom, const unsigned short max_res[3], InterpolationMode interpolation, FrameRequest & request) const {
+    if (!max_res)
+        return E_INVALIDARG;
+    if (!Available(index))
         return E_BOUNDS;
+    if ((interpolation != INTERPOLATION_NEAREST) && (interpolation != INTERPOLATION_LINEAR))
+        return E_INVALIDARG;
+
+    request.index = index;
+    request.geom = out_geom;
+    for (size_t i = 0; i < 3; ++i)
+        request.max_res[i] = max_res[i];
+    if (request.max_res[2] == 0)
+        request.max_res[2] = 1; // require at least one plane to to retrieved
+    request.interpolation = interpolation;
+    return S_OK;
+}
+
+HRESULT Image3dSource::ResampleFrame(const FrameRequest & request, Image3d & result, const ColorMap * color_map) {
+    const ImageFormat format = color_map ? color_map->Format() : m_frames->Format();
+    try {
+        std::shared_ptr<const StoredFrame> frame = m_frames->Get(request.index, *m_pool);
+        if (!frame)
+            return E_BOUNDS; // no longer available
+
+        // resample straight into the returned buffer (every voxel is written, so no initialization needed)
+        Image3d img = CreateImage3d(frame->view.time, format, request.max_res, &m_buffers, color_map ? COLOR_ROW_ALIGNMENT : 1);
+        SourceStats::FrameMemory memory(m_stats, static_cast<uint64_t>(img.stride1)*img.dims[2]);
+        SampleFrame(*frame->pyramid, request.geom, request.interpolation, *m_pool, ToView(img), color_map);
+        m_stats.Produced(static_cast<uint64_t>(img.dims[0])*img.dims[1]*img.dims[2], static_cast<uint64_t>(img.stride1)*img.dims[2]);
+
+        result = std::move(img);
+        return S_OK;
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+}
+
+HRESULT Image3dSource::RecycleFrame(/*in,out*/Image3d *data) {
+    if (!data || !data->data)
+        return E_INVALIDARG;
+
+    if (!m_buffers.Recycle(data->data))
+        return E_INVALIDARG; // not a frame buffer
+    data->data = nullptr; // ownership transferred to pool
+
+    *data = Image3d();
+    return S_OK;
+}
+
+HRESULT Image3dSource::GetBufferStats(/*out*/unsigned int *allocations, /*out*/unsigned int *reuses) {
+    if (!allocations || !reuses)
+        return E_INVALIDARG;
+
+    *allocations = m_buffers.Allocations();
+    *reuses = m_buffers.Reuses();
+    return S_OK;
+}
+
+HRESULT Image3dSource::GetFrames(unsigned int first, unsigned int count, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3dSeries *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_FRAMES);
+    if (!data || !max_res || (count == 0))
+        return E_INVALIDARG;
+    if (!Available(first) || (count > m_frames->Count() - first))
+        return E_BOUNDS;
+    if ((interpolation != INTERPOLATION_NEAREST) && (interpolation != INTERPOLATION_LINEAR))
+        return E_INVALIDARG;
+
+    ImageFormat format = m_frames->Format(); // all frames share the same format
+
+    // at least one plane, without modifying the caller's array
+    const unsigned short dims[3] = { max_res[0], max_res[1], std::max<unsigned short>(max_res[2], 1) };
+
+    try {
+        Image3dSeries result = CreateImage3dSeries(count, format, dims);
+        m_stats.Allocated(); // series are not pooled
+        SourceStats::FrameMemory memory(m_stats, static_cast<uint64_t>(result.stride2)*count);
+        double * times = static_cast<double*>(result.times->pvData);
+        for (unsigned int i = 0; i < count; ++i)
+            times[i] = m_frames->Time(first + i);
+
+        // frames in parallel, each with parallel rows (nested calls are balanced through work stealing)
+        std::atomic<bool> evicted(false); // frames no longer available from live acquisition
+        m_pool->ParallelFor(count, 1, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i) {
+                std::shared_ptr<const StoredFrame> frame = m_frames->Get(first + i, *m_pool);
+                if (!frame) {
+                    evicted = true;
+                    continue;
+                }
+                SampleFrame(*frame->pyramid, out_geom, interpolation, *m_pool, ToView(result, i));
+            }
+        });
+        if (evicted)
+            return E_BOUNDS;
+        m_stats.Produced(static_cast<uint64_t>(result.dims[0])*result.dims[1]*result.dims[2]*count, static_cast<uint64_t>(result.stride2)*count);
+
+        *data = std::move(result);
+        return S_OK;
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+}
+
+HRESULT Image3dSource::GetSlices(unsigned int index, SAFEARRAY * planes, unsigned short max_res[2], InterpolationMode interpolation, /*out*/Image3d *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_SLICES);
+    return ResampleSlices(index, planes, max_res, interpolation, nullptr, data);
+}
+
+HRESULT Image3dSource::ResampleSlices(unsigned int index, SAFEARRAY * planes, const unsigned short max_res[2], InterpolationMode interpolation, const ColorMap * color_map, /*out*/Image3d *data) {
+    static_assert(sizeof(Cart3dGeom) == 12*sizeof(float), "Cart3dGeom size mismatch");
+
+    if (!data || !planes || !max_res)
+        return E_INVALIDARG;
+    if ((max_res[0] == 0) || (max_res[1] == 0))
+        return E_INVALIDARG; // empty slices
+    if (!Available(index))
+        return E_BOUNDS;
+    if ((interpolation != INTERPOLATION_NEAREST) && (interpolation != INTERPOLATION_LINEAR))
+        return E_INVALIDARG;
+
+    VARTYPE type = VT_EMPTY;
+    if ((SafeArrayGetDim(planes) != 1) || FAILED(SafeArrayGetVartype(planes, &type)) || (type != VT_R4))
+        return E_INVALIDARG;
+    const unsigned int plane_floats = planes->rgsabound[0].cElements;
+    if ((plane_floats == 0) || (plane_floats % 12 != 0) || (plane_floats/12 > std::numeric_limits<unsigned short>::max()))
+        return E_INVALIDARG; // must contain 1 or more Cart3dGeom structs
+
+    ImageFormat format = color_map ? color_map->Format() : m_frames->Format();
+    try {
+        std::shared_ptr<const StoredFrame> frame = m_frames->Get(index, *m_pool);
+        if (!frame)
+            return E_BOUNDS; // no longer available
+        const unsigned short dims[3] = { max_res[0], max_res[1], static_cast<unsigned short>(plane_floats/12) };
+        Image3d result = CreateImage3d(frame->view.time, format, dims, &m_buffers, color_map ? COLOR_ROW_ALIGNMENT : 1);
+        SourceStats::FrameMemory memory(m_stats, static_cast<uint64_t>(result.stride1)*dims[2]);
+        SampleSlices(*frame->pyramid, static_cast<const Cart3dGeom*>(planes->pvData), interpolation, *m_pool, ToView(result), color_map);
+        m_stats.Produced(static_cast<uint64_t>(dims[0])*dims[1]*dims[2], static_cast<uint64_t>(result.stride1)*dims[2]);
 
-    ImageFormat format = m_frames[index].format;
-    if (format == FORMAT_U8) {
-        Image3d result = SampleFrame<uint8_t>(m_frames[index], m_img_geom, out_geom, max_res);
         *data = std::move(result);
         return S_OK;
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
     }
+}
 
-    return E_NOTIMPL;
+HRESULT Image3dSource::CreateSharedRing(unsigned int slot_count, unsigned int slot_size, /*out*/BSTR *name) {
+    if (!name)
+        return E_INVALIDARG;
+    if (*name)
+        return E_INVALIDARG; // input must be pointer to nullptr
+    if ((slot_count == 0) || (slot_count > SharedRingHeader::MAX_SLOTS) || (slot_size == 0))
+        return E_INVALIDARG;
+
+    try {
+        const std::string ring_name = SharedMemory::UniqueName();
+        auto ring = std::make_shared<SharedFrameRing>(ring_name, slot_count, slot_size);
+        {
+            std::lock_guard<std::mutex> lock(m_ring_mutex);
+            m_ring = ring; // in-flight GetFrameShared calls keep the previous ring alive
+        }
+
+        *name = CComBSTR(ring_name.c_str()).Detach();
+        return S_OK;
+    } catch (const std::invalid_argument &) {
+        return E_INVALIDARG; // section too large
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    } catch (const std::runtime_error &) {
+        return E_FAIL;
+    }
+}
+
+HRESULT Image3dSource::GetFrameShared(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3dShared *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_FRAME_SHARED);
+    if (!data)
+        return E_INVALIDARG;
+    FrameRequest request;
+    HRESULT hr = MakeFrameRequest(index, out_geom, max_res, interpolation, request);
+    if (FAILED(hr))
+        return hr;
+
+    std::shared_ptr<SharedFrameRing> ring;
+    {
+        std::lock_guard<std::mutex> lock(m_ring_mutex);
+        ring = m_ring;
+    }
+    if (!ring)
+        return E_UNEXPECTED; // CreateSharedRing not called
+
+    const ImageFormat format = m_frames->Format();
+    const uint64_t size = uint64_t(request.max_res[0])*request.max_res[1]*request.max_res[2]*ImageFormatSize(format);
+    if (size > ring->SlotSize())
+        return E_BOUNDS; // frame doesn't fit in a slot
+
+    try {
+        std::shared_ptr<const StoredFrame> frame = m_frames->Get(request.index, *m_pool);
+        if (!frame)
+            return E_BOUNDS; // no longer available
+
+        // an exception leaves the slot marked as being written, so clients never accept a partial frame
+        SharedFrameRing::Slot slot = ring->BeginWrite();
+        const Image3dView out = Image3dView::Packed(frame->view.time, format, request.max_res, slot.data);
+        SampleFrame(*frame->pyramid, request.geom, request.interpolation, *m_pool, out);
+        ring->EndWrite(slot);
+        m_stats.Produced(static_cast<uint64_t>(out.dims[0])*out.dims[1]*out.dims[2], out.Size()); // written to the preallocated ring, so no frame memory
+
+        Image3dShared result = {};
+        result.time = out.time;
+        result.format = out.format;
+        for (size_t i = 0; i < 3; ++i)
+            result.dims[i] = out.dims[i];
+        result.stride0 = out.stride0;
+        result.stride1 = out.stride1;
+        result.offset = slot.offset;
+        result.sequence = slot.sequence;
+        *data = result;
+        return S_OK;
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+}
+
+HRESULT Image3dSource::BeginGetFrame(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/unsigned int *request) {
+    SourceStats::Call call(m_stats, METHOD_BEGIN_GET_FRAME);
+    if (!request)
+        return E_INVALIDARG;
+    FrameRequest frame_request;
+    HRESULT hr = MakeFrameRequest(index, out_geom, max_res, interpolation, frame_request);
+    if (FAILED(hr))
+        return hr;
+
+    try {
+        *request = m_async.Submit(frame_request);
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+HRESULT Image3dSource::EndGetFrame(unsigned int request, unsigned int timeout_ms, /*out*/Image3d *data) {
+    SourceStats::Call call(m_stats, METHOD_END_GET_FRAME);
+    if (!data)
+        return E_INVALIDARG;
+
+    Image3d result;
+    HRESULT hr = m_async.Wait(request, timeout_ms, result);
+    if (hr != S_OK)
+        return hr; // E_PENDING if not yet completed
+
+    *data = std::move(result);
+    return S_OK;
+}
+
+HRESULT Image3dSource::CancelGetFrame(unsigned int request) {
+    if (!m_async.Cancel(request))
+        return E_INVALIDARG;
+    return S_OK;
+}
+
+HRESULT Image3dSource::PrefetchFrames(unsigned int first, unsigned int count, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation) {
+    SourceStats::Call call(m_stats, METHOD_PREFETCH_FRAMES);
+    // snapshot of the available frames [begin, begin+N), since live stores append & drop frames meanwhile
+    const unsigned int begin = m_frames->First();
+    const unsigned int N = m_frames->Count() - begin;
+    if (count > N)
+        return E_INVALIDARG;
+    if ((count > 0) && ((first < begin) || (first - begin >= N)))
+        return E_BOUNDS;
+
+    try {
+        // frames wrap around to the oldest available frame at the end of the loop, to support cine playback
+        std::vector<FrameRequest> requests(count);
+        for (unsigned int i = 0; i < count; ++i) {
+            HRESULT hr = MakeFrameRequest(begin + (first - begin + i) % N, out_geom, max_res, interpolation, requests[i]);
+            if (FAILED(hr))
+                return hr;
+        }
+        m_async.Prefetch(requests); // count == 0 cancels prefetching
+    } catch (const std::bad_alloc &) {
+        return E_OUTOFMEMORY;
+    }
+    return S_OK;
+}
+
+HRESULT Image3dSource::WaitForFrames(unsigned int known_count, unsigned int timeout_ms, /*out*/unsigned int *first_frame, /*out*/unsigned int *frame_count) {
+    if (!first_frame || !frame_count)
+        return E_INVALIDARG;
+
+    // only waits on the frame count, so acquisition continues meanwhile
+    const bool growing = m_frames->WaitForFrames(known_count, timeout_ms);
+    const unsigned int count = m_frames->Count();
+    *first_frame = std::min(m_frames->First(), count);
+    *frame_count = count;
+    if (count > known_count)
+        return S_OK;
+    return growing ? E_PENDING : S_FALSE;
+}
+
+HRESULT Image3dSource::GetFrameColorMapped(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, ImageFormat format, /*out*/Image3d *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_FRAME_COLOR_MAPPED);
+    if (!data)
+        return E_INVALIDARG;
+    if ((format != FORMAT_R8G8B8A8) && (format != FORMAT_B8G8R8A8))
+        return E_INVALIDARG;
+    FrameRequest request;
+    HRESULT hr = MakeFrameRequest(index, out_geom, max_res, interpolation, request);
+    if (FAILED(hr))
+        return hr;
+
+    // prefetched frames are not color-mapped, so always resample
+    static_assert(sizeof(R8G8B8A8) == sizeof(uint32_t), "R8G8B8A8 size mismatch");
+    const ColorMap color_map(reinterpret_cast<const uint32_t*>(m_color_map_tissue.data()), format);
+    Image3d result;
+    hr = ResampleFrame(request, result, &color_map);
+    if (FAILED(hr))
+        return hr;
+
+    *data = std::move(result);
+    return S_OK;
+}
+
+HRESULT Image3dSource::GetSlicesColorMapped(unsigned int index, SAFEARRAY * planes, unsigned short max_res[2], InterpolationMode interpolation, ImageFormat format, /*out*/Image3d *data) {
+    SourceStats::Call call(m_stats, METHOD_GET_SLICES_COLOR_MAPPED);
+    if ((format != FORMAT_R8G8B8A8) && (format != FORMAT_B8G8R8A8))
+        return E_INVALIDARG;
+
+    const ColorMap color_map(reinterpret_cast<const uint32_t*>(m_color_map_tissue.data()), format);
+    return ResampleSlices(index, planes, max_res, interpolation, &color_map, data);
+}
+
+HRESULT Image3dSource::GetMethodStats(Image3dMethod method, /*out*/MethodStats *stats) {
+    if (!stats)
+        return E_INVALIDARG;
+    if ((method < METHOD_GET_FRAME) || (method > METHOD_PREFETCH_FRAMES))
+        return E_INVALIDARG;
+
+    const LatencyHistogram & latency = m_stats.Method(method);
+    MethodStats result = {};
+    result.calls = static_cast<unsigned int>(std::min<uint64_t>(latency.Count(), std::numeric_limits<unsigned int>::max()));
+    result.latency_p50 = latency.Percentile(0.50)/1000.0f;
+    result.latency_p95 = latency.Percentile(0.95)/1000.0f;
+    result.latency_p99 = latency.Percentile(0.99)/1000.0f;
+    result.latency_max = latency.Max()/1000.0f;
+    *stats = result;
+    return S_OK;
+}
+
+HRESULT Image3dSource::GetResourceStats(/*out*/ResourceStats *stats) {
+    if (!stats)
+        return E_INVALIDARG;
+
+    ResourceStats result = {};
+    result.bytes_produced = m_stats.BytesProduced();
+    result.voxels_resampled = m_stats.VoxelsResampled();
+    result.frame_memory = m_stats.FrameMemoryInUse();
+    result.peak_frame_memory = m_stats.PeakFrameMemory();
+    result.buffer_allocations = m_buffers.Allocations() - m_buffer_baseline[0] + static_cast<unsigned int>(m_stats.Allocations());
+    result.buffer_reuses = m_buffers.Reuses() - m_buffer_baseline[1];
+    *stats = result;
+    return S_OK;
+}
+
+HRESULT Image3dSource::ResetStats() {
+    m_stats.Reset();
+    m_buffer_baseline[0] = m_buffers.Allocations();
+    m_buffer_baseline[1] = m_buffers.Reuses();
+    return S_OK;
 }
 
 HRESULT Image3dSource::GetBoundingBox(/*out*/Cart3dGeom *geom) {
@@ -152,6 +535,15 @@ HRESULT Image3dSource::GetECG(/*out*/EcgSeries *ecg) {
     if (!ecg)
         return E_INVALIDARG;
 
+    if (m_frames->Live()) {
+        try {
+            m_frames->GetECG(*ecg); // covering the frames currently available
+        } catch (const std::bad_alloc &) {
+            return E_OUTOFMEMORY;
+        }
+        return S_OK;
+    }
+
     // return a copy
     *ecg = EcgSeries(m_ecg);
     return S_OK;
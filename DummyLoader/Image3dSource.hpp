@@ -4,24 +4,78 @@ Copyright (c) 2016, GE Healthcare, Ultrasound.      */
 #pragma once
 
 #include "Image3dStream.hpp"
+#include "../Image3dCore/MipPyramid.hpp"
+#include "../Image3dCore/ThreadPool.hpp"
+#include "../Image3dCore/SharedFrameRing.hpp"
+#include "../Image3dCore/PerfCounters.hpp"
+#include "AsyncFrameQueue.hpp"
+#include "SyntheticFrames.hpp"
+#include "MappedFrames.hpp"
+#include "LiveFrames.hpp"
+#include <mutex>
 
 
 
 class ATL_NO_VTABLE Image3dSource :
     public CComObjectRootEx<CComMultiThreadModel>,
     public CComCoClass<Image3dSource, &__uuidof(Image3dSource)>,
-    public IImage3dSource {
+    public IImage3dSource9,
+    public IImage3dStats {
 public:
+    typedef PerfCounters<METHOD_PREFETCH_FRAMES + 1> SourceStats; ///< one histogram per Image3dMethod
+
     Image3dSource();
 
     /*NOT virtual*/ ~Image3dSource();
 
+    /** Replace the dataset with synthetic frames. Must be called before requesting any frames. Frames are synthesized on demand,
+        or by a producer thread for simulated live acquisition (SyntheticParams::rate). */
+    void Initialize(const SyntheticParams & params);
+
+    /** Replace the dataset with frames from a mapped MetaImage file. Must be called before requesting any frames.
+        Throws std::invalid_argument if the data file is too small. */
+    void Initialize(const MetaImageHeader & header, std::shared_ptr<const MappedFile> file);
+
     HRESULT STDMETHODCALLTYPE GetFrameCount(/*out*/unsigned int *size) override;
 
     HRESULT STDMETHODCALLTYPE GetFrameTimes(/*out*/SAFEARRAY * *frame_times) override;
 
     HRESULT STDMETHODCALLTYPE GetFrame(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], /*out*/Image3d *data) override;
 
+    HRESULT STDMETHODCALLTYPE GetFrameInterpolated(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE RecycleFrame(/*in,out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE GetBufferStats(/*out*/unsigned int *allocations, /*out*/unsigned int *reuses) override;
+
+    HRESULT STDMETHODCALLTYPE GetFrames(unsigned int first, unsigned int count, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3dSeries *data) override;
+
+    HRESULT STDMETHODCALLTYPE GetSlices(unsigned int index, SAFEARRAY * planes, unsigned short max_res[2], InterpolationMode interpolation, /*out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE CreateSharedRing(unsigned int slot_count, unsigned int slot_size, /*out*/BSTR *name) override;
+
+    HRESULT STDMETHODCALLTYPE GetFrameShared(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3dShared *data) override;
+
+    HRESULT STDMETHODCALLTYPE BeginGetFrame(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/unsigned int *request) override;
+
+    HRESULT STDMETHODCALLTYPE EndGetFrame(unsigned int request, unsigned int timeout_ms, /*out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE CancelGetFrame(unsigned int request) override;
+
+    HRESULT STDMETHODCALLTYPE PrefetchFrames(unsigned int first, unsigned int count, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation) override;
+
+    HRESULT STDMETHODCALLTYPE WaitForFrames(unsigned int known_count, unsigned int timeout_ms, /*out*/unsigned int *first_frame, /*out*/unsigned int *frame_count) override;
+
+    HRESULT STDMETHODCALLTYPE GetFrameColorMapped(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, ImageFormat format, /*out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE GetSlicesColorMapped(unsigned int index, SAFEARRAY * planes, unsigned short max_res[2], InterpolationMode interpolation, ImageFormat format, /*out*/Image3d *data) override;
+
+    HRESULT STDMETHODCALLTYPE GetMethodStats(Image3dMethod method, /*out*/MethodStats *stats) override;
+
+    HRESULT STDMETHODCALLTYPE GetResourceStats(/*out*/ResourceStats *stats) override;
+
+    HRESULT STDMETHODCALLTYPE ResetStats() override;
+
     HRESULT STDMETHODCALLTYPE GetBoundingBox(/*out*/Cart3dGeom *geom) override;
 
     HRESULT STDMETHODCALLTYPE GetColorMap(/*out*/SAFEARRAY ** map) override;
@@ -36,14 +90,46 @@ public:
 
     BEGIN_COM_MAP(Image3dSource)
         COM_INTERFACE_ENTRY(IImage3dSource)
+        COM_INTERFACE_ENTRY(IImage3dSource2)
+        COM_INTERFACE_ENTRY(IImage3dSource3)
+        COM_INTERFACE_ENTRY(IImage3dSource4)
+        COM_INTERFACE_ENTRY(IImage3dSource5)
+        COM_INTERFACE_ENTRY(IImage3dSource6)
+        COM_INTERFACE_ENTRY(IImage3dSource7)
+        COM_INTERFACE_ENTRY(IImage3dSource8)
+        COM_INTERFACE_ENTRY(IImage3dSource9)
+        COM_INTERFACE_ENTRY(IImage3dStats)
     END_COM_MAP()
 
 private:
-    ProbeInfo                m_probe;
-    EcgSeries                m_ecg;
-    std::array<R8G8B8A8,256> m_color_map_tissue;
-    Cart3dGeom               m_img_geom = {};
-    std::vector<Image3d>     m_frames;
+    /** Validate GetFrameInterpolated arguments, and fill in "request". */
+    HRESULT MakeFrameRequest(unsigned int index, Cart3dGeom out_geom, const unsigned short max_res[3], InterpolationMode interpolation, FrameRequest & request) const;
+
+    /** Frame index within the frames currently available. */
+    bool Available(unsigned int index) const;
+
+    /** Replace the dataset, and simulate an ECG trace spanning the frames (unless recorded by a live store). */
+    void Initialize(std::unique_ptr<FrameStore> frames);
+
+    /** Resample a frame into a new buffer. Called from the client thread or the background thread.
+        Samples are mapped into color pixels if a "color_map" is passed. */
+    HRESULT ResampleFrame(const FrameRequest & request, Image3d & result, const ColorMap * color_map = nullptr);
+
+    /** Shared implementation of GetSlices & GetSlicesColorMapped. */
+    HRESULT ResampleSlices(unsigned int index, SAFEARRAY * planes, const unsigned short max_res[2], InterpolationMode interpolation, const ColorMap * color_map, /*out*/Image3d *data);
+
+    ProbeInfo                   m_probe;
+    EcgSeries                   m_ecg;
+    std::array<R8G8B8A8,256>    m_color_map_tissue;
+    Cart3dGeom                  m_img_geom = {};
+    std::unique_ptr<FrameStore> m_frames; ///< frames & their reduced resolution levels
+    std::shared_ptr<ThreadPool> m_pool;    ///< loader-wide resampling threads
+    FrameBufferPool             m_buffers; ///< recycled GetFrame output buffers
+    std::mutex                  m_ring_mutex;
+    std::shared_ptr<SharedFrameRing> m_ring; ///< shared-memory frame transport (created on demand)
+    SourceStats                 m_stats;   ///< lock-free counters reported through IImage3dStats
+    std::atomic<unsigned int>   m_buffer_baseline[2]; ///< m_buffers allocations & reuses at the last ResetStats
+    AsyncFrameQueue             m_async;   ///< background resampling (must be destroyed before the members it accesses)
 };
 
 OBJECT_ENTRY_AUTO(__uuidof(Image3dSource), Image3dSource)
@@ -10,6 +10,8 @@ Copyright (c) 2020, GE Healthcare, Ultrasound.      */
 #include <vector>
 #include "../Image3dAPI/ComSupport.hpp"
 #include "../Image3dAPI/IImage3d.h"
+#include "../Image3dCore/Resample.hpp" // must be included after IImage3d.h to share its type definitions
+#include "FrameBufferPool.hpp"
 
 #include "DummyLoader.h"
 #include "Resource.h"
@@ -35,32 +37,88 @@ struct R8G8B8A8 {
     uint8_t a = 0;
 };
 
-/** Determine the sample size [bytes] for a given image format. */
-static unsigned int ImageFormatSize(ImageFormat format) {
-    switch (format) {
-    case FORMAT_U8: return 1;
-    }
-
-    abort(); // should never be reached
-}
-
-/** Create a Image3d object from a std::vector buffer. */
-static Image3d CreateImage3d (double time, ImageFormat format, const unsigned short dims[3], const std::vector<byte> &img_buf) {
-    assert(img_buf.size() == ImageFormatSize(format)*dims[0]*dims[1]*dims[2]);
-
+/** Create a Image3d object with packed storage. The buffer is left for the caller to fill in-place through ToView,
+    so that samples are written straight into the SAFEARRAY that is returned to the client.
+    The buffer is taken from "pool" if specified. Rows are padded to a multiple of "row_alignment" bytes, while planes remain packed.
+    Throws std::bad_alloc if the buffer exceeds 4GB. */
+static Image3d CreateImage3d (double time, ImageFormat format, const unsigned short dims[3], FrameBufferPool * pool = nullptr, unsigned int row_alignment = 1) {
     Image3d img;
     img.time = time;
     img.format = format;
     for (size_t i = 0; i < 3; ++i)
         img.dims[i] = dims[i];
 
-    CComSafeArray<BYTE> data(static_cast<unsigned int>(img_buf.size()));
-    memcpy(data.m_psa->pvData, img_buf.data(), img_buf.size());
-    img.data = data.Detach();
-
-    // assume packed storage
-    img.stride0 = dims[0] * ImageFormatSize(format);
+    const uint64_t row_size = static_cast<uint64_t>(dims[0]) * ImageFormatSize(format);
+    const uint64_t stride0 = (row_size + row_alignment - 1) / row_alignment * row_alignment;
+    const uint64_t size = stride0 * dims[1] * dims[2];
+    if (size > 0xFFFFFFFFu)
+        throw std::bad_alloc(); // exceeds SAFEARRAY size limit
+    img.stride0 = static_cast<unsigned int>(stride0);
     img.stride1 = dims[1] * img.stride0;
 
+    if (pool) {
+        img.data = pool->Acquire(static_cast<unsigned int>(size));
+    } else {
+        img.data = SafeArrayCreateVector(VT_UI1, 0, static_cast<unsigned int>(size));
+        if (!img.data)
+            throw std::bad_alloc();
+    }
+
     return img;
 }
+
+
+/** Create a Image3dSeries object with "count" frames of packed storage, to be filled in-place through ToView. */
+static Image3dSeries CreateImage3dSeries (unsigned int count, ImageFormat format, const unsigned short dims[3]) {
+    Image3dSeries series;
+    series.format = format;
+    for (size_t i = 0; i < 3; ++i)
+        series.dims[i] = dims[i];
+
+    // assume packed storage (strides computed in 64bit, so that they cannot wrap before the size check)
+    const uint64_t stride0 = static_cast<uint64_t>(dims[0]) * ImageFormatSize(format);
+    const uint64_t stride1 = dims[1] * stride0;
+    const uint64_t stride2 = dims[2] * stride1;
+    const uint64_t size = stride2 * count;
+    if ((stride2 > 0xFFFFFFFFull) || (size > 0xFFFFFFFFull))
+        throw std::bad_alloc(); // exceeds SAFEARRAY capacity
+    series.stride0 = static_cast<unsigned int>(stride0);
+    series.stride1 = static_cast<unsigned int>(stride1);
+    series.stride2 = static_cast<unsigned int>(stride2);
+
+    series.times = SafeArrayCreateVector(VT_R8, 0, count);
+    if (!series.times)
+        throw std::bad_alloc();
+    series.data = SafeArrayCreateVector(VT_UI1, 0, static_cast<unsigned int>(size));
+    if (!series.data)
+        throw std::bad_alloc();
+
+    return series;
+}
+
+
+/** Create a non-owning view of the buffer in an Image3d object. */
+static Image3dView ToView (const Image3d & img) {
+    Image3dView view;
+    view.time = img.time;
+    view.format = img.format;
+    for (size_t i = 0; i < 3; ++i)
+        view.dims[i] = img.dims[i];
+    view.stride0 = img.stride0;
+    view.stride1 = img.stride1;
+    view.data = static_cast<uint8_t*>(img.data->pvData);
+    return view;
+}
+
+/** Create a non-owning view of a frame in an Image3dSeries object. */
+static Image3dView ToView (const Image3dSeries & series, unsigned int frame) {
+    Image3dView view;
+    view.time = static_cast<const double*>(series.times->pvData)[frame];
+    view.format = series.format;
+    for (size_t i = 0; i < 3; ++i)
+        view.dims[i] = series.dims[i];
+    view.stride0 = series.stride0;
+    view.stride1 = series.stride1;
+    view.data = static_cast<uint8_t*>(series.data->pvData) + frame*static_cast<size_t>(series.stride2);
+    return view;
+}
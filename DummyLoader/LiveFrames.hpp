@@ -0,0 +1,184 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "SyntheticFrames.hpp"
+#include "../Image3dCore/LiveFrameRing.hpp"
+
+
+/** Simulated live acquisition. A producer thread synthesizes checkerboard frames at SyntheticParams::rate into a LiveFrameRing,
+    until SyntheticParams::frames are acquired. Only the SyntheticParams::window most recent frames remain available.
+    Frames are resampled straight from the ring slots, which are not overwritten while in use. */
+class LiveFrames : public FrameStore {
+public:
+    /** Start acquiring frames. Throws std::bad_alloc if the window doesn't fit in memory. */
+    LiveFrames (const SyntheticParams & params, std::shared_ptr<ThreadPool> pool) : m_params(params), m_geom(params.Geometry()), m_ring(params.format, params.dims, params.window), m_pool(pool) {
+        m_producer = std::thread([this] { Produce(); });
+    }
+
+    ~LiveFrames () override {
+        {
+            std::lock_guard<std::mutex> lock(m_stop_mutex);
+            m_stop = true;
+        }
+        m_stop_cv.notify_all();
+        m_producer.join();
+    }
+
+    unsigned int Count () const override {
+        return m_ring.Count();
+    }
+
+    ImageFormat Format () const override {
+        return m_params.format;
+    }
+
+    double Time (unsigned int index) const override {
+        return m_ring.Time(index);
+    }
+
+    double Duration () const override {
+        return static_cast<double>(Count())/m_params.rate;
+    }
+
+    Cart3dGeom Geometry () const override {
+        return m_geom;
+    }
+
+    /** Get a frame straight from its ring slot, which is kept until the frame is released.
+        Coarser pyramid levels are built per request, since the slot is soon reused. */
+    std::shared_ptr<const StoredFrame> Get (unsigned int index, ThreadPool & /*pool*/) override {
+        LiveFrameRing::Frame slot;
+        if (!m_ring.Acquire(index, slot))
+            return nullptr;
+
+        std::unique_ptr<StoredFrame> frame;
+        try {
+            frame.reset(new StoredFrame());
+            frame->view = slot.view;
+            frame->pyramid.reset(new MipPyramid(frame->view, m_geom, false));
+        } catch (...) {
+            m_ring.Release(slot);
+            throw;
+        }
+        const LiveFrameRing & ring = m_ring;
+        return std::shared_ptr<const StoredFrame>(frame.release(), [&ring, slot](const StoredFrame * ptr) {
+            delete ptr;
+            ring.Release(slot);
+        });
+    }
+
+    bool Live () const override {
+        return true;
+    }
+
+    unsigned int First () const override {
+        return m_ring.First();
+    }
+
+    bool WaitForFrames (unsigned int known_count, unsigned int timeout_ms) override {
+        m_ring.Wait(known_count, timeout_ms);
+        return !m_ring.Closed();
+    }
+
+    void GetECG (EcgSeries & ecg) const override {
+        std::vector<float>  samples;
+        std::vector<double> trig_times;
+        unsigned int first = 0, count = 0;
+        for (bool complete = false; !complete; ) {
+            // retry if the oldest frames are overwritten while copying
+            first = m_ring.First();
+            count = m_ring.Count();
+            samples.clear();
+            trig_times.clear();
+            complete = true;
+            for (unsigned int i = first; complete && (i < count); ++i) {
+                LiveFrameRing::EcgChunk chunk;
+                complete = m_ring.ReadEcg(i, chunk);
+                samples.insert(samples.end(), chunk.samples, chunk.samples + LiveFrameRing::ECG_SAMPLES);
+                if (chunk.trig)
+                    trig_times.push_back(chunk.trig_time);
+            }
+        }
+
+        CComSafeArray<float> sample_arr(static_cast<ULONG>(samples.size()));
+        if (!samples.empty())
+            memcpy(&sample_arr.GetAt(0), samples.data(), samples.size()*sizeof(float));
+        CComSafeArray<double> trig_arr(static_cast<ULONG>(trig_times.size()));
+        if (!trig_times.empty())
+            memcpy(&trig_arr.GetAt(0), trig_times.data(), trig_times.size()*sizeof(double));
+
+        EcgSeries result;
+        result.start_time = (first < count) ? m_ring.Time(first) : FrameTime(0);
+        result.delta_time = 1.0/(m_params.rate*LiveFrameRing::ECG_SAMPLES);
+        result.samples = sample_arr.Detach();
+        result.trig_times = trig_arr.Detach();
+        ecg = std::move(result);
+    }
+
+private:
+    LiveFrames (const LiveFrames &) = delete;
+    LiveFrames & operator = (const LiveFrames &) = delete;
+
+    /** Acquisition time of a frame [seconds]. Frames start at t = 10, as for recorded loops. */
+    double FrameTime (unsigned int index) const {
+        return 10.0 + static_cast<double>(index)/m_params.rate;
+    }
+
+    /** Same sine-wave ECG as for recorded loops, with a trig every 1/2 sec. */
+    LiveFrameRing::EcgChunk MakeEcg (unsigned int index) const {
+        LiveFrameRing::EcgChunk ecg;
+        const double delta_time = 1.0/(m_params.rate*LiveFrameRing::ECG_SAMPLES);
+        for (unsigned int i = 0; i < LiveFrameRing::ECG_SAMPLES; ++i)
+            ecg.samples[i] = static_cast<float>(sin(4*M_PI*(index*LiveFrameRing::ECG_SAMPLES + i)*delta_time));
+
+        const double begin = FrameTime(index) - 10.0;
+        const double trig = std::ceil(2*begin)/2;
+        if (trig < FrameTime(index + 1) - 10.0) {
+            ecg.trig = true;
+            ecg.trig_time = 10.0 + trig;
+        }
+        return ecg;
+    }
+
+    void Produce () {
+        const auto start = std::chrono::steady_clock::now();
+        try {
+            for (unsigned int i = 0; i < m_params.frames; ++i) {
+                {
+                    // wait for the acquisition time of the frame
+                    std::unique_lock<std::mutex> lock(m_stop_mutex);
+                    if (m_stop_cv.wait_until(lock, start + std::chrono::microseconds(1000000ull*i/m_params.rate), [this] { return m_stop; }))
+                        break;
+                }
+
+                const Image3dView out = m_ring.BeginWrite(FrameTime(i));
+                if (!out.data)
+                    continue; // dropped, since all slots are being read
+                SynthesizeFrame(m_params, i, *m_pool, out);
+                m_ring.EndWrite(MakeEcg(i));
+            }
+        } catch (const std::bad_alloc &) {
+            // stop acquiring
+        }
+        m_ring.Close();
+    }
+
+    const SyntheticParams       m_params;
+    const Cart3dGeom            m_geom;
+    LiveFrameRing               m_ring;
+    std::shared_ptr<ThreadPool> m_pool;
+    std::mutex                  m_stop_mutex;
+    std::condition_variable     m_stop_cv;
+    bool                        m_stop = false; ///< protected by m_stop_mutex
+    std::thread                 m_producer;     ///< must be started after the members it accesses are initialized
+};
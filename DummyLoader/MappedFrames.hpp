@@ -0,0 +1,95 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "FrameStore.hpp"
+#include "../Image3dCore/MetaImage.hpp"
+
+
+/** Frames of a MetaImage volume sequence, resampled straight from the mapped data file without copying (also with DUMMYLOADER_LAYOUT=bricked).
+    Pages are read from disk by the OS when first touched by resampling. Coarser pyramid levels are built on demand, and the most recently
+    used frames are kept with their levels up to CACHE_FRAMES frames and CACHE_MB of levels. */
+class MappedFrames : public FrameStore {
+public:
+    static const unsigned int CACHE_FRAMES = 64;  ///< max. number of frames kept (the last frame used is always kept)
+    static const size_t       CACHE_MB     = 256; ///< max. size of pyramid levels kept [MB]
+
+    /** Throws std::invalid_argument if the data file is too small for the header, or the data misaligned. */
+    MappedFrames (const MetaImageHeader & header, std::shared_ptr<const MappedFile> file) : m_header(header), m_file(file), m_geom(header.Geometry()) {
+        m_data_offset = static_cast<size_t>(header.DataOffset(file->Size()));
+    }
+
+    unsigned int Count () const override {
+        return m_header.frames;
+    }
+
+    ImageFormat Format () const override {
+        return m_header.format;
+    }
+
+    double Time (unsigned int index) const override {
+        return index*m_header.spacing[3];
+    }
+
+    double Duration () const override {
+        return m_header.frames*m_header.spacing[3];
+    }
+
+    Cart3dGeom Geometry () const override {
+        return m_geom;
+    }
+
+    /** Get a view of a frame in the mapped file. No voxels are read. */
+    std::shared_ptr<const StoredFrame> Get (unsigned int index, ThreadPool & /*pool*/) override {
+        assert(index < m_header.frames);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+            if (it->first == index) {
+                m_cache.splice(m_cache.begin(), m_cache, it); // move to front (most recently used)
+                Trim(); // account for pyramid levels built since
+                return m_cache.front().second;
+            }
+        }
+
+        auto frame = std::make_shared<StoredFrame>();
+        uint8_t * data = const_cast<uint8_t*>(m_file->Data()) + m_data_offset + index*static_cast<size_t>(m_header.FrameSize()); // read-only pages, that are never written
+        frame->view = Image3dView::Packed(Time(index), m_header.format, m_header.dims, data);
+        frame->pyramid.reset(new MipPyramid(frame->view, m_geom));
+        m_cache.emplace_front(index, frame);
+
+        Trim();
+        return frame;
+    }
+
+private:
+    MappedFrames (const MappedFrames &) = delete;
+    MappedFrames & operator = (const MappedFrames &) = delete;
+
+    /** Evict least recently used frames beyond the limits (frames in use are kept alive by their callers). Must be called with m_mutex locked. */
+    void Trim () {
+        const size_t budget = CACHE_MB << 20;
+        size_t size = 0;
+        unsigned int count = 0;
+        for (auto it = m_cache.begin(); it != m_cache.end(); ) {
+            size += it->second->pyramid->BuiltSize();
+            if ((it != m_cache.begin()) && ((size > budget) || (count >= CACHE_FRAMES))) {
+                it = m_cache.erase(it);
+            } else {
+                ++count;
+                ++it;
+            }
+        }
+    }
+
+    const MetaImageHeader                    m_header;
+    const std::shared_ptr<const MappedFile>  m_file;
+    const Cart3dGeom                         m_geom;
+    size_t                                   m_data_offset = 0;
+    std::mutex                               m_mutex;
+    std::list<std::pair<unsigned int, std::shared_ptr<const StoredFrame>>> m_cache; ///< most recently used first (protected by m_mutex)
+};
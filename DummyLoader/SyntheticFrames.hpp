@@ -0,0 +1,302 @@
+/* Dummy test loader for the "3D API".
+Designed by Fredrik Orderud <fredrik.orderud@ge.com>.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "FrameStore.hpp"
+
+
+/** Synthetic checkerboard dataset description. Defaults to a small one second loop.
+    Can be overridden through "key=value" parameters appended to the LoadFile file name after a '?', e.g.
+    "dummy.dcm?dims=512x512x512&frames=100" (see Parse). A live acquisition is simulated if a volume rate is specified, e.g. "dummy.dcm?rate=30&frames=10000". */
+struct SyntheticParams {
+    static const unsigned int FRAME_RATE = 25; ///< [frames/second]
+
+    unsigned short dims[3]   = { 20, 15, 10 };            ///< resolution (width/columns, height/rows, planes)
+    unsigned int   frames    = 25;                        ///< frame count
+    ImageFormat    format    = FORMAT_U8;
+    float          extent[3] = { 0.20f, 0.10f, 0.15f };   ///< width, depth & elevation [m]
+    size_t         cache_mb  = 256;                       ///< max. size of synthesized frames kept, incl. their pyramid levels [MB] (the last frame used is always kept)
+    unsigned int   rate      = 0;                         ///< live acquisition volume rate [frames/second] until "frames" are acquired, or 0 for a recorded loop
+    unsigned int   window    = 32;                        ///< live frames kept available (older frames are overwritten)
+    bool           compress  = false;                     ///< keep recorded frames run-length compressed, and decompress bricks on demand
+
+    /** Parse parameters from a file name. Supported keys are
+        dims=WxHxD (voxels), frames=N, format=u8|u16|f32, extent=WxHxD (meters), cache=MB, rate=N (volumes/s), window=N (frames) and compress=rle|none.
+        Throws std::invalid_argument on unknown keys or malformed values. */
+    static SyntheticParams Parse (const std::wstring & file_name) {
+        SyntheticParams params;
+        const size_t query = file_name.find(L'?');
+        if (query == std::wstring::npos)
+            return params; // defaults
+
+        size_t begin = query + 1;
+        while (begin < file_name.size()) {
+            size_t end = file_name.find(L'&', begin);
+            if (end == std::wstring::npos)
+                end = file_name.size();
+            const std::wstring item = file_name.substr(begin, end - begin);
+            begin = end + 1;
+
+            const size_t eq = item.find(L'=');
+            if (eq == std::wstring::npos)
+                throw std::invalid_argument("missing '=' in dataset parameter");
+            const std::wstring key = item.substr(0, eq);
+            const std::wstring val = item.substr(eq + 1);
+
+            if (key == L"dims") {
+                double vals[3] = {};
+                ParseTriple(val, vals);
+                for (int i = 0; i < 3; ++i) {
+                    if ((vals[i] < 1) || (vals[i] > 0xFFFF) || (vals[i] != static_cast<unsigned short>(vals[i])))
+                        throw std::invalid_argument("dims out of range");
+                    params.dims[i] = static_cast<unsigned short>(vals[i]);
+                }
+            } else if (key == L"frames") {
+                params.frames = static_cast<unsigned int>(ParseCount(val, 1, 100000));
+            } else if (key == L"format") {
+                if (val == L"u8")
+                    params.format = FORMAT_U8;
+                else if (val == L"u16")
+                    params.format = FORMAT_U16;
+                else if (val == L"f32")
+                    params.format = FORMAT_F32;
+                else
+                    throw std::invalid_argument("unsupported format");
+            } else if (key == L"extent") {
+                double vals[3] = {};
+                ParseTriple(val, vals);
+                for (int i = 0; i < 3; ++i) {
+                    if (!(vals[i] > 0) || !(vals[i] < 100))
+                        throw std::invalid_argument("extent out of range");
+                    params.extent[i] = static_cast<float>(vals[i]);
+                }
+            } else if (key == L"cache") {
+                params.cache_mb = ParseCount(val, 0, 1 << 20);
+            } else if (key == L"rate") {
+                params.rate = static_cast<unsigned int>(ParseCount(val, 1, 1000));
+            } else if (key == L"window") {
+                params.window = static_cast<unsigned int>(ParseCount(val, 1, 4096));
+            } else if (key == L"compress") {
+                if ((val != L"rle") && (val != L"none"))
+                    throw std::invalid_argument("unsupported compression");
+                params.compress = (val == L"rle");
+            } else {
+                throw std::invalid_argument("unknown dataset parameter");
+            }
+        }
+        return params;
+    }
+
+    /** Volume geometry, centered below the probe in width & elevation. */
+    Cart3dGeom Geometry () const {
+        Cart3dGeom geom = { -extent[0]/2, 0,         -extent[2]/2, // origin
+                             extent[0],   0,          0,           // dir1 (width)
+                             0,           extent[1],  0,           // dir2 (depth)
+                             0,           0,          extent[2] }; // dir3 (elevation)
+        return geom;
+    }
+
+    /** Time of a frame [seconds]. Frames start at t = 10, in a loop matching the ECG. */
+    double FrameTime (unsigned int index) const {
+        return 10.0 + index*(Duration()/frames);
+    }
+
+    /** Duration of the loop [seconds]. */
+    double Duration () const {
+        return static_cast<double>(frames)/FRAME_RATE;
+    }
+
+private:
+    static size_t ParseCount (const std::wstring & val, size_t min_val, size_t max_val) {
+        wchar_t * end = nullptr;
+        const unsigned long long count = wcstoull(val.c_str(), &end, 10);
+        if (val.empty() || (*end != L'\0') || (count < min_val) || (count > max_val))
+            throw std::invalid_argument("invalid dataset parameter value");
+        return static_cast<size_t>(count);
+    }
+
+    /** Parse "AxBxC". */
+    static void ParseTriple (const std::wstring & val, double out[3]) {
+        const wchar_t * pos = val.c_str();
+        for (int i = 0; i < 3; ++i) {
+            wchar_t * end = nullptr;
+            out[i] = wcstod(pos, &end);
+            if ((end == pos) || (*end != ((i < 2) ? L'x' : L'\0')))
+                throw std::invalid_argument("expected AxBxC dataset parameter value");
+            pos = end + 1;
+        }
+    }
+};
+
+
+/** Sample value of an 8bit gray level, scaled to the full 16bit range or to [0,1] for float. */
+template <class T>
+static T GrayLevel (uint8_t gray) {
+    return std::numeric_limits<T>::is_integer ? static_cast<T>(gray*(std::numeric_limits<T>::max()/255)) : static_cast<T>(gray/255.0f);
+}
+
+/** Synthesize a checkerboard frame into "out", with squares alternating between frame pairs,
+    and a special gray value for the plane closest to the probe. */
+template <class T>
+static void SynthesizeFrameAs (const SyntheticParams & params, unsigned int index, ThreadPool & pool, const Image3dView & out) {
+    assert(ImageFormatSize(out.format) == sizeof(T));
+    const T PROBE_PLANE = GrayLevel<T>(127); // gray value for plane closest to probe
+    const T BLACK = GrayLevel<T>(0), WHITE = GrayLevel<T>(255);
+
+    const unsigned int square = std::max(2, params.dims[0]/10); // square size [voxels] (2 for the default resolution)
+    const bool even_f = (index / 2 % 2) == 0;
+    const unsigned short width = out.dims[0];
+    const unsigned short height = out.dims[1];
+    const unsigned int grain = std::max(1u, 64*1024u/std::max<unsigned int>(width, 1)); // min. rows per tile to amortize scheduling overhead
+    pool.ParallelFor(static_cast<unsigned int>(height)*out.dims[2], grain, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int row = begin; row < end; ++row) {
+            const unsigned int y = row % height;
+            const unsigned int z = row / height;
+            T * out_row = reinterpret_cast<T*>(out.data + y*static_cast<size_t>(out.stride0) + z*static_cast<size_t>(out.stride1));
+            if (y == 0) {
+                std::fill(out_row, out_row + width, PROBE_PLANE);
+                continue;
+            }
+
+            // runs of "square" voxels alternating between black & white
+            const bool even_y = (y / square % 2) == 0;
+            const bool even_z = (z / square % 2) == 0;
+            bool white = !(even_f ^ even_y ^ even_z); // x run 0 is even
+            for (unsigned int x = 0; x < width; x += square) {
+                std::fill(out_row + x, out_row + x + std::min(square, width - x), white ? WHITE : BLACK);
+                white = !white;
+            }
+        }
+    });
+}
+
+/** Synthesize a checkerboard frame of any format (see SynthesizeFrameAs). */
+static void SynthesizeFrame (const SyntheticParams & params, unsigned int index, ThreadPool & pool, const Image3dView & out) {
+    switch (out.format) {
+    case FORMAT_U8:  SynthesizeFrameAs<uint8_t>(params, index, pool, out); break;
+    case FORMAT_U16: SynthesizeFrameAs<uint16_t>(params, index, pool, out); break;
+    case FORMAT_F32: SynthesizeFrameAs<float>(params, index, pool, out); break;
+    default: abort(); // should never be reached
+    }
+}
+
+
+/** Lazily synthesized frames, so that large datasets open instantly with bounded memory use.
+    Frames are synthesized on first request, and the most recently used frames are kept up to the SyntheticParams::cache_mb budget.
+    With SyntheticParams::compress, frames are kept as compressed bricks, so that many more frames fit in the budget. Bricks are then decompressed
+    when first resampled, and the decompressed bricks of less recently used frames are discarded before evicting compressed frames.
+    Thread-safe. Concurrent first requests for the same frame might synthesize it more than once (see MipPyramid). */
+class SyntheticFrames : public FrameStore {
+public:
+    SyntheticFrames (const SyntheticParams & params, bool bricked) : m_params(params), m_geom(params.Geometry()), m_bricked(bricked) {
+    }
+
+    unsigned int Count () const override {
+        return m_params.frames;
+    }
+
+    ImageFormat Format () const override {
+        return m_params.format;
+    }
+
+    double Time (unsigned int index) const override {
+        return m_params.FrameTime(index);
+    }
+
+    double Duration () const override {
+        return m_params.Duration();
+    }
+
+    Cart3dGeom Geometry () const override {
+        return m_geom;
+    }
+
+    /** Get a frame, synthesizing it if not kept from a previous request. */
+    std::shared_ptr<const StoredFrame> Get (unsigned int index, ThreadPool & pool) override {
+        assert(index < m_params.frames);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+                if (it->first == index) {
+                    m_cache.splice(m_cache.begin(), m_cache, it); // move to front (most recently used)
+                    Trim(); // account for pyramid levels built & bricks decompressed since
+                    return m_cache.front().second;
+                }
+            }
+        }
+
+        // synthesize outside the lock, so that other frames can be served meanwhile
+        auto frame = std::make_shared<StoredFrame>();
+        frame->buffer.resize(static_cast<size_t>(m_params.dims[0])*m_params.dims[1]*m_params.dims[2]*ImageFormatSize(m_params.format));
+        frame->view = Image3dView::Packed(Time(index), m_params.format, m_params.dims, frame->buffer.data());
+        SynthesizeFrame(m_params, index, pool, frame->view);
+        if (m_params.compress && (m_params.format == FORMAT_U8) && CompressedVolume::Supported(m_params.dims)) {
+            std::unique_ptr<CompressedVolume> compressed(new CompressedVolume(frame->view, pool));
+            frame->pyramid.reset(new MipPyramid(std::move(compressed), m_geom));
+            frame->view.data = nullptr;
+            std::vector<uint8_t>().swap(frame->buffer);
+        } else {
+            frame->pyramid.reset(new MipPyramid(frame->view, m_geom, m_bricked));
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_cache.begin(); it != m_cache.end(); ++it) {
+            if (it->first == index) {
+                m_cache.erase(it); // synthesized concurrently by another thread (replace)
+                break;
+            }
+        }
+        m_cache.emplace_front(index, frame);
+
+        Trim();
+        return frame;
+    }
+
+private:
+    SyntheticFrames (const SyntheticFrames &) = delete;
+    SyntheticFrames & operator = (const SyntheticFrames &) = delete;
+
+    /** Evict least recently used frames beyond the budget (frames in use are kept alive by their callers). Must be called with m_mutex locked.
+        Frames are accounted with their coarser pyramid levels and bricked or compressed copies. */
+    void Trim () {
+        const size_t budget = m_params.cache_mb << 20;
+        size_t size = 0;
+        for (auto it = m_cache.begin(); it != m_cache.end(); ) {
+            const MipPyramid & pyramid = *it->second->pyramid;
+            size += it->second->buffer.size() + pyramid.BuiltSize();
+            if (const BrickedVolume * bricked = pyramid.Bricked())
+                size += bricked->Size();
+            if (CompressedVolume * compressed = pyramid.Compressed()) {
+                size += compressed->CompressedSize();
+                const size_t decoded = compressed->DecodedSize();
+                if ((it != m_cache.begin()) && (size + decoded > budget))
+                    compressed->Discard(); // drop decompressed bricks first
+                else
+                    size += decoded;
+            }
+            if ((it != m_cache.begin()) && (size > budget))
+                it = m_cache.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    const SyntheticParams m_params;
+    const Cart3dGeom      m_geom;
+    const bool            m_bricked;
+    std::mutex            m_mutex;
+    std::list<std::pair<unsigned int, std::shared_ptr<const StoredFrame>>> m_cache; ///< most recently used first (protected by m_mutex)
+};
@@ -0,0 +1,155 @@
+/* Tests of the host-side FrameCache behind Image3dSourceCache, run by ctest.
+A counting fake loader checks that concurrent requests are collapsed into a single load, and that the byte budget is kept through CLOCK eviction. */
+#include "../Image3dAPI/FrameCache.hpp"
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+
+typedef std::vector<uint8_t>   Frame;
+typedef FrameCache<int, Frame> Cache;
+
+static bool s_all_ok = true;
+
+static void Check (const char * name, bool ok) {
+    std::cout << "  " << std::left << std::setw(44) << name << (ok ? "OK" : "FAILED") << "\n";
+    s_all_ok &= ok;
+}
+
+
+/** Fake loader, that counts its calls and produces frames of "size" bytes filled with the key. */
+class CountingLoader {
+public:
+    explicit CountingLoader (size_t size, std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : m_size(size), m_delay(delay) {
+    }
+
+    std::shared_ptr<const Frame> Get (Cache & cache, int key) {
+        return cache.Get(key, [this, key](size_t & bytes) {
+            ++calls;
+            while (arrived < expected)
+                std::this_thread::yield();
+            std::this_thread::sleep_for(m_delay); // slow load, so that concurrent requests reach the cache meanwhile
+            if (fail)
+                throw std::runtime_error("load failed");
+            bytes = m_size;
+            return std::make_shared<const Frame>(m_size, static_cast<uint8_t>(key));
+        });
+    }
+
+    std::atomic<unsigned int> calls{0};
+    std::atomic<bool>         fail{false};
+    std::atomic<unsigned int> arrived{0}; ///< callers about to request a frame
+    unsigned int              expected = 0; ///< callers to wait for before loading
+
+private:
+    const size_t                    m_size;
+    const std::chrono::milliseconds m_delay;
+};
+
+/** Request "key" from "threads" threads at once. Returns the number of requests that failed. */
+static unsigned int ConcurrentGet (Cache & cache, CountingLoader & loader, int key, unsigned int threads, bool & all_valid) {
+    std::atomic<bool> start(false);
+    std::atomic<unsigned int> failures(0), invalid(0);
+    loader.arrived = 0;
+    loader.expected = threads;
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < threads; ++i) {
+        workers.emplace_back([&]() {
+            while (!start)
+                std::this_thread::yield();
+            ++loader.arrived;
+            try {
+                std::shared_ptr<const Frame> frame = loader.Get(cache, key);
+                if (!frame || frame->empty() || ((*frame)[0] != key))
+                    ++invalid;
+            } catch (const std::runtime_error &) {
+                ++failures;
+            }
+        });
+    }
+    start = true;
+    for (std::thread & worker : workers)
+        worker.join();
+    loader.expected = 0;
+    all_valid = (invalid == 0);
+    return failures;
+}
+
+
+int main () {
+    const unsigned int THREADS = 16;
+
+    std::cout << "Concurrent requests:\n";
+    {
+        Cache cache(1024);
+        CountingLoader loader(100, std::chrono::milliseconds(50));
+        bool valid = false;
+        const unsigned int failures = ConcurrentGet(cache, loader, 7, THREADS, valid);
+        const Cache::Stats stats = cache.GetStats();
+        Check("identical requests call the loader once", (loader.calls == 1) && (failures == 0) && valid);
+        Check("other requests collapsed or hit", (stats.misses == 1) && (stats.collapsed + stats.hits == THREADS - 1));
+        Check("later request is a hit", loader.Get(cache, 7) && (loader.calls == 1) && (cache.GetStats().hits == stats.hits + 1));
+    }
+    {
+        Cache cache(1024);
+        CountingLoader loader(100, std::chrono::milliseconds(50));
+        loader.fail = true;
+        bool valid = false;
+        const unsigned int failures = ConcurrentGet(cache, loader, 3, THREADS, valid);
+        Check("failed load forwarded to all waiters", (loader.calls == 1) && (failures == THREADS));
+        loader.fail = false;
+        Check("failed load is not cached", loader.Get(cache, 3) && (loader.calls == 2) && (cache.GetStats().entries == 1));
+    }
+
+    std::cout << "Byte budget:\n";
+    {
+        Cache cache(300);
+        CountingLoader loader(100);
+        for (int key = 0; key < 3; ++key)
+            loader.Get(cache, key);
+        Check("frames within budget are kept", (cache.GetStats().entries == 3) && (cache.GetStats().bytes == 300) && (cache.GetStats().evictions == 0));
+
+        // all frames are referenced since insertion, so the sweep clears them and evicts the oldest
+        loader.Get(cache, 3);
+        Cache::Stats stats = cache.GetStats();
+        Check("exceeding budget evicts", (stats.evictions == 1) && (stats.entries == 3) && (stats.bytes <= 300));
+        loader.Get(cache, 0);
+        Check("oldest frame evicted first", loader.calls == 5);
+
+        // the reference bit gives frame 2 a second chance, so that the unreferenced frame 3 is evicted instead
+        const unsigned int calls = loader.calls;
+        loader.Get(cache, 2);
+        loader.Get(cache, 4);
+        loader.Get(cache, 2);
+        Check("referenced frame gets a second chance", loader.calls == calls + 1);
+        loader.Get(cache, 3);
+        Check("unreferenced frame evicted", loader.calls == calls + 2);
+        Check("budget kept", cache.GetStats().bytes <= 300);
+    }
+    {
+        Cache cache(300);
+        CountingLoader loader(400);
+        Check("frame above budget is returned", loader.Get(cache, 1) && (cache.GetStats().entries == 0) && (cache.GetStats().bytes == 0));
+        loader.Get(cache, 1);
+        Check("frame above budget is not cached", loader.calls == 2);
+    }
+    {
+        Cache cache(1000);
+        CountingLoader loader(100);
+        std::shared_ptr<const Frame> held = loader.Get(cache, 5);
+        for (int key = 0; key < 5; ++key)
+            loader.Get(cache, key);
+        cache.SetBudget(200);
+        Check("lowering budget evicts immediately", (cache.GetStats().bytes <= 200) && (cache.GetStats().evictions == 4));
+        Check("evicted frame stays valid for holders", (held->size() == 100) && ((*held)[0] == 5));
+        cache.Clear();
+        Check("clear drops all frames", (cache.GetStats().entries == 0) && (cache.GetStats().bytes == 0));
+    }
+
+    std::cout << (s_all_ok ? "All tests passed\n" : "Some tests FAILED\n");
+    return s_all_ok ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+/* "Plugin API" host-side cache of loader results.
+Portable, without COM dependencies (see Image3dSourceCache.hpp for the IImage3dSource wrapper).
+Copyright (c) 2020, GE Healthcare, Ultrasound.           */
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+
+/** Thread-safe memoization of loader results, where the summed size of cached values is kept within a byte budget through
+    CLOCK (second-chance) eviction. Concurrent requests for the same key are collapsed into a single load, with the other
+    callers waiting for its result. Values are immutable and shared, so evicted values stay valid for callers still holding them. */
+template <class Key, class Value, class Hash = std::hash<Key>>
+class FrameCache {
+public:
+    /** Produce the value of a key, and report its size [bytes]. Exceptions are forwarded to every caller waiting for the key. */
+    typedef std::function<std::shared_ptr<const Value>(size_t & bytes)> LoadFn;
+
+    struct Stats {
+        uint64_t hits      = 0; ///< requests served from the cache
+        uint64_t misses    = 0; ///< requests that loaded the value themselves
+        uint64_t collapsed = 0; ///< requests that waited for a load started by another caller
+        uint64_t evictions = 0;
+        size_t   entries   = 0; ///< values currently cached
+        size_t   bytes     = 0; ///< size of values currently cached
+    };
+
+    explicit FrameCache (size_t budget) : m_budget(budget) {
+    }
+
+    /** Get a cached value, or load it through "load" on a miss. The load runs without holding the cache lock.
+        Failed loads are not cached, and values exceeding the budget are returned without being cached. */
+    std::shared_ptr<const Value> Get (const Key & key, const LoadFn & load) {
+        std::shared_ptr<Entry> entry;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(key);
+            if (it != m_entries.end()) {
+                entry = it->second;
+                if (!entry->loading) {
+                    ++m_stats.hits;
+                    entry->referenced = true;
+                    return entry->value;
+                }
+
+                ++m_stats.collapsed;
+                m_loaded.wait(lock, [&]() { return !entry->loading; });
+                if (entry->error)
+                    std::rethrow_exception(entry->error);
+                return entry->value;
+            }
+
+            ++m_stats.misses;
+            entry = std::make_shared<Entry>();
+            m_entries.emplace(key, entry);
+        }
+
+        std::shared_ptr<const Value> value;
+        size_t bytes = 0;
+        std::exception_ptr error;
+        try {
+            value = load(bytes);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry->loading = false;
+            entry->value = value;
+            entry->error = error;
+            entry->bytes = bytes;
+            if (error || !value || (bytes > m_budget)) {
+                m_entries.erase(key); // waiting callers still get the result through "entry"
+            } else {
+                // insert behind the clock hand, with the reference bit set so that it outlives one sweep
+                entry->referenced = true;
+                m_ring.insert(m_hand, key);
+                m_bytes += bytes;
+                Evict();
+            }
+        }
+        m_loaded.notify_all();
+
+        if (error)
+            std::rethrow_exception(error);
+        return value;
+    }
+
+    /** Change the byte budget. Values are evicted immediately if exceeding the new budget. */
+    void SetBudget (size_t budget) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        Evict();
+    }
+
+    /** Drop all cached values. Loads in progress are unaffected. */
+    void Clear () {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const Key & key : m_ring)
+            m_entries.erase(key);
+        m_ring.clear();
+        m_hand = m_ring.end();
+        m_bytes = 0;
+    }
+
+    Stats GetStats () const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Stats stats = m_stats;
+        stats.entries = m_ring.size();
+        stats.bytes = m_bytes;
+        return stats;
+    }
+
+private:
+    struct Entry {
+        bool                              loading = true;
+        bool                              referenced = false; ///< accessed since the clock hand last passed
+        std::shared_ptr<const Value>      value;
+        std::exception_ptr                error;
+        size_t                            bytes = 0;
+    };
+
+    /** Advance the clock hand until the cached values fit within the budget. Must be called with m_mutex held. */
+    void Evict () {
+        while ((m_bytes > m_budget) && !m_ring.empty()) {
+            if (m_hand == m_ring.end())
+                m_hand = m_ring.begin();
+
+            auto it = m_entries.find(*m_hand);
+            Entry & entry = *it->second;
+            if (entry.referenced) {
+                entry.referenced = false; // second chance
+                ++m_hand;
+                continue;
+            }
+
+            m_bytes -= entry.bytes;
+            m_hand = m_ring.erase(m_hand);
+            m_entries.erase(it);
+            ++m_stats.evictions;
+        }
+    }
+
+    mutable std::mutex                                    m_mutex;
+    std::condition_variable                               m_loaded;  ///< signaled whenever a load completes
+    size_t                                                m_budget = 0;
+    size_t                                                m_bytes = 0;
+    std::unordered_map<Key, std::shared_ptr<Entry>, Hash> m_entries; ///< cached & loading values
+    std::list<Key>                                        m_ring;    ///< cached values in clock order
+    typename std::list<Key>::iterator                     m_hand = m_ring.end();
+    Stats                                                 m_stats;
+};
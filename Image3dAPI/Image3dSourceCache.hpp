@@ -0,0 +1,227 @@
+/* "Plugin API" host-side caching wrapper for IImage3dSource.
+Copyright (c) 2020, GE Healthcare, Ultrasound.           */
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include "ComSupport.hpp"
+#include "IImage3d.h"
+#include "FrameCache.hpp"
+
+
+/** Frame request parameters identifying a cached frame. */
+struct FrameCacheKey {
+    unsigned int      index = 0;
+    Cart3dGeom        geom = {};
+    unsigned short    max_res[3] = {0,0,0};
+    InterpolationMode interpolation = INTERPOLATION_NEAREST;
+
+    bool operator == (const FrameCacheKey & other) const {
+        return (index == other.index) && (memcmp(&geom, &other.geom, sizeof(geom)) == 0) && (memcmp(max_res, other.max_res, sizeof(max_res)) == 0) && (interpolation == other.interpolation);
+    }
+};
+
+/** FNV-1a hash of the key fields. */
+struct FrameCacheKeyHash {
+    size_t operator () (const FrameCacheKey & key) const {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void * data, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ull;
+        };
+        mix(&key.index, sizeof(key.index));
+        mix(&key.geom, sizeof(key.geom));
+        mix(key.max_res, sizeof(key.max_res));
+        mix(&key.interpolation, sizeof(key.interpolation));
+        return static_cast<size_t>(hash);
+    }
+};
+
+
+/** IImage3dSource wrapper that memoizes GetFrame & GetFrameInterpolated results within a byte budget, as recommended in Guidelines.md
+    for hosts instead of caching inside the loader. Metadata (frame count & times, bounding box, color map, ECG, probe info and UID) is
+    fetched once. Concurrent requests for the same frame are collapsed into a single loader call. Clients receive a copy of the cached frame.
+    Not suitable for live sources (IImage3dSource8), where the frame count grows over time.
+
+    Usage:
+        CComPtr<Image3dSourceCache> cached = Image3dSourceCache::Create(source, 512*1024*1024); */
+class ATL_NO_VTABLE Image3dSourceCache :
+    public CComObjectRootEx<CComMultiThreadModel>,
+    public IImage3dSource2 {
+public:
+    typedef FrameCache<FrameCacheKey, Image3d, FrameCacheKeyHash> Cache;
+
+    /** Wrap "source" with a frame cache of up to "budget" bytes. */
+    static CComPtr<Image3dSourceCache> Create (IImage3dSource * source, size_t budget) {
+        if (!source)
+            throw std::invalid_argument("Image3dSourceCache: null source");
+
+        CComPtr<Image3dSourceCache> obj = CreateLocalInstance<Image3dSourceCache>();
+        obj->m_source = source;
+        obj->m_source2 = source; // QueryInterface
+        obj->m_frames.reset(new Cache(budget));
+        return obj;
+    }
+
+    /** Change the byte budget of cached frames. */
+    void SetBudget (size_t budget) {
+        m_frames->SetBudget(budget);
+    }
+
+    /** Drop all cached frames, e.g. to release memory. Metadata is kept. */
+    void Clear () {
+        m_frames->Clear();
+    }
+
+    Cache::Stats GetStats () const {
+        return m_frames->GetStats();
+    }
+
+    HRESULT STDMETHODCALLTYPE GetFrameCount(/*out*/unsigned int *size) override {
+        if (!size)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_frame_count, [this](unsigned int & count) { return m_source->GetFrameCount(&count); }, [size](const unsigned int & count) {
+            *size = count;
+            return S_OK;
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetFrameTimes(/*out*/SAFEARRAY * *frame_times) override {
+        if (!frame_times)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_frame_times, [this](CComSafeArray<double> & times) { return m_source->GetFrameTimes(times.GetSafeArrayPtr()); }, [frame_times](CComSafeArray<double> & times) {
+            return times.CopyTo(frame_times);
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetFrame(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], /*out*/Image3d *data) override {
+        return GetFrameInterpolated(index, out_geom, max_res, INTERPOLATION_NEAREST, data);
+    }
+
+    HRESULT STDMETHODCALLTYPE GetFrameInterpolated(unsigned int index, Cart3dGeom out_geom, unsigned short max_res[3], InterpolationMode interpolation, /*out*/Image3d *data) override {
+        if (!data || !max_res)
+            return E_INVALIDARG;
+        if ((interpolation != INTERPOLATION_NEAREST) && !m_source2)
+            return E_NOTIMPL; // wrapped source lacks interpolation support
+
+        FrameCacheKey key;
+        key.index = index;
+        key.geom = out_geom;
+        for (size_t i = 0; i < 3; ++i)
+            key.max_res[i] = max_res[i];
+        key.interpolation = interpolation;
+
+        try {
+            std::shared_ptr<const Image3d> frame = m_frames->Get(key, [&](size_t & bytes) {
+                auto result = std::make_shared<Image3d>();
+                unsigned short res[3] = { key.max_res[0], key.max_res[1], key.max_res[2] };
+                HRESULT hr = m_source2 ? m_source2->GetFrameInterpolated(key.index, key.geom, res, key.interpolation, result.get())
+                                       : m_source->GetFrame(key.index, key.geom, res, result.get());
+                if (FAILED(hr))
+                    throw _com_error(hr);
+
+                bytes = sizeof(Image3d) + static_cast<size_t>(result->stride1)*result->dims[2];
+                return std::shared_ptr<const Image3d>(std::move(result));
+            });
+
+            Image3d copy(*frame); // client takes ownership of the buffer
+            if (frame->data && !copy.data)
+                return E_OUTOFMEMORY;
+            *data = std::move(copy);
+            return S_OK;
+        } catch (const _com_error & err) {
+            return err.Error();
+        } catch (const std::bad_alloc &) {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    HRESULT STDMETHODCALLTYPE GetBoundingBox(/*out*/Cart3dGeom *geom) override {
+        if (!geom)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_bbox, [this](Cart3dGeom & bbox) { return m_source->GetBoundingBox(&bbox); }, [geom](const Cart3dGeom & bbox) {
+            *geom = bbox;
+            return S_OK;
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetColorMap(/*out*/SAFEARRAY ** map) override {
+        if (!map)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_color_map, [this](CComSafeArray<unsigned int> & colors) { return m_source->GetColorMap(colors.GetSafeArrayPtr()); }, [map](CComSafeArray<unsigned int> & colors) {
+            return colors.CopyTo(map);
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetECG(/*out*/EcgSeries *ecg) override {
+        if (!ecg)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_ecg, [this](EcgSeries & series) { return m_source->GetECG(&series); }, [ecg](const EcgSeries & series) {
+            *ecg = EcgSeries(series); // deep copy
+            return S_OK;
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetProbeInfo(/*out*/ProbeInfo *probe) override {
+        if (!probe)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_probe, [this](ProbeInfo & info) { return m_source->GetProbeInfo(&info); }, [probe](const ProbeInfo & info) {
+            *probe = info;
+            return S_OK;
+        });
+    }
+
+    HRESULT STDMETHODCALLTYPE GetSopInstanceUID(/*out*/BSTR *uid_str) override {
+        if (!uid_str)
+            return E_INVALIDARG;
+
+        return GetMetadata(m_uid, [this](CComBSTR & uid) { return m_source->GetSopInstanceUID(&uid); }, [uid_str](const CComBSTR & uid) {
+            return uid.CopyTo(uid_str);
+        });
+    }
+
+    BEGIN_COM_MAP(Image3dSourceCache)
+        COM_INTERFACE_ENTRY(IImage3dSource)
+        COM_INTERFACE_ENTRY(IImage3dSource2)
+    END_COM_MAP()
+
+private:
+    /** Fetch a metadata value from the wrapped source on first use, and pass the cached value to "copy" for returning to the client.
+        Failures are not cached, so that they are retried on the next call. */
+    template <class T, class FetchFn, class CopyFn>
+    HRESULT GetMetadata (std::unique_ptr<T> & cached, FetchFn fetch, CopyFn copy) {
+        std::lock_guard<std::mutex> lock(m_metadata_mutex);
+        try {
+            if (!cached) {
+                std::unique_ptr<T> value(new T());
+                HRESULT hr = fetch(*value);
+                if (FAILED(hr))
+                    return hr;
+                cached = std::move(value);
+            }
+            return copy(*cached);
+        } catch (const std::bad_alloc &) {
+            return E_OUTOFMEMORY;
+        }
+    }
+
+    CComPtr<IImage3dSource>                      m_source;
+    CComQIPtr<IImage3dSource2>                   m_source2; ///< null if not supported by the wrapped source
+    std::unique_ptr<Cache>                       m_frames;
+
+    std::mutex                                   m_metadata_mutex;
+    std::unique_ptr<unsigned int>                m_frame_count;
+    std::unique_ptr<CComSafeArray<double>>       m_frame_times;
+    std::unique_ptr<Cart3dGeom>                  m_bbox;
+    std::unique_ptr<CComSafeArray<unsigned int>> m_color_map;
+    std::unique_ptr<EcgSeries>                   m_ecg;
+    std::unique_ptr<ProbeInfo>                   m_probe;
+    std::unique_ptr<CComBSTR>                    m_uid;
+};
@@ -0,0 +1,157 @@
+/* Portable core of the "3D API" reference loader.
+Bricked volume layout, for cache-friendly resampling along arbitrary directions.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <vector>
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+#endif
+#include "Image3dView.hpp"
+#include "SampleSimd.hpp"
+
+
+/** Zero-initialized memory pages straight from the OS. Physical memory is only used for pages that are touched,
+    also when the process heap holds freed memory that would otherwise be reused. */
+class PageBuffer {
+public:
+    /** Throws std::bad_alloc. */
+    explicit PageBuffer (size_t size) : m_size(size) {
+#ifdef _WIN32
+        m_data = static_cast<uint8_t*>(VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+        if (!m_data)
+            throw std::bad_alloc();
+#else
+        void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            throw std::bad_alloc();
+        m_data = static_cast<uint8_t*>(ptr);
+#endif
+    }
+
+    ~PageBuffer () {
+#ifdef _WIN32
+        VirtualFree(m_data, 0, MEM_RELEASE);
+#else
+        munmap(m_data, m_size);
+#endif
+    }
+
+    uint8_t * Data () const {
+        return m_data;
+    }
+
+    size_t Size () const {
+        return m_size;
+    }
+
+private:
+    PageBuffer (const PageBuffer &) = delete;
+    PageBuffer & operator = (const PageBuffer &) = delete;
+
+    uint8_t * m_data = nullptr;
+    size_t    m_size = 0;
+};
+
+
+/** 8bit volume stored as 8x8x8 voxel bricks of 512 bytes, with row-major voxels within each brick and row-major brick order.
+    Neighbouring voxels along all three axes thereby mostly share cache lines & pages, which benefits oblique and elevation-direction
+    sampling, at the expense of a table lookup per axis. Voxel addresses are separable, so that
+    offset(x,y,z) = offsets[0][x] + offsets[1][y] + offsets[2][z]. */
+class BrickedVolume {
+public:
+    static const unsigned int BRICK_BITS = 3;
+    static const unsigned int BRICK_SIZE = 1u << BRICK_BITS; ///< voxels along each brick axis
+    static const unsigned int BRICK_BYTES = BRICK_SIZE*BRICK_SIZE*BRICK_SIZE;
+
+    /** Check if a volume can be addressed by the bricked row kernels (32bit offsets). */
+    static bool Supported (const unsigned short dims[3]) {
+        return (dims[0] > 0) && (dims[1] > 0) && (dims[2] > 0) && (PaddedSize(dims) < 0x7FFFFFF0u);
+    }
+
+    /** Copy a row-major 8bit frame into bricks. Throws std::bad_alloc if not Supported. */
+    explicit BrickedVolume (const Image3dView & frame) : BrickedVolume(frame.time, frame.format, frame.dims) {
+        // copy brick rows (padding voxels are never read, but zeroed for determinism)
+        for (unsigned int z = 0; z < dims[2]; ++z) {
+            for (unsigned int y = 0; y < dims[1]; ++y) {
+                const uint8_t * src_row = frame.data + y*static_cast<size_t>(frame.stride0) + z*static_cast<size_t>(frame.stride1);
+                uint8_t * dst_row = m_data->Data() + m_offsets[1][y] + m_offsets[2][z];
+                for (unsigned int x = 0; x < dims[0]; x += BRICK_SIZE)
+                    memcpy(dst_row + m_offsets[0][x], src_row + x, std::min(static_cast<unsigned int>(BRICK_SIZE), dims[0] - x)); // avoid ODR-use of BRICK_SIZE
+            }
+        }
+    }
+
+    /** Allocate zeroed bricks, to be filled through Brick. Only the pages of bricks that are filled take up physical memory.
+        Throws std::bad_alloc if not Supported. */
+    BrickedVolume (double time_, ImageFormat format_, const unsigned short dims_[3]) : time(time_), format(format_) {
+        assert(ImageFormatSize(format_) == sizeof(uint8_t));
+        for (unsigned int i = 0; i < 3; ++i)
+            dims[i] = dims_[i];
+        if (!Supported(dims))
+            throw std::bad_alloc();
+
+        // per-axis address tables (brick part + intra-brick part)
+        const unsigned int bricks[3] = { BrickCount(dims[0]), BrickCount(dims[1]), BrickCount(dims[2]) };
+        const uint32_t brick_stride[3] = { BRICK_BYTES, bricks[0]*BRICK_BYTES, bricks[0]*bricks[1]*BRICK_BYTES };
+        const uint32_t voxel_stride[3] = { 1, BRICK_SIZE, BRICK_SIZE*BRICK_SIZE };
+        for (unsigned int a = 0; a < 3; ++a) {
+            m_offsets[a].resize(dims[a]);
+            for (uint32_t i = 0; i < dims[a]; ++i)
+                m_offsets[a][i] = (i >> BRICK_BITS)*brick_stride[a] + (i & (BRICK_SIZE - 1))*voxel_stride[a];
+        }
+
+        m_data.reset(new PageBuffer(static_cast<size_t>(PaddedSize(dims))));
+    }
+
+    /** Storage of brick "index", where bricks are numbered in row-major brick order. */
+    uint8_t * Brick (size_t index) {
+        assert(index*BRICK_BYTES < m_data->Size());
+        return m_data->Data() + index*BRICK_BYTES;
+    }
+
+    /** Description for the bricked row kernels. */
+    VoxelGridU8 Grid () const {
+        VoxelGridU8 grid = {};
+        grid.data = m_data->Data();
+        for (unsigned int a = 0; a < 3; ++a) {
+            grid.dims[a] = dims[a];
+            grid.offsets[a] = m_offsets[a].data();
+        }
+        return grid;
+    }
+
+    /** Buffer size, including padding of partial bricks [bytes]. */
+    size_t Size () const {
+        return m_data->Size();
+    }
+
+    double         time    = 0;
+    ImageFormat    format  = FORMAT_INVALID;
+    unsigned short dims[3] = {0,0,0}; ///< resolution (width/columns, height/rows, planes)
+
+    /** Number of bricks along an axis with "dim" voxels. */
+    static unsigned int BrickCount (unsigned int dim) {
+        return (dim + BRICK_SIZE - 1) >> BRICK_BITS;
+    }
+
+private:
+    BrickedVolume (const BrickedVolume &) = delete;
+    BrickedVolume & operator = (const BrickedVolume &) = delete;
+
+    static uint64_t PaddedSize (const unsigned short dims[3]) {
+        return uint64_t(BrickCount(dims[0]))*BrickCount(dims[1])*BrickCount(dims[2])*BRICK_BYTES;
+    }
+
+    std::unique_ptr<PageBuffer> m_data;
+    std::vector<uint32_t>       m_offsets[3]; ///< per-axis address tables
+};
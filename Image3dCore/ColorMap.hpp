@@ -0,0 +1,58 @@
+/* Portable core of the "3D API" reference loader.
+Color mapping of resampled rows into display-ready RGBA pixels.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "Image3dView.hpp"
+#include "SampleSimd.hpp"
+
+
+/** Row pitch [bytes] of color-mapped output is a multiple of this, matching the Direct3D 12 texture upload pitch alignment
+    (D3D12_TEXTURE_DATA_PITCH_ALIGNMENT), so that rows can be copied straight into upload buffers. */
+static const unsigned int COLOR_ROW_ALIGNMENT = 256;
+
+
+/** 256-entry color table for mapping grayscale samples into FORMAT_R8G8B8A8 or FORMAT_B8G8R8A8 pixels. The 8bit kernel is picked once
+    per table (see SelectMapRowU8). 16bit samples are mapped by their most significant byte, and float samples in [0,1] after rounding to 8bit. */
+class ColorMap {
+public:
+    /** Table from R8G8B8A8 "colors" (same layout as returned by GetColorMap), with channels reordered to match "format". */
+    ColorMap (const uint32_t colors[256], ImageFormat format) : m_format(format) {
+        assert((format == FORMAT_R8G8B8A8) || (format == FORMAT_B8G8R8A8));
+        for (unsigned int i = 0; i < 256; ++i) {
+            uint32_t color = colors[i];
+            if (format == FORMAT_B8G8R8A8)
+                color = (color & 0xFF00FF00u) | ((color & 0xFFu) << 16) | ((color >> 16) & 0xFFu); // swap red & blue
+            m_table[i] = color;
+        }
+        m_map_u8 = SelectMapRowU8(m_table);
+    }
+
+    /** Pixel format of the mapped rows. */
+    ImageFormat Format () const {
+        return m_format;
+    }
+
+    void MapRow (const uint8_t * in, unsigned int count, uint32_t * out) const {
+        m_map_u8(in, count, m_table, out);
+    }
+
+    void MapRow (const uint16_t * in, unsigned int count, uint32_t * out) const {
+        for (unsigned int i = 0; i < count; ++i)
+            out[i] = m_table[in[i] >> 8];
+    }
+
+    void MapRow (const float * in, unsigned int count, uint32_t * out) const {
+        for (unsigned int i = 0; i < count; ++i) {
+            const float val = (in[i] > 0) ? std::min(in[i], 1.0f) : 0.0f; // also maps NaN to 0
+            out[i] = m_table[static_cast<unsigned int>(255*val + 0.5f)];
+        }
+    }
+
+private:
+    uint32_t    m_table[256];
+    MapRowU8Fn  m_map_u8 = nullptr;
+    ImageFormat m_format = FORMAT_INVALID;
+};
@@ -0,0 +1,344 @@
+/* Portable core of the "3D API" reference loader.
+Run-length compressed bricks, that are decompressed on demand for resampling.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Resample.hpp"
+
+
+/** Run-length encode a 512-byte brick, and append it to "out". The brick is stored as
+    - 1 byte if all voxels share the same value,
+    - 512 bytes (uncompressed) if run-length coding doesn't pay off, or otherwise
+    - as PackBits-style runs, each starting with a control byte "c". c < 128 is followed by c+1 literal bytes,
+      and c >= 128 by a single byte that is repeated c-125 times (3 to 130). */
+static void EncodeBrickRLE (const uint8_t * brick, std::vector<uint8_t> & out) {
+    const size_t SIZE = BrickedVolume::BRICK_BYTES;
+    const size_t MAX_LITERAL = 128, MIN_RUN = 3, MAX_RUN = 130;
+
+    if (std::all_of(brick + 1, brick + SIZE, [brick](uint8_t val) { return val == brick[0]; })) {
+        out.push_back(brick[0]);
+        return;
+    }
+
+    const size_t start = out.size();
+    for (size_t i = 0; i < SIZE; ) {
+        size_t run = 1;
+        while ((i + run < SIZE) && (run < MAX_RUN) && (brick[i + run] == brick[i]))
+            ++run;
+        if (run >= MIN_RUN) {
+            out.push_back(static_cast<uint8_t>(run + 125));
+            out.push_back(brick[i]);
+            i += run;
+            continue;
+        }
+
+        // literals until the next run that pays off
+        size_t end = i + 1;
+        while ((end < SIZE) && (end - i < MAX_LITERAL) && !((end + 2 < SIZE) && (brick[end] == brick[end + 1]) && (brick[end] == brick[end + 2])))
+            ++end;
+        out.push_back(static_cast<uint8_t>(end - i - 1));
+        out.insert(out.end(), brick + i, brick + end);
+        i = end;
+    }
+
+    if (out.size() - start >= SIZE) {
+        // store uncompressed
+        out.resize(start);
+        out.insert(out.end(), brick, brick + SIZE);
+    }
+}
+
+/** Decode a brick from EncodeBrickRLE, that occupies "size" bytes. */
+static void DecodeBrickRLE (const uint8_t * in, size_t size, uint8_t * brick) {
+    const size_t SIZE = BrickedVolume::BRICK_BYTES;
+    if (size == 1) {
+        memset(brick, in[0], SIZE);
+        return;
+    }
+    if (size == SIZE) {
+        memcpy(brick, in, SIZE);
+        return;
+    }
+
+    const uint8_t * const in_end = in + size;
+    size_t pos = 0;
+    while (in < in_end) {
+        const unsigned int ctrl = *in++;
+        if (ctrl < 128) {
+            memcpy(brick + pos, in, ctrl + 1);
+            in  += ctrl + 1;
+            pos += ctrl + 1;
+        } else {
+            memset(brick + pos, *in++, ctrl - 125);
+            pos += ctrl - 125;
+        }
+        assert(pos <= SIZE);
+    }
+    assert((in == in_end) && (pos == SIZE));
+}
+
+
+/** 8bit frame stored as run-length compressed 8x8x8 bricks (see EncodeBrickRLE), in the brick order of BrickedVolume.
+    Resampling requests decompress the bricks they touch into a BrickedVolume that is shared by subsequent requests, so that
+    only the parts of the frame that are actually viewed take up uncompressed memory. Decompressed bricks can be discarded to reclaim memory.
+    Thread-safe. Concurrent requests touching the same brick decompress it once. */
+class CompressedVolume {
+public:
+    /** Check if a volume can be compressed (same limits as BrickedVolume). */
+    static bool Supported (const unsigned short dims[3]) {
+        return BrickedVolume::Supported(dims);
+    }
+
+    /** Compress a row-major 8bit frame. Slabs of bricks are compressed in parallel by "pool". Throws std::bad_alloc if not Supported. */
+    CompressedVolume (const Image3dView & frame, ThreadPool & pool) : time(frame.time), format(frame.format) {
+        assert(ImageFormatSize(frame.format) == sizeof(uint8_t));
+        for (unsigned int i = 0; i < 3; ++i) {
+            dims[i] = frame.dims[i];
+            m_bricks[i] = BrickedVolume::BrickCount(dims[i]);
+        }
+        if (!Supported(dims))
+            throw std::bad_alloc();
+
+        // compress each slab of bricks separately, and concatenate them
+        const unsigned int slab_bricks = m_bricks[0]*m_bricks[1];
+        std::vector<std::vector<uint8_t>> slabs(m_bricks[2]);
+        m_offsets.resize(BrickCount() + 1);
+        pool.ParallelFor(m_bricks[2], 1, [&](unsigned int begin, unsigned int end) {
+            uint8_t brick[BrickedVolume::BRICK_BYTES];
+            for (unsigned int bz = begin; bz < end; ++bz) {
+                for (unsigned int b = 0; b < slab_bricks; ++b) {
+                    CopyBrick(frame, b % m_bricks[0], b / m_bricks[0], bz, brick);
+                    EncodeBrickRLE(brick, slabs[bz]);
+                    m_offsets[bz*size_t(slab_bricks) + b + 1] = slabs[bz].size(); // relative to slab until concatenated
+                }
+            }
+        });
+
+        size_t total = 0;
+        for (const std::vector<uint8_t> & slab : slabs)
+            total += slab.size();
+        m_data.reserve(total);
+        for (unsigned int bz = 0; bz < m_bricks[2]; ++bz) {
+            for (unsigned int b = 1; b <= slab_bricks; ++b)
+                m_offsets[bz*size_t(slab_bricks) + b] += m_data.size();
+            m_data.insert(m_data.end(), slabs[bz].begin(), slabs[bz].end());
+            std::vector<uint8_t>().swap(slabs[bz]);
+        }
+    }
+
+    size_t BrickCount () const {
+        return static_cast<size_t>(m_bricks[0])*m_bricks[1]*m_bricks[2];
+    }
+
+    /** Size of the compressed bricks, including the brick table [bytes]. */
+    size_t CompressedSize () const {
+        return m_data.size() + m_offsets.size()*sizeof(uint64_t);
+    }
+
+    /** Size of the uncompressed bricks, including padding of partial bricks [bytes]. */
+    size_t UncompressedSize () const {
+        return BrickCount()*BrickedVolume::BRICK_BYTES;
+    }
+
+    /** Size of the bricks decompressed so far and not discarded [bytes]. */
+    size_t DecodedSize () const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_decoded ? m_decoded->ready.load(std::memory_order_relaxed)*BrickedVolume::BRICK_BYTES : 0;
+    }
+
+    /** Decompress the bricks that resampling into "out_dims" through any of the voxel transforms in "tr" might read
+        (step_z is ignored if out_dims[2] == 1). Bricks are decompressed in parallel by "pool".
+        The returned volume can be sampled through these transforms, and remains valid as long as it is held. Throws std::bad_alloc. */
+    std::shared_ptr<const BrickedVolume> Decode (const std::vector<VoxelTransform> & tr, const unsigned short out_dims[3], ThreadPool & pool) {
+        std::shared_ptr<Decoded> decoded;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_decoded)
+                m_decoded = std::make_shared<Decoded>(*this);
+            decoded = m_decoded;
+        }
+
+        std::vector<uint8_t> touched(BrickCount(), 0);
+        for (const VoxelTransform & t : tr)
+            MarkTouchedBricks(t, out_dims, touched);
+
+        std::vector<uint32_t> pending;
+        for (size_t b = 0; b < touched.size(); ++b) {
+            if (touched[b] && (decoded->state[b].load(std::memory_order_acquire) != READY))
+                pending.push_back(static_cast<uint32_t>(b));
+        }
+
+        const size_t pending_count = pending.size();
+        pool.ParallelFor(static_cast<unsigned int>(pending_count), 16, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i) {
+                const uint32_t b = pending[i];
+                uint8_t expected = EMPTY;
+                if (!decoded->state[b].compare_exchange_strong(expected, DECODING, std::memory_order_acquire))
+                    continue; // decompressed by a concurrent request
+
+                DecodeBrickRLE(m_data.data() + m_offsets[b], static_cast<size_t>(m_offsets[b + 1] - m_offsets[b]), decoded->volume.Brick(b));
+                decoded->state[b].store(READY, std::memory_order_release);
+                decoded->ready.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        // wait for bricks that concurrent requests are still decompressing
+        for (uint32_t b : pending) {
+            while (decoded->state[b].load(std::memory_order_acquire) != READY)
+                std::this_thread::yield();
+        }
+        return std::shared_ptr<const BrickedVolume>(decoded, &decoded->volume);
+    }
+
+    /** Decompress the bricks touched when resampling into the geometry and resolution of "out" (see SampleFrame). */
+    std::shared_ptr<const BrickedVolume> Decode (Cart3dGeom frame_geom, Cart3dGeom out_geom, const unsigned short out_dims[3], ThreadPool & pool) {
+        vec3f out_origin, out_dir1, out_dir2, out_dir3;
+        std::tie(out_origin, out_dir1, out_dir2, out_dir3) = FromCart3dGeom(out_geom);
+        if (out_dims[2] == 1)
+            out_dir3 = vec3f(0, 0, 0); // single slice (see SampleSlice)
+        const std::vector<VoxelTransform> tr(1, ComposeVoxelTransform(frame_geom, dims, out_origin, out_dir1, out_dir2, out_dir3, out_dims));
+        return Decode(tr, out_dims, pool);
+    }
+
+    /** Decompress the whole frame into row-major "out", without keeping the bricks. */
+    void DecodeAll (ThreadPool & pool, const Image3dView & out) const {
+        assert((out.format == format) && (out.dims[0] == dims[0]) && (out.dims[1] == dims[1]) && (out.dims[2] == dims[2]));
+        const unsigned int slab_bricks = m_bricks[0]*m_bricks[1];
+        pool.ParallelFor(static_cast<unsigned int>(BrickCount()), std::max(1u, slab_bricks/4), [&](unsigned int begin, unsigned int end) {
+            uint8_t brick[BrickedVolume::BRICK_BYTES];
+            for (unsigned int b = begin; b < end; ++b) {
+                DecodeBrickRLE(m_data.data() + m_offsets[b], static_cast<size_t>(m_offsets[b + 1] - m_offsets[b]), brick);
+                const unsigned int bx = b % m_bricks[0], by = b / m_bricks[0] % m_bricks[1], bz = b / slab_bricks;
+                ForBrickRows(out, bx, by, bz, [&](uint8_t * row, unsigned int offset, unsigned int width) {
+                    memcpy(row, brick + offset, width);
+                });
+            }
+        });
+    }
+
+    /** Release the decompressed bricks. Volumes returned by Decode remain valid while held. */
+    void Discard () {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decoded.reset();
+    }
+
+    double         time    = 0;
+    ImageFormat    format  = FORMAT_INVALID;
+    unsigned short dims[3] = {0,0,0}; ///< resolution (width/columns, height/rows, planes)
+
+private:
+    CompressedVolume (const CompressedVolume &) = delete;
+    CompressedVolume & operator = (const CompressedVolume &) = delete;
+
+    enum : uint8_t { EMPTY, DECODING, READY };
+
+    /** Decompressed bricks, with a state per brick. */
+    struct Decoded {
+        explicit Decoded (const CompressedVolume & frame) : volume(frame.time, frame.format, frame.dims), state(new std::atomic<uint8_t>[frame.BrickCount()]) {
+            for (size_t b = 0; b < frame.BrickCount(); ++b)
+                state[b].store(EMPTY, std::memory_order_relaxed);
+        }
+
+        BrickedVolume                           volume; ///< only READY bricks are initialized
+        std::unique_ptr<std::atomic<uint8_t>[]> state;
+        std::atomic<size_t>                     ready{0};
+    };
+
+    /** Call "fn(row, offset, width)" for each row of a brick within the frame, where "row" points to the first voxel of the row in "frame",
+        "offset" is the position of that voxel within the brick, and "width" the number of voxels within the frame. */
+    template <class Fn>
+    static void ForBrickRows (const Image3dView & frame, unsigned int bx, unsigned int by, unsigned int bz, Fn fn) {
+        const unsigned int N = BrickedVolume::BRICK_SIZE;
+        const unsigned int x0 = bx*N, y0 = by*N, z0 = bz*N;
+        const unsigned int width = std::min(N, frame.dims[0] - x0);
+        for (unsigned int z = 0; (z < N) && (z0 + z < frame.dims[2]); ++z) {
+            for (unsigned int y = 0; (y < N) && (y0 + y < frame.dims[1]); ++y)
+                fn(frame.data + x0 + (y0 + y)*static_cast<size_t>(frame.stride0) + (z0 + z)*static_cast<size_t>(frame.stride1), (z*N + y)*N, width);
+        }
+    }
+
+    /** Gather a brick from a row-major frame. Voxels outside the frame are zeroed. */
+    static void CopyBrick (const Image3dView & frame, unsigned int bx, unsigned int by, unsigned int bz, uint8_t * brick) {
+        memset(brick, 0, BrickedVolume::BRICK_BYTES);
+        ForBrickRows(frame, bx, by, bz, [brick](const uint8_t * row, unsigned int offset, unsigned int width) {
+            memcpy(brick + offset, row, width);
+        });
+    }
+
+    /** Mark the bricks that resampling through "tr" might read. The output grid is split into cells of about a brick in size,
+        and the bricks overlapping the source bounding box of each cell, widened by the interpolation footprint, are marked. */
+    void MarkTouchedBricks (const VoxelTransform & tr, const unsigned short out_dims[3], std::vector<uint8_t> & touched) const {
+        const vec3f steps[3] = { tr.step_x, tr.step_y, (out_dims[2] > 1) ? tr.step_z : vec3f(0, 0, 0) };
+        unsigned int cell[3] = {}; // output voxels per cell
+        for (unsigned int a = 0; a < 3; ++a) {
+            const float max_step = std::max(std::fabs(steps[a].x), std::max(std::fabs(steps[a].y), std::fabs(steps[a].z)));
+            const float span = (max_step > 0) ? BrickedVolume::BRICK_SIZE/max_step : static_cast<float>(out_dims[a]);
+            cell[a] = static_cast<unsigned int>(std::max(1.0f, std::min(span, static_cast<float>(out_dims[a]))));
+        }
+
+        const float origin[3] = { tr.origin.x, tr.origin.y, tr.origin.z };
+        for (unsigned int z0 = 0; z0 < out_dims[2]; z0 += cell[2]) {
+            for (unsigned int y0 = 0; y0 < out_dims[1]; y0 += cell[1]) {
+                for (unsigned int x0 = 0; x0 < out_dims[0]; x0 += cell[0]) {
+                    // source bounding box of the cell corners
+                    const unsigned int lo_idx[3] = { x0, y0, z0 };
+                    float lo[3] = { origin[0], origin[1], origin[2] };
+                    float hi[3] = { origin[0], origin[1], origin[2] };
+                    for (unsigned int a = 0; a < 3; ++a) {
+                        const unsigned int hi_idx = std::min(lo_idx[a] + cell[a], out_dims[a] - 1u);
+                        const float step[3] = { steps[a].x, steps[a].y, steps[a].z };
+                        for (unsigned int c = 0; c < 3; ++c) {
+                            const float p0 = lo_idx[a]*step[c], p1 = hi_idx*step[c];
+                            lo[c] += std::min(p0, p1);
+                            hi[c] += std::max(p0, p1);
+                        }
+                    }
+                    MarkBox(lo, hi, touched);
+                }
+            }
+        }
+    }
+
+    /** Mark the bricks overlapping source box [lo, hi] [voxels], widened by the interpolation footprint and a rounding margin.
+        Boxes outside the frame along any axis are skipped, since the kernels don't read voxels for positions outside. */
+    void MarkBox (const float lo[3], const float hi[3], std::vector<uint8_t> & touched) const {
+        unsigned int first[3] = {}, last[3] = {}; // brick range
+        for (unsigned int c = 0; c < 3; ++c) {
+            if (std::isnan(lo[c]) || std::isnan(hi[c])) {
+                std::fill(touched.begin(), touched.end(), uint8_t(1)); // undefined geometry (be conservative)
+                return;
+            }
+            if (!(lo[c] - 1 < dims[c]) || !(hi[c] + 1 >= 0))
+                return;
+            const float max_idx = dims[c] - 1.0f;
+            const auto v0 = static_cast<unsigned int>(std::min(std::max(std::floor(lo[c] - 1.5f), 0.0f), max_idx)); // linear interpolation reads floor(pos - 0.5)
+            const auto v1 = static_cast<unsigned int>(std::min(std::max(std::floor(hi[c] + 1.0f), 0.0f), max_idx));
+            first[c] = v0 >> BrickedVolume::BRICK_BITS;
+            last[c]  = v1 >> BrickedVolume::BRICK_BITS;
+        }
+        for (unsigned int bz = first[2]; bz <= last[2]; ++bz)
+            for (unsigned int by = first[1]; by <= last[1]; ++by)
+                memset(touched.data() + (bz*size_t(m_bricks[1]) + by)*m_bricks[0] + first[0], 1, last[0] - first[0] + 1);
+    }
+
+    unsigned int              m_bricks[3] = {}; ///< bricks along each axis
+    std::vector<uint8_t>      m_data;           ///< compressed bricks
+    std::vector<uint64_t>     m_offsets;        ///< start of each brick in m_data, followed by the end of the last brick
+    mutable std::mutex        m_mutex;
+    std::shared_ptr<Decoded>  m_decoded;        ///< protected by m_mutex (null until first Decode)
+};
+
+
+/** Resample a compressed frame into the geometry and resolution of "out", after decompressing the bricks it touches. */
+template <class T>
+static void SampleFrame (CompressedVolume & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    const std::shared_ptr<const BrickedVolume> decoded = frame.Decode(frame_geom, out_geom, out.dims, pool);
+    SampleFrame<T>(*decoded, frame_geom, out_geom, interp, pool, out, color_map);
+}
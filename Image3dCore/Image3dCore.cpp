@@ -0,0 +1,29 @@
+/* Compile all core headers on their own, to verify that they are self-contained and free of COM dependencies. */
+#include "Image3dView.hpp"
+#include "LinAlg.hpp"
+#include "SampleSimd.hpp"
+#include "ColorMap.hpp"
+#include "ThreadPool.hpp"
+#include "BrickedVolume.hpp"
+#include "Resample.hpp"
+#include "CompressedVolume.hpp"
+#include "MipPyramid.hpp"
+#include "SharedFrameRing.hpp"
+#include "MetaImage.hpp"
+#include "LiveFrameRing.hpp"
+#include "PerfCounters.hpp"
+
+// instantiate resampling kernels for all supported sample types
+template void SampleFrame<uint8_t>(const Image3dView & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map);
+template void SampleFrame<uint16_t>(const Image3dView & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map);
+template void SampleFrame<float>(const Image3dView & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map);
+template void SampleSlices<uint8_t>(const Image3dView & frame, Cart3dGeom frame_geom, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out);
+template void SampleSlices<uint16_t>(const Image3dView & frame, Cart3dGeom frame_geom, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out);
+template void SampleSlices<float>(const Image3dView & frame, Cart3dGeom frame_geom, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out);
+template void SampleFrame<uint8_t>(const BrickedVolume & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map);
+template void SampleSlices<uint8_t>(const BrickedVolume & frame, Cart3dGeom frame_geom, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out);
+template void SampleFrame<uint8_t>(CompressedVolume & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map);
+template void Downsample2x<uint8_t>(const Image3dView & src, ThreadPool & pool, const Image3dView & dst);
+template void Downsample2x<uint16_t>(const Image3dView & src, ThreadPool & pool, const Image3dView & dst);
+template void Downsample2x<float>(const Image3dView & src, ThreadPool & pool, const Image3dView & dst);
+template class PerfCounters<7>;
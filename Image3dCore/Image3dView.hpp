@@ -0,0 +1,98 @@
+/* Portable core of the "3D API" reference loader.
+Plain-buffer image types without COM dependencies.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+
+
+#ifndef __IImage3d_h__ // MIDL include guard
+// Portable mirror of the IImage3d.idl definitions used by the core. Must be kept in sync with the IDL file.
+// Types from the MIDL-generated header are used instead when it's included first.
+
+enum ImageFormat {
+    FORMAT_INVALID  = 0, ///< make sure that "cleared" state is invalid
+    FORMAT_U8       = 1, ///< unsigned 8bit grayscale
+    FORMAT_U16      = 2, ///< unsigned 16bit grayscale
+    FORMAT_F32      = 3, ///< 32bit floating-point grayscale in [0,1]
+    FORMAT_R8G8B8A8 = 4, ///< 32bit color-mapped RGBA (DXGI_FORMAT_R8G8B8A8_UNORM byte order)
+    FORMAT_B8G8R8A8 = 5, ///< 32bit color-mapped BGRA (DXGI_FORMAT_B8G8R8A8_UNORM byte order)
+};
+
+enum InterpolationMode {
+    INTERPOLATION_NEAREST = 0, ///< nearest-neighbour (same as GetFrame)
+    INTERPOLATION_LINEAR  = 1, ///< trilinear interpolation between voxel centers
+};
+
+/** 3D image geometry. All units are in meter [m]. */
+struct Cart3dGeom {
+    float origin_x; ///< coordinate of 1st sample
+    float origin_y;
+    float origin_z;
+
+    float dir1_x;   ///< 1st direction vector (from first to last column)
+    float dir1_y;
+    float dir1_z;
+
+    float dir2_x;   ///< 2nd direction vector (from first to last row)
+    float dir2_y;
+    float dir2_z;
+
+    float dir3_x;   ///< 3rd direction vector (from first to last plane)
+    float dir3_y;
+    float dir3_z;
+};
+#endif
+
+
+/** Determine the sample size [bytes] for a given image format. */
+static inline unsigned int ImageFormatSize(ImageFormat format) {
+    switch (format) {
+    case FORMAT_U8:  return 1;
+    case FORMAT_U16: return 2;
+    case FORMAT_F32: return 4;
+    case FORMAT_R8G8B8A8: return 4;
+    case FORMAT_B8G8R8A8: return 4;
+    default: break;
+    }
+
+    abort(); // should never be reached
+}
+
+
+/** Non-owning view of a 3D image buffer. Same layout description as the Image3d struct in IImage3d.idl,
+    but without ownership of the underlying buffer. Stored in row-major order, possibly with padding between rows. */
+struct Image3dView {
+    double         time    = 0;
+    ImageFormat    format  = FORMAT_INVALID;
+    unsigned short dims[3] = {0,0,0}; ///< resolution (width/columns, height/rows, planes)
+    unsigned int   stride0 = 0;       ///< distance between each row [bytes] (>= width*element_size)
+    unsigned int   stride1 = 0;       ///< distance between each plane [bytes] (>= height*stride0)
+    uint8_t      * data    = nullptr; ///< first voxel (not owned)
+
+    /** Create a view with packed storage. */
+    static Image3dView Packed (double time, ImageFormat format, const unsigned short dims[3], uint8_t * data) {
+        Image3dView view;
+        view.time = time;
+        view.format = format;
+        for (unsigned int i = 0; i < 3; ++i)
+            view.dims[i] = dims[i];
+        view.stride0 = dims[0] * ImageFormatSize(format);
+        view.stride1 = dims[1] * view.stride0;
+        view.data = data;
+        return view;
+    }
+
+    /** Create a view with rows padded to a multiple of "row_alignment" bytes, and packed planes. */
+    static Image3dView Aligned (double time, ImageFormat format, const unsigned short dims[3], unsigned int row_alignment, uint8_t * data) {
+        Image3dView view = Packed(time, format, dims, data);
+        view.stride0 = (view.stride0 + row_alignment - 1)/row_alignment*row_alignment;
+        view.stride1 = dims[1] * view.stride0;
+        return view;
+    }
+
+    /** Buffer size [bytes] covered by the view. */
+    size_t Size () const {
+        return static_cast<size_t>(stride1)*dims[2];
+    }
+};
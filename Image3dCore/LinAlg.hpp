@@ -6,6 +6,7 @@ Copyright (c) 2015, GE Vingmed Ultrasound            */
 #include <cassert>
 #include <cmath>
 #include <tuple>
+#include "Image3dView.hpp"
 
 
 /** 3D vector type. */
@@ -64,7 +65,7 @@ struct vec3f {
     float x, y, z;
 };
 
-static vec3f operator * (float val, vec3f vec) {
+static inline vec3f operator * (float val, vec3f vec) {
     return vec3f(val*vec.x, val*vec.y, val*vec.z);
 }
 
@@ -211,18 +212,7 @@ static inline vec3f prod(const mat33f & m, const vec3f & p) {
 }
 
 
-/** Convert from normalized voxel pos in [0,1) to (x,y,z) coordinate. */
-static vec3f PosToCoord (vec3f origin, vec3f dir1, vec3f dir2, vec3f dir3, const vec3f pos) {
-    mat33f M;
-    col_assign(M, 0, dir1);
-    col_assign(M, 1, dir2);
-    col_assign(M, 2, dir3);
-
-    return prod(M, pos) + origin;
-}
-
-
-static std::tuple<vec3f, vec3f, vec3f, vec3f> FromCart3dGeom (Cart3dGeom geom) {
+static inline std::tuple<vec3f, vec3f, vec3f, vec3f> FromCart3dGeom (Cart3dGeom geom) {
     const vec3f origin(geom.origin_x, geom.origin_y, geom.origin_z);
     const vec3f dir1(geom.dir1_x, geom.dir1_y, geom.dir1_z);
     const vec3f dir2(geom.dir2_x, geom.dir2_y, geom.dir2_z);
@@ -232,7 +222,7 @@ static std::tuple<vec3f, vec3f, vec3f, vec3f> FromCart3dGeom (Cart3dGeom geom) {
 }
 
 
-static Cart3dGeom ToCart3dGeom (vec3f origin, vec3f dir1, vec3f dir2, vec3f dir3) {
+static inline Cart3dGeom ToCart3dGeom (vec3f origin, vec3f dir1, vec3f dir2, vec3f dir3) {
     Cart3dGeom geom = {};
     {
         geom.origin_x = origin.x;
@@ -255,67 +245,54 @@ static Cart3dGeom ToCart3dGeom (vec3f origin, vec3f dir1, vec3f dir2, vec3f dir3
 }
 
 
-/** Convert from (x,y,z) coordinate to normalized voxel pos in [0,1). */
-static vec3f CoordToPos (Cart3dGeom geom, const vec3f xyz) {
-    vec3f origin, dir1, dir2, dir3;
-    std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(geom);
-
-    mat33f M;
-    col_assign(M, 0, dir1);
-    col_assign(M, 1, dir2);
-    col_assign(M, 2, dir3);
-
-    return prod(inv(M), xyz - origin);
-}
-
-
-template <class T>
-static T SampleVoxel (const Image3d & frame, const vec3f pos) {
-    assert(ImageFormatSize(frame.format) == sizeof(T));
-
-    // out-of-bounds checking
-    if ((pos.x < 0) || (pos.y < 0) || (pos.z < 0))
-        return OUTSIDE_VAL;
+/** Affine mapping from output voxel indices to source voxel coordinates.
+    Composed once per frame request, so that resampling only need to add fixed increments. */
+struct VoxelTransform {
+    vec3f origin; ///< source voxel coordinate of output voxel (0,0,0)
+    vec3f step_x; ///< source voxel increment per output column
+    vec3f step_y; ///< source voxel increment per output row
+    vec3f step_z; ///< source voxel increment per output plane
+};
 
-    auto x = static_cast<unsigned int>(frame.dims[0] * pos.x);
-    auto y = static_cast<unsigned int>(frame.dims[1] * pos.y);
-    auto z = static_cast<unsigned int>(frame.dims[2] * pos.z);
+/** Mapping from world coordinates into source voxel coordinates.
+    Only depends on the source, so it can be shared between several output geometries. */
+struct SourceVoxelMap {
+    vec3f  origin; ///< source origin [m]
+    mat33f S;      ///< inverse of the source axes, with rows scaled by the source resolution
+};
 
-    // out-of-bounds checking
-    if ((x >= frame.dims[0]) || (y >= frame.dims[1]) || (z >= frame.dims[2]))
-        return OUTSIDE_VAL;
+/** Invert the source geometry. */
+static inline SourceVoxelMap MakeSourceVoxelMap (Cart3dGeom src_geom, const unsigned short src_dims[3]) {
+    vec3f src_origin, src_dir1, src_dir2, src_dir3;
+    std::tie(src_origin, src_dir1, src_dir2, src_dir3) = FromCart3dGeom(src_geom);
 
-    return static_cast<T*>(frame.data->pvData)[x + y*frame.stride0/sizeof(T) + z*frame.stride1/sizeof(T)];
+    mat33f M;
+    col_assign(M, 0, src_dir1);
+    col_assign(M, 1, src_dir2);
+    col_assign(M, 2, src_dir3);
+
+    // scale rows of the inverse from normalized [0,1) pos to voxel coordinates
+    SourceVoxelMap result;
+    result.origin = src_origin;
+    result.S = inv(M);
+    for (size_t i = 0; i < 3; ++i)
+        for (size_t j = 0; j < 3; ++j)
+            result.S(i, j) *= src_dims[i];
+    return result;
 }
 
+/** Compose the mapping from output voxel indices into source voxel coordinates. */
+static inline VoxelTransform ComposeVoxelTransform (const SourceVoxelMap & src, vec3f out_origin, vec3f out_dir1, vec3f out_dir2, vec3f out_dir3, const unsigned short out_res[3]) {
+    VoxelTransform result;
+    result.origin = prod(src.S, out_origin - src.origin);
+    result.step_x = (1.0f/out_res[0]) * prod(src.S, out_dir1);
+    result.step_y = (1.0f/out_res[1]) * prod(src.S, out_dir2);
+    result.step_z = (1.0f/out_res[2]) * prod(src.S, out_dir3);
+    return result;
+}
 
-template <class T>
-static Image3d SampleFrame (const Image3d & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, unsigned short max_res[3]) {
-    if (max_res[2] == 0)
-        max_res[2] = 1; // require at least one plane to to retrieved
-
-    vec3f out_origin, out_dir1, out_dir2, out_dir3;
-    std::tie(out_origin, out_dir1, out_dir2, out_dir3) = FromCart3dGeom(out_geom);
-
-    // allow 3rd axis to be empty if only retrieving a single slice
-    if ((out_dir3 == vec3f(0, 0, 0)) && (max_res[2] < 2))
-        out_dir3 = cross_prod(out_dir1, out_dir2);
-
-    // sample image buffer
-    std::vector<unsigned char> img_buf(sizeof(T) * max_res[0] * max_res[1] * max_res[2], 127);
-    for (unsigned short z = 0; z < max_res[2]; ++z) {
-        for (unsigned short y = 0; y < max_res[1]; ++y) {
-            for (unsigned short x = 0; x < max_res[0]; ++x) {
-                // convert from input texture coordinate to output texture coordinate
-                vec3f pos_in(x*1.0f/max_res[0], y*1.0f/max_res[1], z*1.0f/max_res[2]);
-                vec3f xyz = PosToCoord(out_origin, out_dir1, out_dir2, out_dir3, pos_in);
-                vec3f pos_out = CoordToPos(frame_geom, xyz);
-
-                T val = SampleVoxel<T>(frame, pos_out);
-                reinterpret_cast<T*>(img_buf.data())[x + y*max_res[0] + z*max_res[0] * max_res[1]] = val;
-            }
-        }
-    }
-
-    return CreateImage3d(frame.time, frame.format, max_res, img_buf);
+/** Compose the mapping from output voxel indices into source voxel coordinates.
+    The source geometry matrix is only inverted once per call. */
+static inline VoxelTransform ComposeVoxelTransform (Cart3dGeom src_geom, const unsigned short src_dims[3], vec3f out_origin, vec3f out_dir1, vec3f out_dir2, vec3f out_dir3, const unsigned short out_res[3]) {
+    return ComposeVoxelTransform(MakeSourceVoxelMap(src_geom, src_dims), out_origin, out_dir1, out_dir2, out_dir3, out_res);
 }
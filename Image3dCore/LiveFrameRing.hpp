@@ -0,0 +1,261 @@
+/* Portable core of the "3D API" reference loader.
+Ring of the most recent frames of a live acquisition, with lock-free appending & reading.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "Image3dView.hpp"
+
+
+/** Append-only array with a single writer thread, and lock-free reads of published elements from any thread.
+    Elements are stored in fixed-size segments that are never moved, so that appending doesn't invalidate concurrent reads. */
+template <class T>
+class AppendOnlyLog {
+public:
+    static const size_t SEGMENT_SIZE = 4096;
+    static const size_t MAX_SEGMENTS = 4096; ///< room for 16M elements (over 70 hours of frames at 60 volumes/s)
+
+    AppendOnlyLog () : m_segments(new std::unique_ptr<T[]>[MAX_SEGMENTS]) {
+    }
+
+    /** Append & publish an element (writer thread only). Returns false if full. Throws std::bad_alloc. */
+    bool Append (const T & val) {
+        const size_t n = m_size.load(std::memory_order_relaxed);
+        if (n >= SEGMENT_SIZE*MAX_SEGMENTS)
+            return false;
+        std::unique_ptr<T[]> & segment = m_segments[n / SEGMENT_SIZE];
+        if (!segment)
+            segment.reset(new T[SEGMENT_SIZE]); // published together with the element
+        segment[n % SEGMENT_SIZE] = val;
+        m_size.store(n + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Number of published elements. */
+    size_t Size () const {
+        return m_size.load(std::memory_order_acquire);
+    }
+
+    /** Read a published element (index < Size()). */
+    const T & operator [] (size_t index) const {
+        return m_segments[index / SEGMENT_SIZE][index % SEGMENT_SIZE];
+    }
+
+private:
+    AppendOnlyLog (const AppendOnlyLog &) = delete;
+    AppendOnlyLog & operator = (const AppendOnlyLog &) = delete;
+
+    std::unique_ptr<std::unique_ptr<T[]>[]> m_segments;
+    std::atomic<size_t>                     m_size{0};
+};
+
+
+/** Ring of the most recent frames of a live acquisition. Frames are appended by a single producer thread, and read by any number of consumer threads.
+    The producer never waits for consumers: Each frame is written to the slot of the oldest frame that no consumer is reading, so that frames being read
+    are never overwritten. Frame indices keep increasing, and the "window" most recent frames are normally available.
+    Memory use is bounded by the window size, except for the frame times that are kept for all frames (8 bytes per frame). */
+class LiveFrameRing {
+public:
+    static const unsigned int ECG_SAMPLES = 8; ///< ECG samples per frame interval
+    static const unsigned int SPARE_SLOTS = 2; ///< slots beyond the window, for the frame being written & older frames still being read
+
+    /** ECG trace of one frame interval, appended together with the frame. */
+    struct EcgChunk {
+        float  samples[ECG_SAMPLES] = {};
+        bool   trig      = false; ///< QRS/R-wave trigger within the interval
+        double trig_time = 0;     ///< [seconds]
+    };
+
+    /** Frame acquired for reading. Must be passed to Release when done. */
+    struct Frame {
+        Image3dView  view;
+        unsigned int slot = 0;
+    };
+
+    /** Ring keeping the "window" most recent frames. Slot buffers are allocated upfront. Throws std::bad_alloc. */
+    LiveFrameRing (ImageFormat format, const unsigned short dims[3], unsigned int window) : m_window(window) {
+        if (window == 0)
+            throw std::invalid_argument("empty live frame window");
+        m_slots.reset(new Slot[window + SPARE_SLOTS]);
+        for (unsigned int i = 0; i < window + SPARE_SLOTS; ++i) {
+            m_slots[i].buffer.resize(static_cast<size_t>(dims[0])*dims[1]*dims[2]*ImageFormatSize(format));
+            m_slots[i].view = Image3dView::Packed(0, format, dims, m_slots[i].buffer.data());
+        }
+        m_write_tried.resize(window + SPARE_SLOTS);
+        m_slot_of.reset(new std::atomic<unsigned int>[window + 1]);
+        for (unsigned int i = 0; i <= window; ++i)
+            m_slot_of[i].store(0, std::memory_order_relaxed);
+    }
+
+    unsigned int Window () const {
+        return m_window;
+    }
+
+    /** Start writing the next frame (producer thread only), and return its storage. The frame index is Count().
+        Returns an empty view if the frame must be dropped, since all slots are being read or the maximum frame count is reached. */
+    Image3dView BeginWrite (double time) {
+        const unsigned int index = m_count.load(std::memory_order_relaxed);
+        if (index >= AppendOnlyLog<double>::SEGMENT_SIZE*AppendOnlyLog<double>::MAX_SEGMENTS)
+            return Image3dView();
+
+        // try slots in order of age
+        std::vector<bool> & tried = m_write_tried;
+        tried.assign(tried.size(), false);
+        for (unsigned int attempt = 0; attempt < m_window + SPARE_SLOTS; ++attempt) {
+            unsigned int oldest = 0;
+            for (unsigned int i = 1; i < m_window + SPARE_SLOTS; ++i) {
+                if (tried[oldest] || (!tried[i] && (m_slots[i].sequence.load(std::memory_order_relaxed) < m_slots[oldest].sequence.load(std::memory_order_relaxed))))
+                    oldest = i;
+            }
+            tried[oldest] = true;
+
+            // mark as being written (odd number) before checking for readers, so that readers either back off or are detected
+            Slot & slot = m_slots[oldest];
+            const uint64_t prev = slot.sequence.load(std::memory_order_relaxed);
+            slot.sequence.store(2*uint64_t(index) + 1, std::memory_order_seq_cst);
+            if (slot.readers.load(std::memory_order_seq_cst) != 0) {
+                slot.sequence.store(prev, std::memory_order_seq_cst); // still being read
+                continue;
+            }
+
+            m_write_slot = oldest;
+            m_write_time = time;
+            Image3dView view = slot.view;
+            view.time = time;
+            return view;
+        }
+        return Image3dView();
+    }
+
+    /** Publish the frame started with BeginWrite, together with the ECG of its interval (producer thread only). Throws std::bad_alloc. */
+    void EndWrite (const EcgChunk & ecg) {
+        const unsigned int index = m_count.load(std::memory_order_relaxed);
+        Slot & slot = m_slots[m_write_slot];
+        slot.ecg = ecg;
+        m_times.Append(m_write_time);
+        slot.sequence.store(2*uint64_t(index) + 2, std::memory_order_release);
+        m_slot_of[index % (m_window + 1)].store(m_write_slot, std::memory_order_release);
+        m_count.store(index + 1, std::memory_order_seq_cst);
+        WakeWaiters();
+    }
+
+    /** Signal that no more frames will be appended (producer thread only). */
+    void Close () {
+        m_closed.store(true, std::memory_order_seq_cst);
+        WakeWaiters();
+    }
+
+    /** Number of frames published so far. */
+    unsigned int Count () const {
+        return m_count.load(std::memory_order_acquire);
+    }
+
+    /** Oldest frame normally available. Older frames might remain readable, and frames might also be evicted earlier if many frames are being read. */
+    unsigned int First () const {
+        const unsigned int count = Count();
+        return (count > m_window) ? count - m_window : 0;
+    }
+
+    bool Closed () const {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+    /** Time of a published frame (index < Count()), also if no longer available. */
+    double Time (unsigned int index) const {
+        return m_times[index];
+    }
+
+    /** Get a published frame for reading, and prevent it from being overwritten until Release. Returns false if no longer available. */
+    bool Acquire (unsigned int index, Frame & frame) const {
+        if ((index < First()) || (index >= Count()))
+            return false;
+        const unsigned int slot_idx = m_slot_of[index % (m_window + 1)].load(std::memory_order_acquire);
+        const Slot & slot = m_slots[slot_idx];
+        slot.readers.fetch_add(1, std::memory_order_seq_cst);
+        if (slot.sequence.load(std::memory_order_seq_cst) != 2*uint64_t(index) + 2) {
+            slot.readers.fetch_sub(1, std::memory_order_release);
+            return false; // overwritten since checking First()
+        }
+        frame.view = slot.view;
+        frame.view.time = Time(index);
+        frame.slot = slot_idx;
+        return true;
+    }
+
+    /** Allow a frame from Acquire to be overwritten. */
+    void Release (const Frame & frame) const {
+        m_slots[frame.slot].readers.fetch_sub(1, std::memory_order_release);
+    }
+
+    /** Copy the ECG of a published frame interval. Returns false if no longer available. */
+    bool ReadEcg (unsigned int index, EcgChunk & ecg) const {
+        Frame frame;
+        if (!Acquire(index, frame))
+            return false;
+        ecg = m_slots[frame.slot].ecg;
+        Release(frame);
+        return true;
+    }
+
+    /** Wait up to "timeout_ms" milliseconds (0xFFFFFFFF to wait indefinitely) for Count() to exceed "known_count", or for the ring to be closed.
+        Returns Count(). Consumers only take a lock if they need to wait, and the producer only touches that lock to wake up waiting consumers. */
+    unsigned int Wait (unsigned int known_count, unsigned int timeout_ms) const {
+        unsigned int count = Count();
+        if ((count > known_count) || Closed() || (timeout_ms == 0))
+            return count;
+
+        std::unique_lock<std::mutex> lock(m_wait_mutex);
+        m_waiters.fetch_add(1, std::memory_order_seq_cst); // before re-checking the count, so that the producer sees it if publishing meanwhile
+        auto done = [&] {
+            count = m_count.load(std::memory_order_seq_cst);
+            return (count > known_count) || m_closed.load(std::memory_order_seq_cst);
+        };
+        if (timeout_ms == 0xFFFFFFFF)
+            m_wait_cv.wait(lock, done);
+        else
+            m_wait_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), done);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return count;
+    }
+
+private:
+    LiveFrameRing (const LiveFrameRing &) = delete;
+    LiveFrameRing & operator = (const LiveFrameRing &) = delete;
+
+    struct Slot {
+        std::vector<uint8_t>              buffer;
+        Image3dView                       view;         ///< refers to "buffer" (time not used)
+        EcgChunk                          ecg;
+        std::atomic<uint64_t>             sequence{0};  ///< 2*index+2 when frame "index" is published. Odd while being written.
+        mutable std::atomic<unsigned int> readers{0};   ///< Acquire calls not yet released
+    };
+
+    void WakeWaiters () {
+        if (m_waiters.load(std::memory_order_seq_cst) == 0)
+            return; // nobody waiting (they re-check the count after registering)
+        {
+            // waiters only hold the lock while checking the count, so this is brief
+            std::lock_guard<std::mutex> lock(m_wait_mutex);
+        }
+        m_wait_cv.notify_all();
+    }
+
+    const unsigned int                          m_window;
+    std::unique_ptr<Slot[]>                     m_slots;           ///< m_window + SPARE_SLOTS slots
+    std::unique_ptr<std::atomic<unsigned int>[]> m_slot_of;        ///< slot of frame "index" at [index % (m_window + 1)]
+    AppendOnlyLog<double>                       m_times;           ///< time of every published frame
+    std::vector<bool>                           m_write_tried;     ///< slots tried by BeginWrite (producer side)
+    unsigned int                                m_write_slot = 0;  ///< slot of the frame being written (producer side)
+    double                                      m_write_time = 0;  ///< time of the frame being written (producer side)
+    std::atomic<unsigned int>                   m_count{0};        ///< published frames
+    std::atomic<bool>                           m_closed{false};
+    mutable std::atomic<unsigned int>           m_waiters{0};
+    mutable std::mutex                          m_wait_mutex;
+    mutable std::condition_variable             m_wait_cv;
+};
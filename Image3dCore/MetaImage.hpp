@@ -0,0 +1,330 @@
+/* Portable core of the "3D API" reference loader.
+Read-only file mapping & MetaImage (.mhd/.mha) header parsing, for replaying recorded volumes without reading them up front.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <locale>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Image3dView.hpp"
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+
+/** Read-only mapping of a whole file. Pages are only read from disk when first accessed. */
+class MappedFile {
+public:
+    /** Map "path". Throws std::runtime_error if the file cannot be opened or mapped (incl. empty files). */
+    explicit MappedFile (const std::wstring & path) {
+#ifdef _WIN32
+        m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            Fail("CreateFile");
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(m_file, &size) || (size.QuadPart == 0) || (static_cast<uint64_t>(size.QuadPart) > SIZE_MAX))
+            Fail("GetFileSize");
+        m_size = static_cast<size_t>(size.QuadPart);
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping)
+            Fail("CreateFileMapping");
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)); // map whole file
+        if (!m_data)
+            Fail("MapViewOfFile");
+#else
+        int fd = open(ToUtf8(path).c_str(), O_RDONLY);
+        if (fd < 0)
+            Fail("open");
+        struct stat st = {};
+        if ((fstat(fd, &st) != 0) || (st.st_size <= 0) || (static_cast<uint64_t>(st.st_size) > SIZE_MAX)) {
+            close(fd);
+            Fail("fstat");
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        void * ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd); // mapping remains valid
+        if (ptr == MAP_FAILED)
+            Fail("mmap");
+        m_data = static_cast<const uint8_t*>(ptr);
+#endif
+    }
+
+    ~MappedFile () {
+        Release();
+    }
+
+    const uint8_t * Data () const {
+        return m_data;
+    }
+    size_t Size () const {
+        return m_size;
+    }
+
+private:
+    MappedFile (const MappedFile &) = delete;
+    MappedFile & operator = (const MappedFile &) = delete;
+
+#ifndef _WIN32
+    /** Encode a path for the POSIX file API. */
+    static std::string ToUtf8 (const std::wstring & str) {
+        std::string result;
+        for (wchar_t wc : str) {
+            const auto c = static_cast<uint32_t>(wc);
+            if (c < 0x80) {
+                result += static_cast<char>(c);
+            } else if (c < 0x800) {
+                result += static_cast<char>(0xC0 | (c >> 6));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            } else if (c < 0x10000) {
+                result += static_cast<char>(0xE0 | (c >> 12));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            } else {
+                result += static_cast<char>(0xF0 | (c >> 18));
+                result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+        }
+        return result;
+    }
+#endif
+
+    void Release () {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data)
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+        m_data = nullptr;
+    }
+
+    void Fail (const char * operation) {
+        Release();
+        throw std::runtime_error(std::string(operation) + " failed for mapped file");
+    }
+
+    size_t          m_size = 0;
+    const uint8_t * m_data = nullptr;
+#ifdef _WIN32
+    HANDLE          m_file = INVALID_HANDLE_VALUE;
+    HANDLE          m_mapping = nullptr;
+#endif
+};
+
+
+/** Uncompressed MetaImage (ITK) volume or volume sequence, as described by a .mhd header with separate data file,
+    or a .mha file with the data following the header ("ElementDataFile = LOCAL").
+    Sequences are stored as 4D images, with the 4th ElementSpacing value as frame interval [s].
+    Spatial units are millimeters, and Offset is the center of the first voxel (ITK convention). */
+struct MetaImageHeader {
+    unsigned short dims[3]   = {0,0,0};          ///< resolution (width/columns, height/rows, planes)
+    unsigned int   frames    = 1;
+    ImageFormat    format    = FORMAT_INVALID;
+    double         spacing[4] = {1, 1, 1, 1};    ///< voxel spacing [mm] & frame interval [s]
+    double         offset[3] = {0, 0, 0};        ///< center of first voxel [mm]
+    double         matrix[9] = {1,0,0, 0,1,0, 0,0,1}; ///< row "i" is the direction of axis "i"
+    std::wstring   data_file;                    ///< resolved data file path (the header file itself for LOCAL data)
+    int64_t        header_size = 0;              ///< bytes to skip in the data file, or -1 if the data is at the end of the file
+
+    /** Parse a header. "text" might be followed by binary data, that is not accessed.
+        Throws std::invalid_argument for malformed or unsupported headers. */
+    static MetaImageHeader Parse (const char * text, size_t size, const std::wstring & header_path) {
+        MetaImageHeader header;
+        unsigned int ndims = 0;
+        bool have_dims = false, have_data_file = false;
+
+        size_t pos = 0;
+        while ((pos < size) && !have_data_file) {
+            size_t end = pos;
+            while ((end < size) && (text[end] != '\n')) {
+                if (text[end] == '\0')
+                    throw std::invalid_argument("MetaImage header contains binary data before ElementDataFile");
+                ++end;
+            }
+            const std::string line(text + pos, end - pos);
+            pos = std::min(end + 1, size);
+
+            const size_t eq = line.find('=');
+            if (eq == std::string::npos) {
+                if (Trim(line).empty())
+                    continue;
+                throw std::invalid_argument("MetaImage header line without '='");
+            }
+            const std::string key = Trim(line.substr(0, eq));
+            const std::string val = Trim(line.substr(eq + 1));
+
+            if (key == "ObjectType") {
+                if (val != "Image")
+                    throw std::invalid_argument("MetaImage ObjectType is not Image");
+            } else if (key == "NDims") {
+                const double n = ParseValues(val, 1)[0];
+                if ((n != 3) && (n != 4))
+                    throw std::invalid_argument("MetaImage NDims must be 3 or 4");
+                ndims = static_cast<unsigned int>(n);
+            } else if (key == "DimSize") {
+                const std::vector<double> vals = ParseValues(val, NDims(ndims));
+                for (unsigned int i = 0; i < ndims; ++i) {
+                    if ((vals[i] < 1) || (vals[i] > ((i < 3) ? 0xFFFF : 0xFFFFFFFF)) || (vals[i] != static_cast<uint64_t>(vals[i])))
+                        throw std::invalid_argument("MetaImage DimSize out of range");
+                    if (i < 3)
+                        header.dims[i] = static_cast<unsigned short>(vals[i]);
+                    else
+                        header.frames = static_cast<unsigned int>(vals[i]);
+                }
+                have_dims = true;
+            } else if (key == "ElementSpacing") {
+                const std::vector<double> vals = ParseValues(val, NDims(ndims));
+                for (unsigned int i = 0; i < ndims; ++i) {
+                    if (!(vals[i] > 0))
+                        throw std::invalid_argument("MetaImage ElementSpacing must be positive");
+                    header.spacing[i] = vals[i];
+                }
+            } else if ((key == "Offset") || (key == "Position") || (key == "Origin")) {
+                const std::vector<double> vals = ParseValues(val, NDims(ndims));
+                for (unsigned int i = 0; i < 3; ++i)
+                    header.offset[i] = vals[i];
+            } else if ((key == "TransformMatrix") || (key == "Rotation") || (key == "Orientation")) {
+                const std::vector<double> vals = ParseValues(val, NDims(ndims)*ndims);
+                for (unsigned int r = 0; r < 3; ++r)
+                    for (unsigned int c = 0; c < 3; ++c)
+                        header.matrix[3*r + c] = vals[ndims*r + c];
+            } else if (key == "ElementType") {
+                if (val == "MET_UCHAR")
+                    header.format = FORMAT_U8;
+                else if (val == "MET_USHORT")
+                    header.format = FORMAT_U16;
+                else if (val == "MET_FLOAT")
+                    header.format = FORMAT_F32;
+                else
+                    throw std::invalid_argument("MetaImage ElementType " + val + " not supported (only MET_UCHAR, MET_USHORT & MET_FLOAT)");
+            } else if ((key == "BinaryDataByteOrderMSB") || (key == "ElementByteOrderMSB")) {
+                if (val != "False")
+                    throw std::invalid_argument("MetaImage data must be little-endian");
+            } else if (key == "ElementNumberOfChannels") {
+                if (ParseValues(val, 1)[0] != 1)
+                    throw std::invalid_argument("MetaImage with multiple channels not supported");
+            } else if ((key == "CompressedData") || (key == "BinaryData")) {
+                if (val != ((key == "CompressedData") ? "False" : "True"))
+                    throw std::invalid_argument("MetaImage data must be uncompressed binary");
+            } else if (key == "HeaderSize") {
+                const double skip = ParseValues(val, 1)[0];
+                if ((skip < -1) || (skip > 1e18) || (skip != static_cast<int64_t>(skip)))
+                    throw std::invalid_argument("MetaImage HeaderSize out of range");
+                header.header_size = static_cast<int64_t>(skip);
+            } else if (key == "ElementDataFile") {
+                if (val == "LOCAL") {
+                    // data follows the header (HeaderSize is ignored)
+                    header.data_file = header_path;
+                    header.header_size = static_cast<int64_t>(pos);
+                } else if ((val == "LIST") || (val.find('%') != std::string::npos) || val.empty()) {
+                    throw std::invalid_argument("MetaImage with multiple data files not supported");
+                } else {
+                    header.data_file = ResolvePath(header_path, val);
+                }
+                have_data_file = true; // must be the last field
+            }
+            // other fields (e.g. AnatomicalOrientation & ElementSize) are ignored
+        }
+
+        if ((ndims == 0) || !have_dims || !have_data_file || (header.format == FORMAT_INVALID))
+            throw std::invalid_argument("MetaImage header lacks NDims, DimSize, ElementType or ElementDataFile");
+        return header;
+    }
+
+    /** Frame size [bytes]. */
+    uint64_t FrameSize () const {
+        return uint64_t(dims[0])*dims[1]*dims[2]*ImageFormatSize(format);
+    }
+
+    /** Offset of the first frame in a data file of "file_size" bytes. Throws std::invalid_argument if the file is too small, or the data misaligned. */
+    uint64_t DataOffset (uint64_t file_size) const {
+        const uint64_t frame_size = FrameSize();
+        if ((frame_size == 0) || (frames > file_size/frame_size))
+            throw std::invalid_argument("MetaImage data file is truncated"); // also avoids overflow of the data size below
+        const uint64_t data_size = frame_size*frames;
+        const uint64_t skip = (header_size < 0) ? file_size - std::min(data_size, file_size) : static_cast<uint64_t>(header_size);
+        if ((skip > file_size) || (data_size > file_size - skip))
+            throw std::invalid_argument("MetaImage data file is truncated");
+        if (skip % ImageFormatSize(format) != 0)
+            throw std::invalid_argument("MetaImage data is not aligned to its element size");
+        return skip;
+    }
+
+    /** Volume geometry [m], spanning the voxels (i.e. extended by half a voxel beyond the first & last voxel centers). */
+    Cart3dGeom Geometry () const {
+        const double MM = 0.001; // [m]
+        double origin[3] = { offset[0], offset[1], offset[2] };
+        double dir[3][3] = {};
+        for (unsigned int i = 0; i < 3; ++i) {
+            for (unsigned int c = 0; c < 3; ++c) {
+                origin[c] -= 0.5*spacing[i]*matrix[3*i + c];
+                dir[i][c] = spacing[i]*dims[i]*matrix[3*i + c]*MM;
+            }
+        }
+        Cart3dGeom geom = {
+            static_cast<float>(origin[0]*MM), static_cast<float>(origin[1]*MM), static_cast<float>(origin[2]*MM),
+            static_cast<float>(dir[0][0]), static_cast<float>(dir[0][1]), static_cast<float>(dir[0][2]),
+            static_cast<float>(dir[1][0]), static_cast<float>(dir[1][1]), static_cast<float>(dir[1][2]),
+            static_cast<float>(dir[2][0]), static_cast<float>(dir[2][1]), static_cast<float>(dir[2][2]) };
+        return geom;
+    }
+
+private:
+    static unsigned int NDims (unsigned int ndims) {
+        if (ndims == 0)
+            throw std::invalid_argument("MetaImage NDims must precede per-axis fields");
+        return ndims;
+    }
+
+    static std::string Trim (const std::string & str) {
+        const char * WHITESPACE = " \t\r";
+        const size_t first = str.find_first_not_of(WHITESPACE);
+        if (first == std::string::npos)
+            return std::string();
+        return str.substr(first, str.find_last_not_of(WHITESPACE) + 1 - first);
+    }
+
+    /** Parse "count" whitespace-separated numbers. */
+    static std::vector<double> ParseValues (const std::string & val, unsigned int count) {
+        std::istringstream stream(val);
+        stream.imbue(std::locale::classic());
+        std::vector<double> result(count);
+        for (double & v : result) {
+            if (!(stream >> v))
+                throw std::invalid_argument("MetaImage header value has too few elements");
+        }
+        return result;
+    }
+
+    /** Resolve a data file name relative to the directory of the header file. */
+    static std::wstring ResolvePath (const std::wstring & header_path, const std::string & file_name) {
+        const std::wstring name(file_name.begin(), file_name.end()); // ASCII file names only
+        const bool absolute = (name[0] == L'/') || (name[0] == L'\\') || ((name.size() > 1) && (name[1] == L':'));
+        if (absolute)
+            return name;
+        const size_t dir_end = header_path.find_last_of(L"/\\");
+        return (dir_end == std::wstring::npos) ? name : header_path.substr(0, dir_end + 1) + name;
+    }
+};
@@ -0,0 +1,274 @@
+/* Portable core of the "3D API" reference loader.
+Multi-resolution pyramid of box-filtered 2x reductions, for resampling into coarse output geometries.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "CompressedVolume.hpp"
+
+
+/** Box-filter 2x2x2 reduction of one output row. Generic counterpart of Reduce2xRowU8_Scalar. */
+template <class T>
+static void Reduce2xRow (const T * const rows[4], unsigned int src_width, unsigned int out_width, T * out) {
+    for (unsigned int x = 0; x < out_width; ++x) {
+        const unsigned int x0 = 2*x;
+        const unsigned int x1 = std::min(2*x + 1, src_width - 1);
+        float sum = 0;
+        for (int r = 0; r < 4; ++r)
+            sum += static_cast<float>(rows[r][x0]) + static_cast<float>(rows[r][x1]);
+        float val = sum/8;
+        if (std::numeric_limits<T>::is_integer)
+            val = std::floor(val + 0.5f); // round to nearest
+        out[x] = static_cast<T>(val);
+    }
+}
+
+/** 8bit overload that dispatches to the fastest SIMD kernel supported by the CPU. */
+static inline void Reduce2xRow (const uint8_t * const rows[4], unsigned int src_width, unsigned int out_width, uint8_t * out) {
+    const Reduce2xRowU8Fn kernel = SelectReduce2xRowU8();
+    kernel(rows, src_width, out_width, out);
+}
+
+/** Box-filtered 2x reduction of "src" into "dst", that must have half the resolution of "src" (rounded up).
+    Odd edges are replicated, so that edge voxels are averages of the source voxels they cover. */
+template <class T>
+static void Downsample2x (const Image3dView & src, ThreadPool & pool, const Image3dView & dst) {
+    assert((ImageFormatSize(src.format) == sizeof(T)) && (dst.format == src.format));
+
+    const unsigned short height = dst.dims[1];
+    const unsigned int grain = std::max(1u, 16*1024u/std::max<unsigned int>(src.dims[0], 1)); // min. rows per tile to amortize scheduling overhead
+    pool.ParallelFor(static_cast<unsigned int>(height)*dst.dims[2], grain, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int row = begin; row < end; ++row) {
+            const unsigned int y = row % height;
+            const unsigned int z = row / height;
+            const unsigned int y0 = 2*y, y1 = std::min(2*y + 1, src.dims[1] - 1u);
+            const unsigned int z0 = 2*z, z1 = std::min(2*z + 1, src.dims[2] - 1u);
+            auto src_row = [&src](unsigned int sy, unsigned int sz) {
+                return reinterpret_cast<const T*>(src.data + sy*static_cast<size_t>(src.stride0) + sz*static_cast<size_t>(src.stride1));
+            };
+            const T * const rows[4] = { src_row(y0, z0), src_row(y1, z0), src_row(y0, z1), src_row(y1, z1) };
+            T * out_row = reinterpret_cast<T*>(dst.data + y*static_cast<size_t>(dst.stride0) + z*static_cast<size_t>(dst.stride1));
+            Reduce2xRow(rows, src.dims[0], dst.dims[0], out_row);
+        }
+    });
+}
+
+
+/** Image buffer & geometry of a pyramid level. */
+struct MipLevel {
+    Image3dView view;
+    Cart3dGeom  geom = {};
+};
+
+
+/** Lazily built multi-resolution pyramid of a frame. Level 0 is the frame itself, and each subsequent level
+    is a box-filtered 2x reduction of the previous one, covering the same volume. Levels are only built when first used.
+    Thread-safe. Concurrent first use of a level might build it more than once, which is preferred over blocking,
+    since a thread waiting for a build could otherwise be handed the same work through the thread pool. */
+class MipPyramid {
+public:
+    static const unsigned int MAX_LEVELS = 16;
+
+    /** Level 0 refers to "frame" without copying, so its buffer must outlive the pyramid.
+        If "bricked", level 0 is also copied into a BrickedVolume that is sampled instead of the row-major frame (8bit only). */
+    MipPyramid (const Image3dView & frame, Cart3dGeom geom, bool bricked = false) {
+        if (bricked && (frame.format == FORMAT_U8) && BrickedVolume::Supported(frame.dims))
+            m_bricked.reset(new BrickedVolume(frame));
+
+        Init(frame, geom);
+    }
+
+    /** Level 0 is sampled from a compressed frame, that is decompressed on demand. Coarser levels are built from a temporary
+        decompressed copy, and are kept uncompressed. The level 0 view thereby has no voxel data. */
+    MipPyramid (std::unique_ptr<CompressedVolume> frame, Cart3dGeom geom) : m_compressed(std::move(frame)) {
+        Image3dView base;
+        base.time = m_compressed->time;
+        base.format = m_compressed->format;
+        for (unsigned int i = 0; i < 3; ++i)
+            base.dims[i] = m_compressed->dims[i];
+        Init(base, geom);
+    }
+
+    /** Number of levels, including level 0. */
+    unsigned int LevelCount () const {
+        return m_level_count;
+    }
+
+    /** Pick the coarsest level with voxel spacing not exceeding the output voxel spacing.
+        Spacing is measured along output axes with more than one voxel, and the finest axis decides. */
+    unsigned int SelectLevel (Cart3dGeom out_geom, const unsigned short out_dims[3]) const {
+        vec3f origin, dir[3];
+        std::tie(origin, dir[0], dir[1], dir[2]) = FromCart3dGeom(out_geom);
+        const SourceVoxelMap src = MakeSourceVoxelMap(m_levels[0].geom, m_levels[0].view.dims);
+
+        float spacing = std::numeric_limits<float>::infinity(); // [level 0 voxels]
+        for (unsigned int i = 0; i < 3; ++i) {
+            if (out_dims[i] > 1)
+                spacing = std::min(spacing, length(prod(src.S, dir[i]))/out_dims[i]);
+        }
+        if (!(spacing >= 2) || std::isinf(spacing))
+            return 0; // also single-voxel output & NaN
+
+        const auto level = static_cast<unsigned int>(std::floor(std::log2(spacing) + 1e-3f)); // tolerate rounding errors at exact powers of two
+        return std::min(level, m_level_count - 1);
+    }
+
+    /** Get a level, building it and any missing finer levels first. */
+    MipLevel Level (unsigned int level, ThreadPool & pool) {
+        assert(level < m_level_count);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (level < m_levels.size())
+                return m_levels[level];
+        }
+
+        MipLevel finer = Level(level - 1, pool);
+        std::vector<uint8_t> decompressed;
+        if (!finer.view.data && m_compressed) {
+            // temporary row-major copy of a compressed level 0
+            decompressed.resize(static_cast<size_t>(finer.view.dims[0])*finer.view.dims[1]*finer.view.dims[2]);
+            finer.view = Image3dView::Packed(finer.view.time, finer.view.format, finer.view.dims, decompressed.data());
+            m_compressed->DecodeAll(pool, finer.view);
+        }
+
+        MipLevel result;
+        unsigned short dims[3] = {};
+        vec3f origin, dir[3];
+        std::tie(origin, dir[0], dir[1], dir[2]) = FromCart3dGeom(finer.geom);
+        for (unsigned int i = 0; i < 3; ++i) {
+            dims[i] = Reduce2xDim(finer.view.dims[i]);
+            if (finer.view.dims[i] > 1)
+                dir[i] = (2.0f*dims[i]/finer.view.dims[i])*dir[i]; // extend to cover replicated edge for odd dimensions
+        }
+        result.geom = ToCart3dGeom(origin, dir[0], dir[1], dir[2]);
+
+        // build outside the lock (see class comment)
+        std::unique_ptr<std::vector<uint8_t>> buffer(new std::vector<uint8_t>(static_cast<size_t>(dims[0])*dims[1]*dims[2]*ImageFormatSize(finer.view.format)));
+        result.view = Image3dView::Packed(finer.view.time, finer.view.format, dims, buffer->data());
+        switch (finer.view.format) {
+        case FORMAT_U8:  Downsample2x<uint8_t>(finer.view, pool, result.view); break;
+        case FORMAT_U16: Downsample2x<uint16_t>(finer.view, pool, result.view); break;
+        case FORMAT_F32: Downsample2x<float>(finer.view, pool, result.view); break;
+        default: abort(); // should never be reached
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (level < m_levels.size())
+            return m_levels[level]; // built concurrently by another thread (discard ours)
+        assert(level == m_levels.size());
+        m_buffers.push_back(std::move(buffer));
+        m_levels.push_back(result);
+        return result;
+    }
+
+    /** Bricked copy of level 0, or nullptr if level 0 is sampled from the row-major frame. */
+    const BrickedVolume * Bricked () const {
+        return m_bricked.get();
+    }
+
+    /** Compressed level 0, or nullptr if level 0 is sampled from the row-major frame or its bricked copy. */
+    CompressedVolume * Compressed () const {
+        return m_compressed.get();
+    }
+
+    /** Size of levels built so far, excluding level 0 [bytes]. */
+    size_t BuiltSize () const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t size = 0;
+        for (const auto & buffer : m_buffers)
+            size += buffer->size();
+        return size;
+    }
+
+private:
+    MipPyramid (const MipPyramid &) = delete;
+    MipPyramid & operator = (const MipPyramid &) = delete;
+
+    void Init (const Image3dView & frame, Cart3dGeom geom) {
+        MipLevel base;
+        base.view = frame;
+        base.geom = geom;
+        m_levels.push_back(base);
+
+        // reduce until all dimensions are 1
+        unsigned short dims[3] = { frame.dims[0], frame.dims[1], frame.dims[2] };
+        m_level_count = 1;
+        while ((m_level_count < MAX_LEVELS) && ((dims[0] > 1) || (dims[1] > 1) || (dims[2] > 1))) {
+            for (unsigned int i = 0; i < 3; ++i)
+                dims[i] = Reduce2xDim(dims[i]);
+            ++m_level_count;
+        }
+    }
+
+    static unsigned short Reduce2xDim (unsigned short dim) {
+        return static_cast<unsigned short>((dim + 1)/2);
+    }
+
+    unsigned int                                       m_level_count = 0;
+    std::unique_ptr<const BrickedVolume>               m_bricked;    ///< optional bricked copy of level 0
+    std::unique_ptr<CompressedVolume>                  m_compressed; ///< compressed level 0 (instead of voxel data in the level 0 view)
+    mutable std::mutex                                 m_mutex;
+    std::vector<MipLevel>                              m_levels;     ///< built levels (protected by m_mutex)
+    std::vector<std::unique_ptr<std::vector<uint8_t>>> m_buffers;    ///< storage for levels 1 and above
+};
+
+
+/** Resample a frame pyramid into the geometry and resolution of "out", from the level that best matches the output voxel spacing.
+    Coarse output is thereby box-filtered instead of point-sampled from the full-resolution frame. Works for all formats,
+    since the bricked & compressed copies of level 0 are 8bit only, and row-major levels are sampled through the kernel table.
+    Samples are mapped into 32bit pixels if a "color_map" is passed (see SampleGridRows). */
+static inline void SampleFrame (MipPyramid & pyramid, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    const unsigned int index = pyramid.SelectLevel(out_geom, out.dims);
+    const MipLevel level = pyramid.Level(index, pool);
+    if ((index == 0) && pyramid.Compressed())
+        SampleFrame<uint8_t>(*pyramid.Compressed(), level.geom, out_geom, interp, pool, out, color_map);
+    else if ((index == 0) && pyramid.Bricked())
+        SampleFrame<uint8_t>(*pyramid.Bricked(), level.geom, out_geom, interp, pool, out, color_map);
+    else
+        SampleFrame(level.view, level.geom, out_geom, interp, pool, out, color_map);
+}
+
+/** Resample several planes of a frame pyramid into consecutive planes of "out". The level is picked separately for each plane.
+    The bricked or compressed copy of level 0 is only used if all planes are sampled from level 0. Works for all formats (see SampleFrame). */
+static inline void SampleSlices (MipPyramid & pyramid, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    const unsigned short plane_res[3] = { out.dims[0], out.dims[1], 1 };
+    std::vector<MipLevel>       levels(out.dims[2]);
+    std::vector<VoxelTransform> tr(out.dims[2]);
+    bool full_res = true;
+    for (size_t i = 0; i < tr.size(); ++i) {
+        const unsigned int index = pyramid.SelectLevel(planes[i], plane_res);
+        levels[i] = pyramid.Level(index, pool);
+        full_res &= (index == 0);
+        vec3f origin, dir1, dir2, dir3;
+        std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(planes[i]);
+        tr[i] = ComposeVoxelTransform(levels[i].geom, levels[i].view.dims, origin, dir1, dir2, vec3f(0, 0, 0), plane_res);
+    }
+
+    if (full_res && pyramid.Compressed()) {
+        const std::shared_ptr<const BrickedVolume> decoded = pyramid.Compressed()->Decode(tr, plane_res, pool);
+        SamplePlaneRows<uint8_t>(std::vector<const BrickedVolume*>(levels.size(), decoded.get()), tr, interp, pool, out, color_map);
+    } else if (full_res && pyramid.Bricked()) {
+        SamplePlaneRows<uint8_t>(std::vector<const BrickedVolume*>(levels.size(), pyramid.Bricked()), tr, interp, pool, out, color_map);
+    } else if (pyramid.Compressed()) {
+        // mixed levels, where level 0 has no row-major voxel data, so sample one plane at a time
+        for (size_t i = 0; i < levels.size(); ++i) {
+            Image3dView plane = out;
+            plane.dims[2] = 1;
+            plane.data += i*static_cast<size_t>(out.stride1);
+            const std::vector<VoxelTransform> plane_tr(1, tr[i]);
+            if (levels[i].view.data) {
+                SamplePlaneRows<uint8_t>(std::vector<const Image3dView*>(1, &levels[i].view), plane_tr, interp, pool, plane, color_map);
+            } else {
+                const std::shared_ptr<const BrickedVolume> decoded = pyramid.Compressed()->Decode(plane_tr, plane_res, pool);
+                SamplePlaneRows<uint8_t>(std::vector<const BrickedVolume*>(1, decoded.get()), plane_tr, interp, pool, plane, color_map);
+            }
+        }
+    } else {
+        std::vector<const Image3dView*> frames(levels.size());
+        for (size_t i = 0; i < levels.size(); ++i)
+            frames[i] = &levels[i].view;
+        SamplePlaneRows(frames, tr, interp, pool, out, color_map);
+    }
+}
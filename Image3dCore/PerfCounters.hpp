@@ -0,0 +1,208 @@
+/* Portable core of the "3D API" reference loader.
+Lock-free performance counters for runtime statistics of a loader.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+
+/** Raise "target" to "value" if larger. */
+static inline void AtomicMax (std::atomic<uint64_t> & target, uint64_t value) {
+    uint64_t prev = target.load(std::memory_order_relaxed);
+    while ((prev < value) && !target.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+        // "prev" reloaded by compare_exchange_weak
+    }
+}
+
+
+/** Latency histogram with logarithmic buckets, 8 per octave (12.5% resolution), from 1us up to ~9 hours.
+    Recording only increments relaxed atomics. Percentiles are computed from the buckets as they are read, which might
+    miss calls completed meanwhile. */
+class LatencyHistogram {
+public:
+    static const unsigned int SUB_BUCKETS = 8;                 ///< buckets per octave (latencies below 8us have 1us buckets)
+    static const unsigned int BUCKETS     = SUB_BUCKETS*33;    ///< up to 2^35 us
+
+    LatencyHistogram () {
+        Reset();
+    }
+
+    void Record (uint64_t us) {
+        m_buckets[BucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+        AtomicMax(m_max, us);
+    }
+
+    /** Number of recorded latencies. */
+    uint64_t Count () const {
+        uint64_t count = 0;
+        for (const std::atomic<uint64_t> & bucket : m_buckets)
+            count += bucket.load(std::memory_order_relaxed);
+        return count;
+    }
+
+    /** Latency [us] at quantile "q" in [0,1], as the upper bound of the bucket that contains it (but never above the max latency).
+        Returns 0 if empty. */
+    uint64_t Percentile (double q) const {
+        uint64_t counts[BUCKETS];
+        uint64_t total = 0;
+        for (unsigned int i = 0; i < BUCKETS; ++i) {
+            counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0)
+            return 0;
+
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q*total)));
+        uint64_t cumulative = 0;
+        unsigned int i = 0;
+        for (; i < BUCKETS - 1; ++i) {
+            cumulative += counts[i];
+            if (cumulative >= rank)
+                break;
+        }
+        return std::min(BucketUpperBound(i), Max());
+    }
+
+    /** Max recorded latency [us]. */
+    uint64_t Max () const {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    void Reset () {
+        for (std::atomic<uint64_t> & bucket : m_buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static unsigned int BucketIndex (uint64_t us) {
+        if (us < SUB_BUCKETS)
+            return static_cast<unsigned int>(us);
+
+        unsigned int log2 = 3;
+        while (us >> (log2 + 1))
+            ++log2;
+        const unsigned int shift = log2 - 3; // keep the 3 bits below the leading one
+        const uint64_t index = SUB_BUCKETS*(shift + 1) + ((us >> shift) - SUB_BUCKETS);
+        return static_cast<unsigned int>(std::min<uint64_t>(index, BUCKETS - 1));
+    }
+
+    static uint64_t BucketUpperBound (unsigned int index) {
+        if (index < SUB_BUCKETS)
+            return index;
+
+        const unsigned int shift = index/SUB_BUCKETS - 1;
+        const uint64_t sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_max;
+};
+
+
+/** Runtime statistics of a loader: Call latencies of "METHODS" methods, produced data, memory of output buffers in progress,
+    and output buffers allocated outside of a buffer pool.
+    All counters are lock-free, so that they can be updated on every call. */
+template <unsigned int METHODS>
+class PerfCounters {
+public:
+    /** Record the latency of a method call when going out of scope. */
+    class Call {
+    public:
+        Call (PerfCounters & counters, unsigned int method) : m_histogram(counters.m_methods[method]), m_start(std::chrono::steady_clock::now()) {
+        }
+
+        ~Call () {
+            const auto elapsed = std::chrono::steady_clock::now() - m_start;
+            m_histogram.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+        }
+
+    private:
+        Call (const Call &) = delete;
+        Call & operator = (const Call &) = delete;
+
+        LatencyHistogram &                    m_histogram;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    /** Account for a frame buffer while it's being produced. */
+    class FrameMemory {
+    public:
+        FrameMemory (PerfCounters & counters, uint64_t bytes) : m_counters(counters), m_bytes(bytes) {
+            const uint64_t total = m_counters.m_frame_memory.fetch_add(m_bytes, std::memory_order_relaxed) + m_bytes;
+            AtomicMax(m_counters.m_peak_frame_memory, total);
+        }
+
+        ~FrameMemory () {
+            m_counters.m_frame_memory.fetch_sub(m_bytes, std::memory_order_relaxed);
+        }
+
+    private:
+        FrameMemory (const FrameMemory &) = delete;
+        FrameMemory & operator = (const FrameMemory &) = delete;
+
+        PerfCounters & m_counters;
+        uint64_t       m_bytes;
+    };
+
+    PerfCounters () {
+        Reset();
+    }
+
+    /** Account for a resampled output frame. */
+    void Produced (uint64_t voxels, uint64_t bytes) {
+        m_voxels.fetch_add(voxels, std::memory_order_relaxed);
+        m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /** Account for an output buffer allocated without a buffer pool. */
+    void Allocated () {
+        m_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    const LatencyHistogram & Method (unsigned int method) const {
+        return m_methods[method];
+    }
+
+    uint64_t VoxelsResampled () const {
+        return m_voxels.load(std::memory_order_relaxed);
+    }
+
+    uint64_t BytesProduced () const {
+        return m_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Allocations () const {
+        return m_allocations.load(std::memory_order_relaxed);
+    }
+
+    uint64_t FrameMemoryInUse () const {
+        return m_frame_memory.load(std::memory_order_relaxed);
+    }
+
+    uint64_t PeakFrameMemory () const {
+        return m_peak_frame_memory.load(std::memory_order_relaxed);
+    }
+
+    /** Restart counters from zero. Frame memory of requests in progress is kept, and the peak restarts from it. */
+    void Reset () {
+        for (LatencyHistogram & histogram : m_methods)
+            histogram.Reset();
+        m_voxels.store(0, std::memory_order_relaxed);
+        m_bytes.store(0, std::memory_order_relaxed);
+        m_allocations.store(0, std::memory_order_relaxed);
+        m_peak_frame_memory.store(m_frame_memory.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+private:
+    LatencyHistogram      m_methods[METHODS];
+    std::atomic<uint64_t> m_voxels;
+    std::atomic<uint64_t> m_bytes;
+    std::atomic<uint64_t> m_allocations;
+    std::atomic<uint64_t> m_frame_memory{0};
+    std::atomic<uint64_t> m_peak_frame_memory;
+};
@@ -0,0 +1,685 @@
+/* Portable core of the "3D API" reference loader.
+Nearest-neighbour & trilinear resampling of image volumes into arbitrary geometries.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <tuple>
+#include <vector>
+#include "BrickedVolume.hpp"
+#include "ColorMap.hpp"
+#include "Image3dView.hpp"
+#include "LinAlg.hpp"
+#include "SampleSimd.hpp"
+#include "ThreadPool.hpp"
+
+
+static const uint8_t OUTSIDE_VAL = 0;   // black outside image volume
+
+
+/** Fixed-point voxel coordinate with 32 fractional bits.
+    The integer part is extracted with a shift, which rounds towards -inf so that negative coordinates end up out-of-bounds. */
+struct vec3fixed {
+    static const int   FRAC_BITS = 32;
+    static constexpr double ONE   = 4294967296.0; ///< 2^FRAC_BITS
+    static constexpr float  LIMIT = 1073741824.0f; ///< 2^30, max. magnitude that can be stepped without overflow
+
+    vec3fixed() : x(0), y(0), z(0) {
+    }
+    explicit vec3fixed(vec3f v) : x(ToFixed(v.x)), y(ToFixed(v.y)), z(ToFixed(v.z)) {
+    }
+
+    vec3fixed & operator += (vec3fixed val) {
+        x += val.x;
+        y += val.y;
+        z += val.z;
+        return *this;
+    }
+
+    /** Check if a coordinate is small enough to be stepped without overflow. */
+    static bool InRange (vec3f v) {
+        // comparisons are false for NaN, so it is also rejected
+        return (std::fabs(v.x) < LIMIT) && (std::fabs(v.y) < LIMIT) && (std::fabs(v.z) < LIMIT);
+    }
+
+    /** Convert to fixed-point. Out-of-range values are clamped, which preserve out-of-bounds classification. */
+    static int64_t ToFixed (float val) {
+        if (!(val > -LIMIT))
+            return static_cast<int64_t>(-LIMIT*ONE); // also catch NaN
+        if (val > LIMIT)
+            return static_cast<int64_t>(LIMIT*ONE);
+        return static_cast<int64_t>(std::floor(val*ONE + 0.5));
+    }
+
+    int64_t x, y, z;
+};
+
+
+/** Lower & upper neighbour along one axis for trilinear interpolation between voxel centers, clamped to the edge voxels,
+    together with the 8bit fixed-point weight of the upper neighbour. */
+struct LinearTap {
+    unsigned int c0, c1;
+    uint32_t     w;
+
+    LinearTap (int64_t pos, unsigned short dim) {
+        const int64_t u  = pos - (int64_t(1) << (vec3fixed::FRAC_BITS - 1)); // shift to voxel centers
+        const auto    i0 = static_cast<int>(u >> vec3fixed::FRAC_BITS);
+        const int     hi = dim - 1;
+        c0 = static_cast<unsigned int>(std::min(std::max(i0, 0), hi));
+        c1 = static_cast<unsigned int>(std::min(std::max(i0 + 1, 0), hi));
+        w  = static_cast<uint32_t>(u) >> 24;
+    }
+};
+
+/** Blend columns x0 & x1 of rows (y0,z0), (y1,z0), (y0,z1) & (y1,z1) with 8bit fixed-point weights "w" along x, y & z.
+    Generic counterpart of the LerpFixed blend in SampleRowLinearU8_Scalar. */
+template <class T>
+static T BlendLinear (const T * r00, const T * r10, const T * r01, const T * r11, unsigned int x0, unsigned int x1, const uint32_t w[3]) {
+    auto lerp = [](float a, float b, uint32_t t) {
+        return a + (b - a)*(t/256.0f);
+    };
+    float v0 = lerp(lerp(static_cast<float>(r00[x0]), static_cast<float>(r00[x1]), w[0]), lerp(static_cast<float>(r10[x0]), static_cast<float>(r10[x1]), w[0]), w[1]);
+    float v1 = lerp(lerp(static_cast<float>(r01[x0]), static_cast<float>(r01[x1]), w[0]), lerp(static_cast<float>(r11[x0]), static_cast<float>(r11[x1]), w[0]), w[1]);
+    float val = lerp(v0, v1, w[2]);
+    if (std::numeric_limits<T>::is_integer)
+        val = std::floor(val + 0.5f); // round to nearest
+    return static_cast<T>(val);
+}
+
+/** 8bit overload with exact integer arithmetic (byte-identical to SampleRowLinearU8_Scalar). */
+static inline uint8_t BlendLinear (const uint8_t * r00, const uint8_t * r10, const uint8_t * r01, const uint8_t * r11, unsigned int x0, unsigned int x1, const uint32_t w[3]) {
+    uint32_t v0 = LerpFixed(LerpFixed(r00[x0], r00[x1], w[0]), LerpFixed(r10[x0], r10[x1], w[0]), w[1]);
+    uint32_t v1 = LerpFixed(LerpFixed(r01[x0], r01[x1], w[0]), LerpFixed(r11[x0], r11[x1], w[0]), w[1]);
+    return static_cast<uint8_t>((LerpFixed(v0, v1, w[2]) + (1u << 23)) >> 24);
+}
+
+
+/** Lookup of a single voxel inside the source (see ClipRow), with the interpolation fixed at compile time. */
+template <class T, InterpolationMode INTERP>
+struct VoxelSampler;
+
+/** Nearest-neighbour lookup. */
+template <class T>
+struct VoxelSampler<T, INTERPOLATION_NEAREST> {
+    static T Sample (const Image3dView & frame, const vec3fixed pos) {
+        const auto x = static_cast<size_t>(pos.x >> vec3fixed::FRAC_BITS);
+        const auto y = static_cast<size_t>(pos.y >> vec3fixed::FRAC_BITS);
+        const auto z = static_cast<size_t>(pos.z >> vec3fixed::FRAC_BITS);
+        return reinterpret_cast<const T*>(frame.data + y*frame.stride0 + z*frame.stride1)[x];
+    }
+};
+
+/** Trilinear interpolation between voxel centers, with 8bit fixed-point weights and clamping to the edge voxels. */
+template <class T>
+struct VoxelSampler<T, INTERPOLATION_LINEAR> {
+    static T Sample (const Image3dView & frame, const vec3fixed pos) {
+        const LinearTap tx(pos.x, frame.dims[0]), ty(pos.y, frame.dims[1]), tz(pos.z, frame.dims[2]);
+        auto row = [&frame](unsigned int y, unsigned int z) {
+            return reinterpret_cast<const T*>(frame.data + y*static_cast<size_t>(frame.stride0) + z*static_cast<size_t>(frame.stride1));
+        };
+        const uint32_t w[3] = { tx.w, ty.w, tz.w };
+        return BlendLinear(row(ty.c0, tz.c0), row(ty.c1, tz.c0), row(ty.c0, tz.c1), row(ty.c1, tz.c1), tx.c0, tx.c1, w);
+    }
+};
+
+
+/** Clip a row against the source volume (see ClipRow), and fill the parts outside with OUTSIDE_VAL.
+    Returns the inside part [begin, end), so that only it needs to be resampled. */
+template <class T>
+static void ClipRowFixed (const unsigned short dims[3], const int64_t pos[3], const int64_t inc[3], unsigned short count, T * out, unsigned int & begin, unsigned int & end) {
+    const unsigned int dims32[3] = { dims[0], dims[1], dims[2] };
+    ClipRow(dims32, pos, inc, count, begin, end);
+    std::fill(out, out + begin, static_cast<T>(OUTSIDE_VAL));
+    std::fill(out + end, out + count, static_cast<T>(OUTSIDE_VAL));
+}
+
+
+/** Check if a row inside the source (see ClipRow) reduces to a strided copy, i.e. steps along a single axis by whole voxels.
+    With linear interpolation, the row must also pass through voxel centers, where all interpolation weights are zero.
+    Returns the stepping axis, or -1 if not applicable. */
+static inline int CopyRowAxis (const int64_t * pos, const int64_t * inc, unsigned int axes, bool linear) {
+    const int64_t FRAC_MASK = (int64_t(1) << vec3fixed::FRAC_BITS) - 1;
+    const int64_t HALF      = int64_t(1) << (vec3fixed::FRAC_BITS - 1);
+    int axis = -1;
+    for (unsigned int a = 0; a < axes; ++a) {
+        if (linear && ((pos[a] & FRAC_MASK) != HALF))
+            return -1;
+        if (inc[a] != 0) {
+            if ((axis >= 0) || ((inc[a] & FRAC_MASK) != 0))
+                return -1;
+            axis = static_cast<int>(a);
+        }
+    }
+    return axis;
+}
+
+/** Copy "count" voxels, starting at "src" and stepping "stride" bytes (possibly negative). Unit strides are copied with memcpy. */
+static inline void CopyStridedU8 (const uint8_t * src, int64_t stride, unsigned int count, uint8_t * out) {
+    if (stride == 1) {
+        memcpy(out, src, count);
+        return;
+    }
+    for (unsigned int i = 0; i < count; ++i)
+        out[i] = src[i*stride];
+}
+
+
+/** Resample "count" voxels of a row that is entirely inside the source (see ClipRow), without per-voxel branches. */
+template <class T, InterpolationMode INTERP>
+static void SampleRowInterior (const Image3dView & frame, vec3fixed pos, const vec3fixed inc, unsigned int count, T * out) {
+    for (unsigned int x = 0; x < count; ++x) {
+        out[x] = VoxelSampler<T, INTERP>::Sample(frame, pos);
+        pos += inc;
+    }
+}
+
+/** Resample one output row with incremental fixed-point stepping. */
+template <class T>
+static void SampleRowFixed (const Image3dView & frame, vec3fixed pos, const vec3fixed inc, unsigned short count, InterpolationMode interp, T * out) {
+    assert(ImageFormatSize(frame.format) == sizeof(T));
+
+    const int64_t p[3] = { pos.x, pos.y, pos.z };
+    const int64_t d[3] = { inc.x, inc.y, inc.z };
+    unsigned int begin = 0, end = 0;
+    ClipRowFixed(frame.dims, p, d, count, out, begin, end);
+
+    pos.x += begin*inc.x;
+    pos.y += begin*inc.y;
+    pos.z += begin*inc.z;
+    if (interp == INTERPOLATION_LINEAR)
+        SampleRowInterior<T, INTERPOLATION_LINEAR>(frame, pos, inc, end - begin, out + begin);
+    else
+        SampleRowInterior<T, INTERPOLATION_NEAREST>(frame, pos, inc, end - begin, out + begin);
+}
+
+/** 8bit overload that dispatches to the fastest SIMD kernel supported by the CPU. */
+static inline void SampleRowFixed (const Image3dView & frame, vec3fixed pos, const vec3fixed inc, unsigned short count, InterpolationMode interp, uint8_t * out) {
+    assert(ImageFormatSize(frame.format) == sizeof(uint8_t));
+
+    VoxelGridU8 src = {};
+    src.data = frame.data;
+    for (size_t i = 0; i < 3; ++i)
+        src.dims[i] = frame.dims[i];
+    src.stride0 = frame.stride0;
+    src.stride1 = frame.stride1;
+
+    const int64_t p[3] = { pos.x, pos.y, pos.z };
+    const int64_t d[3] = { inc.x, inc.y, inc.z };
+    const bool linear = (interp == INTERPOLATION_LINEAR);
+
+    // only resample the part of the row inside the volume (also skips empty volumes)
+    unsigned int begin = 0, end = 0;
+    ClipRowFixed(frame.dims, p, d, count, out, begin, end);
+    if (begin < end) {
+        const int64_t start[3] = { p[0] + begin*d[0], p[1] + begin*d[1], p[2] + begin*d[2] };
+        const int axis = CopyRowAxis(start, d, 3, linear);
+        if (axis >= 0) {
+            // axis-aligned row with integer step (memcpy for unit steps along x)
+            const int64_t strides[3] = { 1, frame.stride0, frame.stride1 };
+            const uint8_t * first = src.data + (start[0] >> 32) + (start[1] >> 32)*strides[1] + (start[2] >> 32)*strides[2];
+            CopyStridedU8(first, (d[axis] >> 32)*strides[axis], end - begin, out + begin);
+        } else {
+            // SIMD kernels use 32bit indices
+            const bool simd_ok = static_cast<uint64_t>(frame.stride1)*frame.dims[2] < 0x7FFFFFF0u;
+            SampleRowU8Fn kernel = linear ? SampleRowLinearInteriorU8_Scalar : SampleRowInteriorU8_Scalar;
+            if (simd_ok)
+                kernel = linear ? SelectSampleRowLinearU8() : SelectSampleRowU8();
+            kernel(src, start, d, end - begin, OUTSIDE_VAL, out + begin);
+        }
+    }
+}
+
+/** Bricked 8bit overload, that dispatches to the fastest table-addressed SIMD kernel. */
+static inline void SampleRowFixed (const BrickedVolume & frame, vec3fixed pos, const vec3fixed inc, unsigned short count, InterpolationMode interp, uint8_t * out) {
+    const VoxelGridU8 src = frame.Grid();
+    const int64_t p[3] = { pos.x, pos.y, pos.z };
+    const int64_t d[3] = { inc.x, inc.y, inc.z };
+    const bool linear = (interp == INTERPOLATION_LINEAR);
+
+    unsigned int begin = 0, end = 0;
+    ClipRowFixed(frame.dims, p, d, count, out, begin, end);
+    if (begin < end) {
+        const SampleRowU8Fn kernel = linear ? SelectSampleRowLinearBrickedU8() : SelectSampleRowBrickedU8();
+        const int64_t start[3] = { p[0] + begin*d[0], p[1] + begin*d[1], p[2] + begin*d[2] };
+        kernel(src, start, d, end - begin, OUTSIDE_VAL, out + begin);
+    }
+}
+
+
+/** Resample one output row by stepping source coordinates with a fixed increment.
+    "Frame" is either a row-major Image3dView or a BrickedVolume. */
+template <class T, class Frame>
+static void SampleRow (const Frame & frame, vec3f start, vec3f step, unsigned short count, InterpolationMode interp, T * out) {
+    if (count == 0)
+        return;
+
+    const vec3f end = start + static_cast<float>(count-1)*step;
+    if (vec3fixed::InRange(start) && vec3fixed::InRange(end)) {
+        // common case: incremental fixed-point stepping
+        SampleRowFixed(frame, vec3fixed(start), vec3fixed(step), count, interp, out);
+    } else {
+        // row extends far outside the volume, so convert each voxel separately to avoid overflow
+        for (unsigned short x = 0; x < count; ++x)
+            SampleRowFixed(frame, vec3fixed(start + static_cast<float>(x)*step), vec3fixed(), 1, interp, out + x);
+    }
+}
+
+
+/** Rows per tile for single slices. Tiles are smaller than for volumes, so that all threads participate even for small slices. */
+static inline unsigned int SliceGrain (const Image3dView & out, const ThreadPool & pool) {
+    const unsigned int min_grain = std::max(1u, 16*1024u/std::max<unsigned int>(out.dims[0], 1)); // min. rows per tile to amortize scheduling overhead
+    return std::max(1u, std::min(min_grain, out.dims[1]/(4*pool.ThreadCount())));
+}
+
+/** Resample a slice that lies within a single plane of an 8bit frame, i.e. where the source coordinate along one axis is constant,
+    through the 2D plane kernels. With linear interpolation, the slice must also be centered on the plane or clamped to an edge plane,
+    so that the neighbouring plane has no weight. Byte-identical to the 3D kernels. Returns false if not applicable. */
+static inline bool SampleSliceInPlane (const Image3dView & frame, const VoxelTransform & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out) {
+    if ((frame.format != FORMAT_U8) || (out.format != FORMAT_U8) || (frame.dims[0] == 0) || (frame.dims[1] == 0) || (frame.dims[2] == 0))
+        return false;
+    if (static_cast<uint64_t>(frame.stride1)*frame.dims[2] >= 0x7FFFFFF0u)
+        return false; // SIMD kernels use 32bit indices
+
+    // constant source axis
+    const float origin[3] = { tr.origin.x, tr.origin.y, tr.origin.z };
+    const float step_x[3] = { tr.step_x.x, tr.step_x.y, tr.step_x.z };
+    const float step_y[3] = { tr.step_y.x, tr.step_y.y, tr.step_y.z };
+    int axis = 0;
+    while ((axis < 3) && ((step_x[axis] != 0) || (step_y[axis] != 0)))
+        ++axis;
+    if ((axis == 3) || !vec3fixed::InRange(tr.origin))
+        return false;
+    const int in_plane[2] = { (axis == 0) ? 1 : 0, (axis == 2) ? 1 : 2 };
+    const unsigned int strides[3] = { 1, frame.stride0, frame.stride1 };
+
+    // the whole slice is outside if the constant coordinate is (same test as the 3D kernels)
+    const int64_t pc = vec3fixed::ToFixed(origin[axis]);
+    if ((static_cast<uint64_t>(pc) >> vec3fixed::FRAC_BITS) >= frame.dims[axis]) {
+        for (unsigned int y = 0; y < out.dims[1]; ++y)
+            std::fill(out.data + y*static_cast<size_t>(out.stride0), out.data + y*static_cast<size_t>(out.stride0) + out.dims[0], OUTSIDE_VAL);
+        return true;
+    }
+
+    unsigned int plane = static_cast<unsigned int>(static_cast<uint64_t>(pc) >> vec3fixed::FRAC_BITS);
+    if (interp == INTERPOLATION_LINEAR) {
+        const int64_t u  = pc - (int64_t(1) << (vec3fixed::FRAC_BITS - 1)); // shift to voxel centers
+        const auto    i0 = static_cast<int>(u >> vec3fixed::FRAC_BITS);
+        const int     hi = frame.dims[axis] - 1;
+        const int     c0 = std::min(std::max(i0, 0), hi);
+        const int     c1 = std::min(std::max(i0 + 1, 0), hi);
+        if (((static_cast<uint32_t>(u) >> 24) != 0) && (c0 != c1))
+            return false; // interpolates between two planes
+        plane = static_cast<unsigned int>(c0);
+    }
+
+    PlaneGridU8 src = {};
+    src.data = frame.data + plane*static_cast<size_t>(strides[axis]);
+    for (int a = 0; a < 2; ++a) {
+        src.dims[a]   = frame.dims[in_plane[a]];
+        src.stride[a] = strides[in_plane[a]];
+    }
+    const SamplePlaneRowU8Fn kernel = (interp == INTERPOLATION_LINEAR) ? SelectSamplePlaneRowLinearU8() : SelectSamplePlaneRowU8();
+
+    const unsigned short width = out.dims[0];
+    pool.ParallelFor(out.dims[1], SliceGrain(out, pool), [&](unsigned int begin, unsigned int end) {
+        for (unsigned int y = begin; y < end; ++y) {
+            const vec3f row_start = tr.origin + static_cast<float>(y)*tr.step_y;
+            uint8_t * out_row = out.data + y*static_cast<size_t>(out.stride0);
+            if (!vec3fixed::InRange(row_start) || !vec3fixed::InRange(row_start + static_cast<float>(width - 1)*tr.step_x)) {
+                SampleRow<uint8_t>(frame, row_start, tr.step_x, width, interp, out_row); // see SampleRow
+                continue;
+            }
+
+            const float start[3] = { row_start.x, row_start.y, row_start.z };
+            const int64_t pos[3] = { vec3fixed::ToFixed(start[in_plane[0]]), vec3fixed::ToFixed(start[in_plane[1]]), 0 };
+            const int64_t inc[3] = { vec3fixed::ToFixed(step_x[in_plane[0]]), vec3fixed::ToFixed(step_x[in_plane[1]]), 0 };
+            const unsigned short dims[3] = { static_cast<unsigned short>(src.dims[0]), static_cast<unsigned short>(src.dims[1]), 1 };
+            unsigned int first = 0, last = 0;
+            ClipRowFixed(dims, pos, inc, width, out_row, first, last);
+            if (first < last) {
+                const int64_t row_pos[2] = { pos[0] + first*inc[0], pos[1] + first*inc[1] };
+                const int copy_axis = CopyRowAxis(row_pos, inc, 2, interp == INTERPOLATION_LINEAR);
+                if (copy_axis >= 0) {
+                    const uint8_t * first_voxel = src.data + (row_pos[0] >> 32)*src.stride[0] + (row_pos[1] >> 32)*src.stride[1];
+                    CopyStridedU8(first_voxel, (inc[copy_axis] >> 32)*src.stride[copy_axis], last - first, out_row + first);
+                } else {
+                    kernel(src, row_pos, inc, last - first, out_row + first);
+                }
+            }
+        }
+    });
+    return true;
+}
+
+/** Geometry class of an output grid relative to the source voxels (see ClassifyGeometry), which decides the resampling kernel. */
+enum GeometryClass {
+    GEOMETRY_IDENTITY,     ///< output voxels coincide with the source voxels, so rows are copied
+    GEOMETRY_AXIS_ALIGNED, ///< output rows run along source rows, so that source columns are shared by all rows
+    GEOMETRY_SINGLE_SLICE, ///< any other single slice (out.dims[2] == 1)
+    GEOMETRY_OBLIQUE,      ///< any other volume
+    GEOMETRY_CLASS_COUNT
+};
+
+/** Classify the mapping "tr" from output voxel indices of "out" into source voxel coordinates of "frame".
+    Identity requires the origin to be exactly on a voxel corner (nearest-neighbour) or center (linear), to match the rounding of the row kernels.
+    Axis-aligned only constrains the source x axis, so that planes rotated about it are also included. */
+static inline GeometryClass ClassifyGeometry (const Image3dView & frame, const VoxelTransform & tr, InterpolationMode interp, const Image3dView & out) {
+    const bool  slice  = (out.dims[2] == 1);
+    const float offset = (interp == INTERPOLATION_LINEAR) ? 0.5f : 0.0f;
+    if ((out.dims[0] == frame.dims[0]) && (out.dims[1] == frame.dims[1]) && (out.dims[2] == frame.dims[2])
+        && (tr.origin == vec3f(offset, offset, offset)) && (tr.step_x == vec3f(1, 0, 0)) && (tr.step_y == vec3f(0, 1, 0)) && (slice || (tr.step_z == vec3f(0, 0, 1))))
+        return GEOMETRY_IDENTITY;
+
+    if ((tr.step_x.y == 0) && (tr.step_x.z == 0) && (tr.step_y.x == 0) && (tr.step_z.x == 0))
+        return GEOMETRY_AXIS_ALIGNED;
+
+    return slice ? GEOMETRY_SINGLE_SLICE : GEOMETRY_OBLIQUE;
+}
+
+
+/** Resample the output grid of "out" row by row through "tr". Single slices are split into smaller tiles (see SliceGrain).
+    With a "color_map", each row is sampled into a per-tile scratch row, and then mapped into the 32bit pixels of "out". */
+template <class T, class Frame>
+static void SampleGridRows (const Frame & frame, const VoxelTransform & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    assert(color_map ? (out.format == color_map->Format()) : (ImageFormatSize(out.format) == sizeof(T)));
+    const unsigned short width = out.dims[0];
+    const unsigned short height = out.dims[1];
+    const unsigned int grain = (out.dims[2] == 1) ? SliceGrain(out, pool) : std::max(1u, 16*1024u/std::max<unsigned int>(width, 1)); // min. rows per tile to amortize scheduling overhead
+    pool.ParallelFor(static_cast<unsigned int>(height)*out.dims[2], grain, [&](unsigned int begin, unsigned int end) {
+        std::vector<T> scratch(color_map ? width : 0);
+        for (unsigned int row = begin; row < end; ++row) {
+            const unsigned int y = row % height;
+            const unsigned int z = row / height;
+            vec3f row_start = tr.origin + static_cast<float>(y)*tr.step_y + static_cast<float>(z)*tr.step_z;
+            uint8_t * out_row = out.data + y*static_cast<size_t>(out.stride0) + z*static_cast<size_t>(out.stride1);
+            if (color_map) {
+                SampleRow<T>(frame, row_start, tr.step_x, width, interp, scratch.data());
+                color_map->MapRow(scratch.data(), width, reinterpret_cast<uint32_t*>(out_row));
+            } else {
+                SampleRow<T>(frame, row_start, tr.step_x, width, interp, reinterpret_cast<T*>(out_row));
+            }
+        }
+    });
+}
+
+
+/** Resampling kernel for a row-major frame, specialized at compile time on sample type, interpolation & geometry class. */
+template <class T, InterpolationMode INTERP, GeometryClass GEOM>
+struct FrameKernel;
+
+/** Copy rows unchanged. */
+template <class T, InterpolationMode INTERP>
+struct FrameKernel<T, INTERP, GEOMETRY_IDENTITY> {
+    static void Run (const Image3dView & frame, const VoxelTransform & /*tr*/, ThreadPool & pool, const Image3dView & out) {
+        const size_t row_size = out.dims[0]*sizeof(T);
+        const unsigned int grain = std::max(1u, 64*1024u/std::max<unsigned int>(static_cast<unsigned int>(row_size), 1)); // min. rows per tile to amortize scheduling overhead
+        pool.ParallelFor(static_cast<unsigned int>(out.dims[1])*out.dims[2], grain, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int row = begin; row < end; ++row) {
+                const unsigned int y = row % out.dims[1];
+                const unsigned int z = row / out.dims[1];
+                memcpy(out.data + y*static_cast<size_t>(out.stride0) + z*static_cast<size_t>(out.stride1), frame.data + y*static_cast<size_t>(frame.stride0) + z*static_cast<size_t>(frame.stride1), row_size);
+            }
+        });
+    }
+};
+
+/** Rows along source rows. Source columns & interpolation weights along x are computed once, and each row only
+    locates its source row(s), so that voxels are gathered through a column table. Rows with unit steps are copied.
+    Byte-identical to the row kernels, since the table holds the same fixed-point coordinates as incremental stepping. */
+template <class T, InterpolationMode INTERP>
+struct FrameKernel<T, INTERP, GEOMETRY_AXIS_ALIGNED> {
+    static void Run (const Image3dView & frame, const VoxelTransform & tr, ThreadPool & pool, const Image3dView & out) {
+        const bool linear = (INTERP == INTERPOLATION_LINEAR);
+        const unsigned short width = out.dims[0];
+        const unsigned short height = out.dims[1];
+        const float last_x = tr.origin.x + static_cast<float>(width - 1)*tr.step_x.x; // x is constant across rows
+        if ((width == 0) || (frame.dims[0] == 0) || !(std::fabs(tr.origin.x) < vec3fixed::LIMIT) || !(std::fabs(last_x) < vec3fixed::LIMIT)) {
+            SampleGridRows<T>(frame, tr, INTERP, pool, out); // every row needs per-voxel conversion (see SampleRow)
+            return;
+        }
+
+        // source columns [begin, end) inside the frame, with the same footprint as the row kernels
+        const int64_t x0 = vec3fixed::ToFixed(tr.origin.x);
+        const int64_t dx = vec3fixed::ToFixed(tr.step_x.x);
+        std::vector<LinearTap> cols;
+        cols.reserve(width);
+        unsigned int begin = width, end = width;
+        bool unit_step = true; // consecutive source columns without interpolation weight
+        for (unsigned int x = 0; x < width; ++x) {
+            const int64_t pos = x0 + x*dx;
+            if ((static_cast<uint64_t>(pos) >> vec3fixed::FRAC_BITS) >= frame.dims[0]) {
+                cols.push_back(LinearTap(0, 1));
+                continue;
+            }
+            LinearTap tap(pos, frame.dims[0]);
+            if (!linear)
+                tap.c0 = static_cast<unsigned int>(pos >> vec3fixed::FRAC_BITS);
+            if (begin == width)
+                begin = x;
+            else
+                unit_step &= (tap.c0 == cols.back().c0 + 1);
+            unit_step &= !linear || (tap.w == 0);
+            end = x + 1;
+            cols.push_back(tap);
+        }
+
+        const unsigned int grain = (out.dims[2] == 1) ? SliceGrain(out, pool) : std::max(1u, 16*1024u/width); // min. rows per tile to amortize scheduling overhead
+        pool.ParallelFor(static_cast<unsigned int>(height)*out.dims[2], grain, [&](unsigned int row_begin, unsigned int row_end) {
+            for (unsigned int row = row_begin; row < row_end; ++row) {
+                const unsigned int y = row % height;
+                const unsigned int z = row / height;
+                const vec3f row_start = tr.origin + static_cast<float>(y)*tr.step_y + static_cast<float>(z)*tr.step_z;
+                T * out_row = reinterpret_cast<T*>(out.data + y*static_cast<size_t>(out.stride0) + z*static_cast<size_t>(out.stride1));
+                if (!vec3fixed::InRange(row_start)) {
+                    SampleRow<T>(frame, row_start, tr.step_x, width, INTERP, out_row); // see SampleRow
+                    continue;
+                }
+
+                const int64_t py = vec3fixed::ToFixed(row_start.y);
+                const int64_t pz = vec3fixed::ToFixed(row_start.z);
+                if (((static_cast<uint64_t>(py) >> vec3fixed::FRAC_BITS) >= frame.dims[1]) || ((static_cast<uint64_t>(pz) >> vec3fixed::FRAC_BITS) >= frame.dims[2])) {
+                    std::fill(out_row, out_row + width, static_cast<T>(OUTSIDE_VAL));
+                    continue;
+                }
+                std::fill(out_row, out_row + begin, static_cast<T>(OUTSIDE_VAL));
+                std::fill(out_row + end, out_row + width, static_cast<T>(OUTSIDE_VAL));
+                if (begin < end)
+                    SampleRowColumns(frame, py, pz, cols.data(), begin, end, unit_step, out_row);
+            }
+        });
+    }
+
+private:
+    static const T * Row (const Image3dView & frame, unsigned int y, unsigned int z) {
+        return reinterpret_cast<const T*>(frame.data + y*static_cast<size_t>(frame.stride0) + z*static_cast<size_t>(frame.stride1));
+    }
+
+    static void SampleRowColumns (const Image3dView & frame, int64_t py, int64_t pz, const LinearTap * cols, unsigned int begin, unsigned int end, bool unit_step, T * out) {
+        if (INTERP == INTERPOLATION_LINEAR) {
+            const LinearTap ty(py, frame.dims[1]), tz(pz, frame.dims[2]);
+            const T * r00 = Row(frame, ty.c0, tz.c0);
+            if (unit_step && (ty.w == 0) && (tz.w == 0)) {
+                memcpy(out + begin, r00 + cols[begin].c0, (end - begin)*sizeof(T));
+                return;
+            }
+            const T * r10 = Row(frame, ty.c1, tz.c0);
+            const T * r01 = Row(frame, ty.c0, tz.c1);
+            const T * r11 = Row(frame, ty.c1, tz.c1);
+            uint32_t w[3] = { 0, ty.w, tz.w };
+            for (unsigned int x = begin; x < end; ++x) {
+                w[0] = cols[x].w;
+                out[x] = BlendLinear(r00, r10, r01, r11, cols[x].c0, cols[x].c1, w);
+            }
+        } else {
+            const T * src = Row(frame, static_cast<unsigned int>(py >> vec3fixed::FRAC_BITS), static_cast<unsigned int>(pz >> vec3fixed::FRAC_BITS));
+            if (unit_step) {
+                memcpy(out + begin, src + cols[begin].c0, (end - begin)*sizeof(T));
+                return;
+            }
+            for (unsigned int x = begin; x < end; ++x)
+                out[x] = src[cols[x].c0];
+        }
+    }
+};
+
+/** Oblique single slice, through the row kernels with latency-oriented tiling. */
+template <class T, InterpolationMode INTERP>
+struct FrameKernel<T, INTERP, GEOMETRY_SINGLE_SLICE> {
+    static void Run (const Image3dView & frame, const VoxelTransform & tr, ThreadPool & pool, const Image3dView & out) {
+        SampleGridRows<T>(frame, tr, INTERP, pool, out);
+    }
+};
+
+/** 8bit slices within a single source plane are sampled through the 2D plane kernels (see SampleSliceInPlane). */
+template <InterpolationMode INTERP>
+struct FrameKernel<uint8_t, INTERP, GEOMETRY_SINGLE_SLICE> {
+    static void Run (const Image3dView & frame, const VoxelTransform & tr, ThreadPool & pool, const Image3dView & out) {
+        if (!SampleSliceInPlane(frame, tr, INTERP, pool, out))
+            SampleGridRows<uint8_t>(frame, tr, INTERP, pool, out);
+    }
+};
+
+/** Oblique volume, through the row kernels. */
+template <class T, InterpolationMode INTERP>
+struct FrameKernel<T, INTERP, GEOMETRY_OBLIQUE> {
+    static void Run (const Image3dView & frame, const VoxelTransform & tr, ThreadPool & pool, const Image3dView & out) {
+        SampleGridRows<T>(frame, tr, INTERP, pool, out);
+    }
+};
+
+
+typedef void (*FrameKernelFn)(const Image3dView & frame, const VoxelTransform & tr, ThreadPool & pool, const Image3dView & out);
+
+/** Pick the resampling kernel for a format, interpolation & geometry class from the table of compile-time specializations. */
+static inline FrameKernelFn SelectFrameKernel (ImageFormat format, InterpolationMode interp, GeometryClass geom) {
+#define FRAME_KERNELS(T, INTERP) { FrameKernel<T, INTERP, GEOMETRY_IDENTITY>::Run, FrameKernel<T, INTERP, GEOMETRY_AXIS_ALIGNED>::Run, \
+                                   FrameKernel<T, INTERP, GEOMETRY_SINGLE_SLICE>::Run, FrameKernel<T, INTERP, GEOMETRY_OBLIQUE>::Run }
+    static const FrameKernelFn table[][2][GEOMETRY_CLASS_COUNT] = {
+        { {}, {} }, // FORMAT_INVALID
+        { FRAME_KERNELS(uint8_t,  INTERPOLATION_NEAREST), FRAME_KERNELS(uint8_t,  INTERPOLATION_LINEAR) }, // FORMAT_U8
+        { FRAME_KERNELS(uint16_t, INTERPOLATION_NEAREST), FRAME_KERNELS(uint16_t, INTERPOLATION_LINEAR) }, // FORMAT_U16
+        { FRAME_KERNELS(float,    INTERPOLATION_NEAREST), FRAME_KERNELS(float,    INTERPOLATION_LINEAR) }, // FORMAT_F32
+    };
+#undef FRAME_KERNELS
+    static_assert(sizeof(table)/sizeof(table[0]) == FORMAT_F32 + 1, "kernel table must cover all formats");
+
+    assert((format > FORMAT_INVALID) && (format <= FORMAT_F32) && ((interp == INTERPOLATION_NEAREST) || (interp == INTERPOLATION_LINEAR)));
+    return table[format][interp][geom];
+}
+
+
+/** Resample the output grid of "out" from a row-major frame of any format, with the tightest kernel picked once up front.
+    Color-mapped output always goes through the row kernels, since the specialized kernels write samples straight into "out". */
+static inline void SampleGrid (const Image3dView & frame, const VoxelTransform & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    if (color_map) {
+        switch (frame.format) {
+        case FORMAT_U8:  SampleGridRows<uint8_t>(frame, tr, interp, pool, out, color_map); break;
+        case FORMAT_U16: SampleGridRows<uint16_t>(frame, tr, interp, pool, out, color_map); break;
+        case FORMAT_F32: SampleGridRows<float>(frame, tr, interp, pool, out, color_map); break;
+        default: abort(); // should never be reached
+        }
+        return;
+    }
+
+    assert(out.format == frame.format);
+    SelectFrameKernel(frame.format, interp, ClassifyGeometry(frame, tr, interp, out))(frame, tr, pool, out);
+}
+
+/** Resample the output grid of "out" from a bricked 8bit frame, through the table-addressed row kernels. */
+static inline void SampleGrid (const BrickedVolume & frame, const VoxelTransform & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    SampleGridRows<uint8_t>(frame, tr, interp, pool, out, color_map);
+}
+
+
+/** Map output voxel indices of a "out_geom" grid with resolution "out_dims" into source voxel coordinates. Single slices (out_dims[2] == 1)
+    are spanned by origin, dir1 & dir2 (dir3 is ignored, since output voxel 0 is on the origin plane). */
+static inline VoxelTransform OutputTransform (Cart3dGeom frame_geom, const unsigned short frame_dims[3], Cart3dGeom out_geom, const unsigned short out_dims[3]) {
+    vec3f out_origin, out_dir1, out_dir2, out_dir3;
+    std::tie(out_origin, out_dir1, out_dir2, out_dir3) = FromCart3dGeom(out_geom);
+    if (out_dims[2] == 1) {
+        const unsigned short plane_res[3] = { out_dims[0], out_dims[1], 1 };
+        return ComposeVoxelTransform(frame_geom, frame_dims, out_origin, out_dir1, out_dir2, vec3f(0, 0, 0), plane_res);
+    }
+
+    // allow 3rd axis to be empty if only retrieving a single slice
+    if ((out_dir3 == vec3f(0, 0, 0)) && (out_dims[2] < 2))
+        out_dir3 = cross_prod(out_dir1, out_dir2);
+    return ComposeVoxelTransform(frame_geom, frame_dims, out_origin, out_dir1, out_dir2, out_dir3, out_dims);
+}
+
+/** Resample a frame into the geometry and resolution of "out", that must point to a pre-allocated buffer.
+    Output rows are split into tiles that are processed in parallel by "pool". "Frame" is either a row-major Image3dView or a BrickedVolume.
+    Samples are mapped into 32bit pixels if a "color_map" is passed, in which case out.format must match it. */
+template <class T, class Frame>
+static void SampleFrame (const Frame & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    assert(color_map ? (out.format == color_map->Format()) : (ImageFormatSize(out.format) == sizeof(T)));
+    SampleGrid(frame, OutputTransform(frame_geom, frame.dims, out_geom, out.dims), interp, pool, out, color_map);
+}
+
+/** Format-independent overload for row-major frames. */
+static inline void SampleFrame (const Image3dView & frame, Cart3dGeom frame_geom, Cart3dGeom out_geom, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    SampleGrid(frame, OutputTransform(frame_geom, frame.dims, out_geom, out.dims), interp, pool, out, color_map);
+}
+
+
+/** Resample planes into consecutive planes of "out", where plane "p" is sampled from "frames[p]" through the
+    voxel transform "tr[p]" (step_z is unused). Rows from all planes are processed in parallel by "pool".
+    Samples are mapped into 32bit pixels if a "color_map" is passed (see SampleGridRows). */
+template <class T, class Frame>
+static void SamplePlaneRows (const std::vector<const Frame*> & frames, const std::vector<VoxelTransform> & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    assert((frames.size() == out.dims[2]) && (tr.size() == out.dims[2]));
+    assert(color_map ? (out.format == color_map->Format()) : (ImageFormatSize(out.format) == sizeof(T)));
+
+    const unsigned short width = out.dims[0];
+    const unsigned short height = out.dims[1];
+    const unsigned int grain = std::max(1u, 16*1024u/std::max<unsigned int>(width, 1)); // min. rows per tile to amortize scheduling overhead
+    pool.ParallelFor(static_cast<unsigned int>(height)*out.dims[2], grain, [&](unsigned int begin, unsigned int end) {
+        std::vector<T> scratch(color_map ? width : 0);
+        for (unsigned int row = begin; row < end; ++row) {
+            const unsigned int y = row % height;
+            const unsigned int p = row / height;
+            vec3f row_start = tr[p].origin + static_cast<float>(y)*tr[p].step_y;
+            uint8_t * out_row = out.data + y*static_cast<size_t>(out.stride0) + p*static_cast<size_t>(out.stride1);
+            if (color_map) {
+                SampleRow<T>(*frames[p], row_start, tr[p].step_x, width, interp, scratch.data());
+                color_map->MapRow(scratch.data(), width, reinterpret_cast<uint32_t*>(out_row));
+            } else {
+                SampleRow<T>(*frames[p], row_start, tr[p].step_x, width, interp, reinterpret_cast<T*>(out_row));
+            }
+        }
+    });
+}
+
+/** Format-independent overload for row-major frames, where the sample type is picked once from the format of the frames. */
+static inline void SamplePlaneRows (const std::vector<const Image3dView*> & frames, const std::vector<VoxelTransform> & tr, InterpolationMode interp, ThreadPool & pool, const Image3dView & out, const ColorMap * color_map = nullptr) {
+    assert(!frames.empty());
+    switch (frames.front()->format) {
+    case FORMAT_U8:  SamplePlaneRows<uint8_t>(frames, tr, interp, pool, out, color_map); break;
+    case FORMAT_U16: SamplePlaneRows<uint16_t>(frames, tr, interp, pool, out, color_map); break;
+    case FORMAT_F32: SamplePlaneRows<float>(frames, tr, interp, pool, out, color_map); break;
+    default: abort(); // should never be reached
+    }
+}
+
+/** Resample several planes of a frame into consecutive planes of "out", so that out.dims[2] must match the plane count.
+    Each plane is spanned by origin, dir1 & dir2 of "planes[i]" (dir3 is ignored). The source geometry is inverted once,
+    and rows from all planes are processed in parallel by "pool". */
+template <class T, class Frame>
+static void SampleSlices (const Frame & frame, Cart3dGeom frame_geom, const Cart3dGeom * planes, InterpolationMode interp, ThreadPool & pool, const Image3dView & out) {
+    assert(ImageFormatSize(out.format) == sizeof(T));
+
+    const SourceVoxelMap src = MakeSourceVoxelMap(frame_geom, frame.dims);
+    const unsigned short plane_res[3] = { out.dims[0], out.dims[1], 1 };
+    std::vector<VoxelTransform> tr(out.dims[2]);
+    for (size_t i = 0; i < tr.size(); ++i) {
+        vec3f origin, dir1, dir2, dir3;
+        std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(planes[i]);
+        tr[i] = ComposeVoxelTransform(src, origin, dir1, dir2, vec3f(0, 0, 0), plane_res);
+    }
+
+    SamplePlaneRows<T>(std::vector<const Frame*>(out.dims[2], &frame), tr, interp, pool, out);
+}
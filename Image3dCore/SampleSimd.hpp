@@ -0,0 +1,994 @@
+/* Portable core of the "3D API" reference loader.
+SIMD kernels for nearest-neighbour and trilinear resampling of 8bit row-major & bricked volumes and single planes, for 2x volume reduction,
+and for mapping 8bit samples through color tables.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+  #define SAMPLE_SIMD_X86
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define TARGET_SSE41
+    #define TARGET_AVX2
+  #else
+    #include <cpuid.h>
+    #define TARGET_SSE41 __attribute__((target("sse4.1")))
+    #define TARGET_AVX2  __attribute__((target("avx2")))
+  #endif
+#endif
+
+
+/** Raw description of an 8bit source volume, as consumed by the row kernels. */
+struct VoxelGridU8 {
+    const uint8_t *  data;       ///< first voxel
+    unsigned int     dims[3];    ///< resolution
+    unsigned int     stride0;    ///< distance between each row [bytes]
+    unsigned int     stride1;    ///< distance between each plane [bytes]
+    const uint32_t * offsets[3]; ///< per-axis address tables for the bricked kernels, so that voxel (x,y,z) is at offsets[0][x]+offsets[1][y]+offsets[2][z] (strides are then unused)
+};
+
+/** Resample "count" voxels along a row, starting at "pos" and incrementing by "inc".
+    Coordinates are 32.32 fixed-point voxel coordinates. Voxels outside the source are set to "outside". */
+typedef void (*SampleRowU8Fn)(const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out);
+
+/** Raw description of an 8bit plane with arbitrary strides, such as the source plane containing an in-plane slice. */
+struct PlaneGridU8 {
+    const uint8_t * data;      ///< first voxel
+    unsigned int    dims[2];   ///< resolution
+    unsigned int    stride[2]; ///< distance between neighbouring voxels along each axis [bytes]
+};
+
+/** Resample "count" voxels along a row within a plane, with the same conventions as SampleRowU8Fn.
+    The row must be entirely inside the plane (see ClipRow), so no bounds checking is performed. */
+typedef void (*SamplePlaneRowU8Fn)(const PlaneGridU8 & src, const int64_t pos[2], const int64_t inc[2], unsigned int count, uint8_t * out);
+
+
+/** Portable scalar reference kernel. */
+static inline void SampleRowU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    int64_t px = pos[0], py = pos[1], pz = pos[2];
+    for (unsigned int i = 0; i < count; ++i) {
+        // integer part (negative values wrap around to large unsigned values)
+        auto x = static_cast<uint64_t>(px) >> 32;
+        auto y = static_cast<uint64_t>(py) >> 32;
+        auto z = static_cast<uint64_t>(pz) >> 32;
+
+        if ((x < src.dims[0]) && (y < src.dims[1]) && (z < src.dims[2]))
+            out[i] = src.data[x + y*src.stride0 + z*src.stride1];
+        else
+            out[i] = outside;
+
+        px += inc[0];
+        py += inc[1];
+        pz += inc[2];
+    }
+}
+
+
+/** Linear interpolation with 8bit fixed-point weight "w" in [0,256). Result is scaled by 256. */
+static inline uint32_t LerpFixed (uint32_t a, uint32_t b, uint32_t w) {
+    return a*(256 - w) + b*w;
+}
+
+/** Portable scalar trilinear kernel. Interpolates between voxel centers with 8bit fixed-point weights, and clamps to the
+    edge voxels within the outer half voxel. Voxels outside the source are set to "outside", matching the nearest-neighbour footprint. */
+static inline void SampleRowLinearU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    const int64_t HALF = int64_t(1) << 31; // half voxel offset to voxel centers
+    int64_t p[3] = { pos[0], pos[1], pos[2] };
+    for (unsigned int i = 0; i < count; ++i) {
+        bool inside = true;
+        unsigned int c0[3], c1[3], w[3];
+        for (int a = 0; a < 3; ++a) {
+            inside &= (static_cast<uint64_t>(p[a]) >> 32) < src.dims[a];
+
+            // lower neighbour index & weight of upper neighbour
+            const int64_t u  = p[a] - HALF;
+            const auto    i0 = static_cast<int32_t>(u >> 32);
+            const int     hi = static_cast<int>(src.dims[a]) - 1;
+            c0[a] = static_cast<unsigned int>(std::min(std::max(i0, 0), hi));
+            c1[a] = static_cast<unsigned int>(std::min(std::max(i0 + 1, 0), hi));
+            w[a]  = static_cast<uint32_t>(u) >> 24;
+        }
+
+        if (inside) {
+            const uint8_t * row00 = src.data + c0[1]*src.stride0 + c0[2]*src.stride1;
+            const uint8_t * row10 = src.data + c1[1]*src.stride0 + c0[2]*src.stride1;
+            const uint8_t * row01 = src.data + c0[1]*src.stride0 + c1[2]*src.stride1;
+            const uint8_t * row11 = src.data + c1[1]*src.stride0 + c1[2]*src.stride1;
+
+            uint32_t v0 = LerpFixed(LerpFixed(row00[c0[0]], row00[c1[0]], w[0]), LerpFixed(row10[c0[0]], row10[c1[0]], w[0]), w[1]);
+            uint32_t v1 = LerpFixed(LerpFixed(row01[c0[0]], row01[c1[0]], w[0]), LerpFixed(row11[c0[0]], row11[c1[0]], w[0]), w[1]);
+            out[i] = static_cast<uint8_t>((LerpFixed(v0, v1, w[2]) + (1u << 23)) >> 24);
+        } else {
+            out[i] = outside;
+        }
+
+        for (int a = 0; a < 3; ++a)
+            p[a] += inc[a];
+    }
+}
+
+
+/** Clip a row against the source bounds, so that voxels [begin, end) are exactly those that pass the per-voxel bounds test
+    of the kernels (and voxels outside this range all fail it, since a row crosses each bound at most once).
+    Evaluated in exact integer arithmetic, which requires coordinates & increments to be within +/-2^62. */
+static inline void ClipRow (const unsigned int dims[3], const int64_t pos[3], const int64_t inc[3], unsigned int count, unsigned int & begin, unsigned int & end) {
+    auto ceil_div = [](int64_t num, int64_t den) { return (num + den - 1)/den; }; // num >= 0, den > 0
+
+    int64_t lo = 0, hi = count;
+    for (int a = 0; (a < 3) && (lo < hi); ++a) {
+        const int64_t limit = static_cast<int64_t>(dims[a]) << 32; // inside if 0 <= p < limit
+        const int64_t p = pos[a];
+        const int64_t d = inc[a];
+        if (d == 0) {
+            if ((p < 0) || (p >= limit))
+                hi = 0;
+        } else if (d > 0) {
+            if (p < 0)
+                lo = std::max(lo, ceil_div(-p, d));                        // first i with p + i*d >= 0
+            hi = std::min(hi, (p < limit) ? ceil_div(limit - p, d) : 0);   // first i with p + i*d >= limit
+        } else {
+            if (p >= limit)
+                lo = std::max(lo, (p - limit)/(-d) + 1);                   // first i with p + i*d < limit
+            hi = std::min(hi, (p >= 0) ? p/(-d) + 1 : 0);                  // first i with p + i*d < 0
+        }
+    }
+
+    if (lo < hi) {
+        begin = static_cast<unsigned int>(lo);
+        end   = static_cast<unsigned int>(hi);
+    } else {
+        begin = end = 0;
+    }
+}
+
+/** Branch-free nearest-neighbour kernel for rows that are entirely inside the source (see ClipRow). */
+static inline void SampleRowInteriorU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t /*outside*/, uint8_t * out) {
+    int64_t px = pos[0], py = pos[1], pz = pos[2];
+    for (unsigned int i = 0; i < count; ++i) {
+        auto x = static_cast<uint64_t>(px) >> 32;
+        auto y = static_cast<uint64_t>(py) >> 32;
+        auto z = static_cast<uint64_t>(pz) >> 32;
+        out[i] = src.data[x + y*src.stride0 + z*src.stride1];
+
+        px += inc[0];
+        py += inc[1];
+        pz += inc[2];
+    }
+}
+
+/** Branch-free trilinear kernel for rows that are entirely inside the source (see ClipRow). Byte-identical to SampleRowLinearU8_Scalar. */
+static inline void SampleRowLinearInteriorU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t /*outside*/, uint8_t * out) {
+    const int64_t HALF = int64_t(1) << 31; // half voxel offset to voxel centers
+    int64_t p[3] = { pos[0], pos[1], pos[2] };
+    for (unsigned int i = 0; i < count; ++i) {
+        unsigned int c0[3], c1[3], w[3];
+        for (int a = 0; a < 3; ++a) {
+            // only the lower neighbour can be outside (by half a voxel), and only the upper one past the last voxel
+            const int64_t u  = p[a] - HALF;
+            const auto    i0 = static_cast<int32_t>(u >> 32);
+            const int     hi = static_cast<int>(src.dims[a]) - 1;
+            c0[a] = static_cast<unsigned int>(std::max(i0, 0));
+            c1[a] = static_cast<unsigned int>(std::min(i0 + 1, hi));
+            w[a]  = static_cast<uint32_t>(u) >> 24;
+        }
+
+        const uint8_t * row00 = src.data + c0[1]*src.stride0 + c0[2]*src.stride1;
+        const uint8_t * row10 = src.data + c1[1]*src.stride0 + c0[2]*src.stride1;
+        const uint8_t * row01 = src.data + c0[1]*src.stride0 + c1[2]*src.stride1;
+        const uint8_t * row11 = src.data + c1[1]*src.stride0 + c1[2]*src.stride1;
+
+        uint32_t v0 = LerpFixed(LerpFixed(row00[c0[0]], row00[c1[0]], w[0]), LerpFixed(row10[c0[0]], row10[c1[0]], w[0]), w[1]);
+        uint32_t v1 = LerpFixed(LerpFixed(row01[c0[0]], row01[c1[0]], w[0]), LerpFixed(row11[c0[0]], row11[c1[0]], w[0]), w[1]);
+        out[i] = static_cast<uint8_t>((LerpFixed(v0, v1, w[2]) + (1u << 23)) >> 24);
+
+        for (int a = 0; a < 3; ++a)
+            p[a] += inc[a];
+    }
+}
+
+
+/** Portable scalar nearest-neighbour plane kernel. */
+static inline void SamplePlaneRowU8_Scalar (const PlaneGridU8 & src, const int64_t pos[2], const int64_t inc[2], unsigned int count, uint8_t * out) {
+    int64_t pu = pos[0], pv = pos[1];
+    for (unsigned int i = 0; i < count; ++i) {
+        auto u = static_cast<uint64_t>(pu) >> 32;
+        auto v = static_cast<uint64_t>(pv) >> 32;
+        out[i] = src.data[u*src.stride[0] + v*src.stride[1]];
+
+        pu += inc[0];
+        pv += inc[1];
+    }
+}
+
+/** Portable scalar bilinear plane kernel. Byte-identical to SampleRowLinearU8_Scalar for slices where the third
+    coordinate has zero weight or is clamped to an edge plane, since the 8bit fixed-point interpolation is exact until the final rounding. */
+static inline void SamplePlaneRowLinearU8_Scalar (const PlaneGridU8 & src, const int64_t pos[2], const int64_t inc[2], unsigned int count, uint8_t * out) {
+    const int64_t HALF = int64_t(1) << 31; // half voxel offset to voxel centers
+    int64_t p[2] = { pos[0], pos[1] };
+    for (unsigned int i = 0; i < count; ++i) {
+        size_t o0[2], o1[2];
+        uint32_t w[2];
+        for (int a = 0; a < 2; ++a) {
+            const int64_t u  = p[a] - HALF;
+            const auto    i0 = static_cast<int32_t>(u >> 32);
+            const int     hi = static_cast<int>(src.dims[a]) - 1;
+            o0[a] = static_cast<size_t>(std::max(i0, 0))*src.stride[a];
+            o1[a] = static_cast<size_t>(std::min(i0 + 1, hi))*src.stride[a];
+            w[a]  = static_cast<uint32_t>(u) >> 24;
+        }
+
+        const uint8_t * row0 = src.data + o0[1];
+        const uint8_t * row1 = src.data + o1[1];
+        uint32_t val = LerpFixed(LerpFixed(row0[o0[0]], row0[o1[0]], w[0]), LerpFixed(row1[o0[0]], row1[o1[0]], w[0]), w[1]);
+        out[i] = static_cast<uint8_t>((val + (1u << 15)) >> 16);
+
+        for (int a = 0; a < 2; ++a)
+            p[a] += inc[a];
+    }
+}
+
+
+/** Scalar nearest-neighbour kernel for volumes addressed through per-axis tables, such as BrickedVolume. */
+static inline void SampleRowBrickedU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    int64_t px = pos[0], py = pos[1], pz = pos[2];
+    for (unsigned int i = 0; i < count; ++i) {
+        auto x = static_cast<uint64_t>(px) >> 32;
+        auto y = static_cast<uint64_t>(py) >> 32;
+        auto z = static_cast<uint64_t>(pz) >> 32;
+
+        if ((x < src.dims[0]) && (y < src.dims[1]) && (z < src.dims[2]))
+            out[i] = src.data[src.offsets[0][x] + src.offsets[1][y] + src.offsets[2][z]];
+        else
+            out[i] = outside;
+
+        px += inc[0];
+        py += inc[1];
+        pz += inc[2];
+    }
+}
+
+/** Scalar trilinear kernel for volumes addressed through per-axis tables. Byte-identical to SampleRowLinearU8_Scalar on the same voxels. */
+static inline void SampleRowLinearBrickedU8_Scalar (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    const int64_t HALF = int64_t(1) << 31; // half voxel offset to voxel centers
+    int64_t p[3] = { pos[0], pos[1], pos[2] };
+    for (unsigned int i = 0; i < count; ++i) {
+        bool inside = true;
+        unsigned int c0[3], c1[3], w[3];
+        for (int a = 0; a < 3; ++a) {
+            inside &= (static_cast<uint64_t>(p[a]) >> 32) < src.dims[a];
+
+            const int64_t u  = p[a] - HALF;
+            const auto    i0 = static_cast<int32_t>(u >> 32);
+            const int     hi = static_cast<int>(src.dims[a]) - 1;
+            c0[a] = static_cast<unsigned int>(std::min(std::max(i0, 0), hi));
+            c1[a] = static_cast<unsigned int>(std::min(std::max(i0 + 1, 0), hi));
+            w[a]  = static_cast<uint32_t>(u) >> 24;
+        }
+
+        if (inside) {
+            const uint32_t x0 = src.offsets[0][c0[0]], x1 = src.offsets[0][c1[0]];
+            const uint8_t * row00 = src.data + src.offsets[1][c0[1]] + src.offsets[2][c0[2]];
+            const uint8_t * row10 = src.data + src.offsets[1][c1[1]] + src.offsets[2][c0[2]];
+            const uint8_t * row01 = src.data + src.offsets[1][c0[1]] + src.offsets[2][c1[2]];
+            const uint8_t * row11 = src.data + src.offsets[1][c1[1]] + src.offsets[2][c1[2]];
+
+            uint32_t v0 = LerpFixed(LerpFixed(row00[x0], row00[x1], w[0]), LerpFixed(row10[x0], row10[x1], w[0]), w[1]);
+            uint32_t v1 = LerpFixed(LerpFixed(row01[x0], row01[x1], w[0]), LerpFixed(row11[x0], row11[x1], w[0]), w[1]);
+            out[i] = static_cast<uint8_t>((LerpFixed(v0, v1, w[2]) + (1u << 23)) >> 24);
+        } else {
+            out[i] = outside;
+        }
+
+        for (int a = 0; a < 3; ++a)
+            p[a] += inc[a];
+    }
+}
+
+
+/** Box-filtered 2x2x2 reduction of one output row. "rows" are the source rows at (y0,z0), (y1,z0), (y0,z1) & (y1,z1),
+    where the same row is passed twice to replicate the edge for odd dimensions. The last column is replicated if "src_width" is odd. */
+typedef void (*Reduce2xRowU8Fn)(const uint8_t * const rows[4], unsigned int src_width, unsigned int out_width, uint8_t * out);
+
+/** Reduce output columns [begin, end) with rounding to nearest. */
+static inline void Reduce2xRangeU8 (const uint8_t * const rows[4], unsigned int src_width, unsigned int begin, unsigned int end, uint8_t * out) {
+    for (unsigned int x = begin; x < end; ++x) {
+        const unsigned int x0 = 2*x;
+        const unsigned int x1 = std::min(2*x + 1, src_width - 1);
+        unsigned int sum = 4; // round to nearest
+        for (int r = 0; r < 4; ++r)
+            sum += rows[r][x0] + rows[r][x1];
+        out[x] = static_cast<uint8_t>(sum >> 3);
+    }
+}
+
+/** Portable scalar 2x reduction kernel. */
+static inline void Reduce2xRowU8_Scalar (const uint8_t * const rows[4], unsigned int src_width, unsigned int out_width, uint8_t * out) {
+    Reduce2xRangeU8(rows, src_width, 0, out_width, out);
+}
+
+
+/** Map "count" 8bit samples through a 256-entry table of 32bit values, such as R8G8B8A8 colors. */
+typedef void (*MapRowU8Fn)(const uint8_t * in, unsigned int count, const uint32_t table[256], uint32_t * out);
+
+/** Portable scalar table lookup kernel. */
+static inline void MapRowU8_Scalar (const uint8_t * in, unsigned int count, const uint32_t table[256], uint32_t * out) {
+    for (unsigned int i = 0; i < count; ++i)
+        out[i] = table[in[i]];
+}
+
+/** Check if every byte channel of a table is either the 8bit index itself or constant, as for grayscale color maps.
+    Such tables can be expanded with byte shuffles instead of lookups (see MapRowRampU8_SSE41). */
+static inline bool IsRampTable (const uint32_t table[256]) {
+    for (unsigned int c = 0; c < 4; ++c) {
+        const unsigned int first = (table[0] >> 8*c) & 0xFF;
+        bool ramp = true, constant = true;
+        for (unsigned int i = 0; i < 256; ++i) {
+            const unsigned int val = (table[i] >> 8*c) & 0xFF;
+            ramp = ramp && (val == i);
+            constant = constant && (val == first);
+        }
+        if (!ramp && !constant)
+            return false;
+    }
+    return true;
+}
+
+
+#ifdef SAMPLE_SIMD_X86
+
+/** Process 4 voxels per iteration with SSE4.1. Lacks gather, so voxels are fetched with scalar loads. */
+TARGET_SSE41 static inline void SampleRowU8_SSE41 (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    // 64bit lanes hold even (0,2) and odd (1,3) voxels, so that the integer parts interleave back into order
+    __m128i even[3], odd[3], step4[3];
+    for (int a = 0; a < 3; ++a) {
+        even[a]  = _mm_set_epi64x(pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm_set_epi64x(pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step4[a] = _mm_set1_epi64x(4*inc[a]);
+    }
+
+    const __m128i max_x   = _mm_set1_epi32(static_cast<int>(src.dims[0] - 1));
+    const __m128i max_y   = _mm_set1_epi32(static_cast<int>(src.dims[1] - 1));
+    const __m128i max_z   = _mm_set1_epi32(static_cast<int>(src.dims[2] - 1));
+    const __m128i stride0 = _mm_set1_epi32(static_cast<int>(src.stride0));
+    const __m128i stride1 = _mm_set1_epi32(static_cast<int>(src.stride1));
+    const __m128i out_val = _mm_set1_epi32(outside);
+    const __m128i pack    = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // integer part of each coordinate as 32bit
+        __m128i c[3];
+        for (int a = 0; a < 3; ++a)
+            c[a] = _mm_blend_epi16(_mm_srli_epi64(even[a], 32), odd[a], 0xCC);
+
+        // unsigned bounds test (negative coordinates wrap around)
+        __m128i inside = _mm_and_si128(_mm_cmpeq_epi32(_mm_min_epu32(c[0], max_x), c[0]),
+                         _mm_and_si128(_mm_cmpeq_epi32(_mm_min_epu32(c[1], max_y), c[1]),
+                                       _mm_cmpeq_epi32(_mm_min_epu32(c[2], max_z), c[2])));
+
+        // linear index, with outside voxels redirected to index 0
+        __m128i idx = _mm_add_epi32(c[0], _mm_add_epi32(_mm_mullo_epi32(c[1], stride0), _mm_mullo_epi32(c[2], stride1)));
+        idx = _mm_and_si128(idx, inside);
+
+        __m128i val = _mm_setr_epi32(src.data[_mm_cvtsi128_si32(idx)],     src.data[_mm_extract_epi32(idx, 1)],
+                                     src.data[_mm_extract_epi32(idx, 2)], src.data[_mm_extract_epi32(idx, 3)]);
+        val = _mm_blendv_epi8(out_val, val, inside);
+
+        int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(val, pack));
+        memcpy(out + i, &packed, 4);
+
+        for (int a = 0; a < 3; ++a) {
+            even[a] = _mm_add_epi64(even[a], step4[a]);
+            odd[a]  = _mm_add_epi64(odd[a], step4[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[3] = { pos[0] + i*inc[0], pos[1] + i*inc[1], pos[2] + i*inc[2] };
+    SampleRowU8_Scalar(src, tail, inc, count - i, outside, out + i);
+}
+
+
+/** Gather bytes at "idx" for lanes where "mask" is set (zero elsewhere).
+    Fetches 32bit words from a 4-byte aligned base, so that reads never cross the end of the buffer.
+    "idx" must be relative to "base", i.e. include the misalignment of the first voxel. */
+TARGET_AVX2 static inline __m256i GatherU8_AVX2 (const int * base, __m256i idx, __m256i mask) {
+    __m256i word  = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, _mm256_srli_epi32(idx, 2), mask, 4);
+    __m256i shift = _mm256_slli_epi32(_mm256_and_si256(idx, _mm256_set1_epi32(3)), 3);
+    return _mm256_and_si256(_mm256_srlv_epi32(word, shift), _mm256_set1_epi32(0xFF));
+}
+
+/** Pack the low byte of 8 32bit lanes and store them. */
+TARGET_AVX2 static inline void StoreU8x8_AVX2 (uint8_t * out, __m256i val) {
+    const __m256i pack = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                          0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(val, pack), _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+}
+
+/** Process 8 voxels per iteration with AVX2, using masked gather. */
+TARGET_AVX2 static inline void SampleRowU8_AVX2 (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    // 64bit lanes hold even (0,2,4,6) and odd (1,3,5,7) voxels, so that the integer parts interleave back into order
+    __m256i even[3], odd[3], step8[3];
+    for (int a = 0; a < 3; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i max_x    = _mm256_set1_epi32(static_cast<int>(src.dims[0] - 1));
+    const __m256i max_y    = _mm256_set1_epi32(static_cast<int>(src.dims[1] - 1));
+    const __m256i max_z    = _mm256_set1_epi32(static_cast<int>(src.dims[2] - 1));
+    const __m256i stride0  = _mm256_set1_epi32(static_cast<int>(src.stride0));
+    const __m256i stride1  = _mm256_set1_epi32(static_cast<int>(src.stride1));
+    const __m256i offset   = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i out_val  = _mm256_set1_epi32(outside);
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // integer part of each coordinate as 32bit
+        __m256i c[3];
+        for (int a = 0; a < 3; ++a)
+            c[a] = _mm256_blend_epi32(_mm256_srli_epi64(even[a], 32), odd[a], 0xAA);
+
+        // unsigned bounds test (negative coordinates wrap around)
+        __m256i inside = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_min_epu32(c[0], max_x), c[0]),
+                         _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_min_epu32(c[1], max_y), c[1]),
+                                          _mm256_cmpeq_epi32(_mm256_min_epu32(c[2], max_z), c[2])));
+
+        __m256i idx = _mm256_add_epi32(c[0], _mm256_add_epi32(_mm256_mullo_epi32(c[1], stride0), _mm256_mullo_epi32(c[2], stride1)));
+        idx = _mm256_add_epi32(idx, offset);
+
+        // gather inside voxels only
+        __m256i val = _mm256_blendv_epi8(out_val, GatherU8_AVX2(base, idx, inside), inside);
+        StoreU8x8_AVX2(out + i, val);
+
+        for (int a = 0; a < 3; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[3] = { pos[0] + i*inc[0], pos[1] + i*inc[1], pos[2] + i*inc[2] };
+    SampleRowU8_Scalar(src, tail, inc, count - i, outside, out + i);
+}
+
+
+/** Same as LerpFixed. Evaluated as (a<<8) + (b-a)*w with wrap-around 32bit arithmetic. */
+TARGET_AVX2 static inline __m256i LerpFixed_AVX2 (__m256i a, __m256i b, __m256i w) {
+    return _mm256_add_epi32(_mm256_slli_epi32(a, 8), _mm256_mullo_epi32(_mm256_sub_epi32(b, a), w));
+}
+
+/** Trilinear interpolation of 8 voxels per iteration with AVX2, using masked gather.
+    Byte-identical to SampleRowLinearU8_Scalar. */
+TARGET_AVX2 static inline void SampleRowLinearU8_AVX2 (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    // 64bit lanes hold even (0,2,4,6) and odd (1,3,5,7) voxels, so that the 32bit halves interleave back into order
+    __m256i even[3], odd[3], step8[3];
+    for (int a = 0; a < 3; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i half    = _mm256_set1_epi64x(int64_t(1) << 31); // half voxel offset to voxel centers
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i one     = _mm256_set1_epi32(1);
+    const __m256i round   = _mm256_set1_epi32(1 << 23);
+    const __m256i offset  = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i out_val = _mm256_set1_epi32(outside);
+    const __m256i stride0 = _mm256_set1_epi32(static_cast<int>(src.stride0));
+    const __m256i stride1 = _mm256_set1_epi32(static_cast<int>(src.stride1));
+    const __m256i dmax[3] = { _mm256_set1_epi32(static_cast<int>(src.dims[0] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[1] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[2] - 1)) };
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i inside = _mm256_set1_epi32(-1);
+        __m256i c0[3], c1[3], w[3];
+        for (int a = 0; a < 3; ++a) {
+            // bounds test on the unshifted coordinate (negative coordinates wrap around)
+            __m256i c = _mm256_blend_epi32(_mm256_srli_epi64(even[a], 32), odd[a], 0xAA);
+            inside = _mm256_and_si256(inside, _mm256_cmpeq_epi32(_mm256_min_epu32(c, dmax[a]), c));
+
+            // lower neighbour index & weight of upper neighbour
+            __m256i ue = _mm256_sub_epi64(even[a], half);
+            __m256i uo = _mm256_sub_epi64(odd[a], half);
+            __m256i i0 = _mm256_blend_epi32(_mm256_srli_epi64(ue, 32), uo, 0xAA);
+            __m256i fr = _mm256_blend_epi32(ue, _mm256_slli_epi64(uo, 32), 0xAA);
+            c0[a] = _mm256_min_epi32(_mm256_max_epi32(i0, zero), dmax[a]);
+            c1[a] = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(i0, one), zero), dmax[a]);
+            w[a]  = _mm256_srli_epi32(fr, 24);
+        }
+
+        // index of lower corner and offsets to upper neighbours
+        __m256i idx = _mm256_add_epi32(_mm256_add_epi32(c0[0], offset), _mm256_add_epi32(_mm256_mullo_epi32(c0[1], stride0), _mm256_mullo_epi32(c0[2], stride1)));
+        __m256i dx  = _mm256_sub_epi32(c1[0], c0[0]);
+        __m256i dy  = _mm256_mullo_epi32(_mm256_sub_epi32(c1[1], c0[1]), stride0);
+        __m256i dz  = _mm256_mullo_epi32(_mm256_sub_epi32(c1[2], c0[2]), stride1);
+
+        __m256i v0, v1;
+        {
+            __m256i row00 = idx;
+            __m256i row10 = _mm256_add_epi32(idx, dy);
+            __m256i a = LerpFixed_AVX2(GatherU8_AVX2(base, row00, inside), GatherU8_AVX2(base, _mm256_add_epi32(row00, dx), inside), w[0]);
+            __m256i b = LerpFixed_AVX2(GatherU8_AVX2(base, row10, inside), GatherU8_AVX2(base, _mm256_add_epi32(row10, dx), inside), w[0]);
+            v0 = LerpFixed_AVX2(a, b, w[1]);
+        }
+        {
+            __m256i row01 = _mm256_add_epi32(idx, dz);
+            __m256i row11 = _mm256_add_epi32(row01, dy);
+            __m256i a = LerpFixed_AVX2(GatherU8_AVX2(base, row01, inside), GatherU8_AVX2(base, _mm256_add_epi32(row01, dx), inside), w[0]);
+            __m256i b = LerpFixed_AVX2(GatherU8_AVX2(base, row11, inside), GatherU8_AVX2(base, _mm256_add_epi32(row11, dx), inside), w[0]);
+            v1 = LerpFixed_AVX2(a, b, w[1]);
+        }
+        __m256i val = _mm256_srli_epi32(_mm256_add_epi32(LerpFixed_AVX2(v0, v1, w[2]), round), 24);
+        val = _mm256_blendv_epi8(out_val, val, inside);
+        StoreU8x8_AVX2(out + i, val);
+
+        for (int a = 0; a < 3; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[3] = { pos[0] + i*inc[0], pos[1] + i*inc[1], pos[2] + i*inc[2] };
+    SampleRowLinearU8_Scalar(src, tail, inc, count - i, outside, out + i);
+}
+
+
+/** Nearest-neighbour lookup of 8 voxels per iteration with AVX2 for table-addressed volumes. The per-axis tables are gathered first,
+    followed by the voxels themselves. */
+TARGET_AVX2 static inline void SampleRowBrickedU8_AVX2 (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    __m256i even[3], odd[3], step8[3];
+    for (int a = 0; a < 3; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i offset  = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i out_val = _mm256_set1_epi32(outside);
+    const __m256i dmax[3] = { _mm256_set1_epi32(static_cast<int>(src.dims[0] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[1] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[2] - 1)) };
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i c[3];
+        __m256i inside = _mm256_set1_epi32(-1);
+        for (int a = 0; a < 3; ++a) {
+            c[a]   = _mm256_blend_epi32(_mm256_srli_epi64(even[a], 32), odd[a], 0xAA);
+            inside = _mm256_and_si256(inside, _mm256_cmpeq_epi32(_mm256_min_epu32(c[a], dmax[a]), c[a]));
+        }
+
+        // table lookup for inside voxels only, since out-of-bounds coordinates would read past the tables
+        __m256i idx = offset;
+        for (int a = 0; a < 3; ++a)
+            idx = _mm256_add_epi32(idx, _mm256_mask_i32gather_epi32(zero, reinterpret_cast<const int*>(src.offsets[a]), c[a], inside, 4));
+
+        __m256i val = _mm256_blendv_epi8(out_val, GatherU8_AVX2(base, idx, inside), inside);
+        StoreU8x8_AVX2(out + i, val);
+
+        for (int a = 0; a < 3; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[3] = { pos[0] + i*inc[0], pos[1] + i*inc[1], pos[2] + i*inc[2] };
+    SampleRowBrickedU8_Scalar(src, tail, inc, count - i, outside, out + i);
+}
+
+/** Trilinear interpolation of 8 voxels per iteration with AVX2 for table-addressed volumes.
+    Byte-identical to SampleRowLinearBrickedU8_Scalar. */
+TARGET_AVX2 static inline void SampleRowLinearBrickedU8_AVX2 (const VoxelGridU8 & src, const int64_t pos[3], const int64_t inc[3], unsigned int count, uint8_t outside, uint8_t * out) {
+    __m256i even[3], odd[3], step8[3];
+    for (int a = 0; a < 3; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i half    = _mm256_set1_epi64x(int64_t(1) << 31); // half voxel offset to voxel centers
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i one     = _mm256_set1_epi32(1);
+    const __m256i round   = _mm256_set1_epi32(1 << 23);
+    const __m256i offset  = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i out_val = _mm256_set1_epi32(outside);
+    const __m256i dmax[3] = { _mm256_set1_epi32(static_cast<int>(src.dims[0] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[1] - 1)),
+                              _mm256_set1_epi32(static_cast<int>(src.dims[2] - 1)) };
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i inside = _mm256_set1_epi32(-1);
+        __m256i t0[3], t1[3], w[3];
+        for (int a = 0; a < 3; ++a) {
+            __m256i c = _mm256_blend_epi32(_mm256_srli_epi64(even[a], 32), odd[a], 0xAA);
+            inside = _mm256_and_si256(inside, _mm256_cmpeq_epi32(_mm256_min_epu32(c, dmax[a]), c));
+
+            __m256i ue = _mm256_sub_epi64(even[a], half);
+            __m256i uo = _mm256_sub_epi64(odd[a], half);
+            __m256i i0 = _mm256_blend_epi32(_mm256_srli_epi64(ue, 32), uo, 0xAA);
+            __m256i fr = _mm256_blend_epi32(ue, _mm256_slli_epi64(uo, 32), 0xAA);
+            w[a] = _mm256_srli_epi32(fr, 24);
+
+            // clamped neighbour indices are always within the tables
+            const int * table = reinterpret_cast<const int*>(src.offsets[a]);
+            t0[a] = _mm256_i32gather_epi32(table, _mm256_min_epi32(_mm256_max_epi32(i0, zero), dmax[a]), 4);
+            t1[a] = _mm256_i32gather_epi32(table, _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(i0, one), zero), dmax[a]), 4);
+        }
+
+        // address of lower corner and offsets to upper neighbours
+        __m256i idx = _mm256_add_epi32(_mm256_add_epi32(t0[0], offset), _mm256_add_epi32(t0[1], t0[2]));
+        __m256i dx  = _mm256_sub_epi32(t1[0], t0[0]);
+        __m256i dy  = _mm256_sub_epi32(t1[1], t0[1]);
+        __m256i dz  = _mm256_sub_epi32(t1[2], t0[2]);
+
+        __m256i v0, v1;
+        {
+            __m256i row00 = idx;
+            __m256i row10 = _mm256_add_epi32(idx, dy);
+            __m256i a = LerpFixed_AVX2(GatherU8_AVX2(base, row00, inside), GatherU8_AVX2(base, _mm256_add_epi32(row00, dx), inside), w[0]);
+            __m256i b = LerpFixed_AVX2(GatherU8_AVX2(base, row10, inside), GatherU8_AVX2(base, _mm256_add_epi32(row10, dx), inside), w[0]);
+            v0 = LerpFixed_AVX2(a, b, w[1]);
+        }
+        {
+            __m256i row01 = _mm256_add_epi32(idx, dz);
+            __m256i row11 = _mm256_add_epi32(row01, dy);
+            __m256i a = LerpFixed_AVX2(GatherU8_AVX2(base, row01, inside), GatherU8_AVX2(base, _mm256_add_epi32(row01, dx), inside), w[0]);
+            __m256i b = LerpFixed_AVX2(GatherU8_AVX2(base, row11, inside), GatherU8_AVX2(base, _mm256_add_epi32(row11, dx), inside), w[0]);
+            v1 = LerpFixed_AVX2(a, b, w[1]);
+        }
+        __m256i val = _mm256_srli_epi32(_mm256_add_epi32(LerpFixed_AVX2(v0, v1, w[2]), round), 24);
+        val = _mm256_blendv_epi8(out_val, val, inside);
+        StoreU8x8_AVX2(out + i, val);
+
+        for (int a = 0; a < 3; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[3] = { pos[0] + i*inc[0], pos[1] + i*inc[1], pos[2] + i*inc[2] };
+    SampleRowLinearBrickedU8_Scalar(src, tail, inc, count - i, outside, out + i);
+}
+
+
+/** Nearest-neighbour plane kernel, processing 8 voxels per iteration with AVX2. */
+TARGET_AVX2 static inline void SamplePlaneRowU8_AVX2 (const PlaneGridU8 & src, const int64_t pos[2], const int64_t inc[2], unsigned int count, uint8_t * out) {
+    __m256i even[2], odd[2], step8[2];
+    for (int a = 0; a < 2; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i all     = _mm256_set1_epi32(-1);
+    const __m256i offset  = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i stride0 = _mm256_set1_epi32(static_cast<int>(src.stride[0]));
+    const __m256i stride1 = _mm256_set1_epi32(static_cast<int>(src.stride[1]));
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i u = _mm256_blend_epi32(_mm256_srli_epi64(even[0], 32), odd[0], 0xAA);
+        __m256i v = _mm256_blend_epi32(_mm256_srli_epi64(even[1], 32), odd[1], 0xAA);
+        __m256i idx = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(u, stride0), _mm256_mullo_epi32(v, stride1)), offset);
+        StoreU8x8_AVX2(out + i, GatherU8_AVX2(base, idx, all));
+
+        for (int a = 0; a < 2; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[2] = { pos[0] + i*inc[0], pos[1] + i*inc[1] };
+    SamplePlaneRowU8_Scalar(src, tail, inc, count - i, out + i);
+}
+
+/** Bilinear plane kernel, processing 8 voxels per iteration with AVX2. Byte-identical to SamplePlaneRowLinearU8_Scalar. */
+TARGET_AVX2 static inline void SamplePlaneRowLinearU8_AVX2 (const PlaneGridU8 & src, const int64_t pos[2], const int64_t inc[2], unsigned int count, uint8_t * out) {
+    __m256i even[2], odd[2], step8[2];
+    for (int a = 0; a < 2; ++a) {
+        even[a]  = _mm256_set_epi64x(pos[a] + 6*inc[a], pos[a] + 4*inc[a], pos[a] + 2*inc[a], pos[a]);
+        odd[a]   = _mm256_set_epi64x(pos[a] + 7*inc[a], pos[a] + 5*inc[a], pos[a] + 3*inc[a], pos[a] + inc[a]);
+        step8[a] = _mm256_set1_epi64x(8*inc[a]);
+    }
+
+    const uintptr_t misalign = reinterpret_cast<uintptr_t>(src.data) & 3;
+    const int *     base     = reinterpret_cast<const int*>(src.data - misalign);
+
+    const __m256i all       = _mm256_set1_epi32(-1);
+    const __m256i half      = _mm256_set1_epi64x(int64_t(1) << 31); // half voxel offset to voxel centers
+    const __m256i zero      = _mm256_setzero_si256();
+    const __m256i one       = _mm256_set1_epi32(1);
+    const __m256i round     = _mm256_set1_epi32(1 << 15);
+    const __m256i offset    = _mm256_set1_epi32(static_cast<int>(misalign));
+    const __m256i stride[2] = { _mm256_set1_epi32(static_cast<int>(src.stride[0])), _mm256_set1_epi32(static_cast<int>(src.stride[1])) };
+    const __m256i dmax[2]   = { _mm256_set1_epi32(static_cast<int>(src.dims[0] - 1)), _mm256_set1_epi32(static_cast<int>(src.dims[1] - 1)) };
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i o0[2], o1[2], w[2];
+        for (int a = 0; a < 2; ++a) {
+            __m256i ue = _mm256_sub_epi64(even[a], half);
+            __m256i uo = _mm256_sub_epi64(odd[a], half);
+            __m256i i0 = _mm256_blend_epi32(_mm256_srli_epi64(ue, 32), uo, 0xAA);
+            __m256i fr = _mm256_blend_epi32(ue, _mm256_slli_epi64(uo, 32), 0xAA);
+            o0[a] = _mm256_mullo_epi32(_mm256_max_epi32(i0, zero), stride[a]);
+            o1[a] = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_add_epi32(i0, one), dmax[a]), stride[a]);
+            w[a]  = _mm256_srli_epi32(fr, 24);
+        }
+
+        __m256i row0 = _mm256_add_epi32(o0[1], offset);
+        __m256i row1 = _mm256_add_epi32(o1[1], offset);
+        __m256i a = LerpFixed_AVX2(GatherU8_AVX2(base, _mm256_add_epi32(row0, o0[0]), all), GatherU8_AVX2(base, _mm256_add_epi32(row0, o1[0]), all), w[0]);
+        __m256i b = LerpFixed_AVX2(GatherU8_AVX2(base, _mm256_add_epi32(row1, o0[0]), all), GatherU8_AVX2(base, _mm256_add_epi32(row1, o1[0]), all), w[0]);
+        StoreU8x8_AVX2(out + i, _mm256_srli_epi32(_mm256_add_epi32(LerpFixed_AVX2(a, b, w[1]), round), 16));
+
+        for (int a = 0; a < 2; ++a) {
+            even[a] = _mm256_add_epi64(even[a], step8[a]);
+            odd[a]  = _mm256_add_epi64(odd[a], step8[a]);
+        }
+    }
+
+    // remaining voxels
+    const int64_t tail[2] = { pos[0] + i*inc[0], pos[1] + i*inc[1] };
+    SamplePlaneRowLinearU8_Scalar(src, tail, inc, count - i, out + i);
+}
+
+
+/** 2x reduction of 8 voxels per iteration with SSE4.1 (SSSE3 pairwise add). */
+TARGET_SSE41 static inline void Reduce2xRowU8_SSE41 (const uint8_t * const rows[4], unsigned int src_width, unsigned int out_width, uint8_t * out) {
+    const __m128i ones  = _mm_set1_epi8(1);
+    const __m128i round = _mm_set1_epi16(4);
+
+    unsigned int x = 0;
+    for (; (x + 8 <= out_width) && (2*x + 16 <= src_width); x += 8) {
+        // sum horizontal pairs as 16bit, then accumulate the 4 rows (max 8*255, so no overflow)
+        __m128i sum = round;
+        for (int r = 0; r < 4; ++r)
+            sum = _mm_add_epi16(sum, _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + 2*x)), ones));
+        sum = _mm_srli_epi16(sum, 3);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, sum));
+    }
+
+    // remaining voxels, including replicated last column
+    Reduce2xRangeU8(rows, src_width, x, out_width, out);
+}
+
+/** 2x reduction of 16 voxels per iteration with AVX2. */
+TARGET_AVX2 static inline void Reduce2xRowU8_AVX2 (const uint8_t * const rows[4], unsigned int src_width, unsigned int out_width, uint8_t * out) {
+    const __m256i ones  = _mm256_set1_epi8(1);
+    const __m256i round = _mm256_set1_epi16(4);
+
+    unsigned int x = 0;
+    for (; (x + 16 <= out_width) && (2*x + 32 <= src_width); x += 16) {
+        __m256i sum = round;
+        for (int r = 0; r < 4; ++r)
+            sum = _mm256_add_epi16(sum, _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[r] + 2*x)), ones));
+        sum = _mm256_srli_epi16(sum, 3);
+        // pack across the two 128bit lanes
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+    }
+
+    // remaining voxels, including replicated last column
+    Reduce2xRangeU8(rows, src_width, x, out_width, out);
+}
+
+
+/** Expand 16 samples per iteration with SSE4.1 (SSSE3 byte shuffle), for tables where every channel is either the sample itself or constant (see IsRampTable). */
+TARGET_SSE41 static inline void MapRowRampU8_SSE41 (const uint8_t * in, unsigned int count, const uint32_t table[256], uint32_t * out) {
+    // ramp channels differ between the first & last entry, and replicate the sample, while the other channels are OR'ed in as constants
+    const uint32_t ramp = table[0] ^ table[255];
+    const __m128i constant = _mm_set1_epi32(static_cast<int>(table[0] & ~ramp));
+    __m128i shuffle[4]; // output voxels [4*k, 4*k+4) of each iteration
+    for (int k = 0; k < 4; ++k) {
+        int8_t ctrl[16];
+        for (int j = 0; j < 16; ++j)
+            ctrl[j] = ((ramp >> 8*(j % 4)) & 0xFF) ? static_cast<int8_t>(4*k + j/4) : int8_t(-128); // sign bit zeroes the byte
+        shuffle[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+    }
+
+    unsigned int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        for (int k = 0; k < 4; ++k)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4*k), _mm_or_si128(_mm_shuffle_epi8(samples, shuffle[k]), constant));
+    }
+
+    MapRowU8_Scalar(in + i, count - i, table, out + i);
+}
+
+/** Table lookup of 16 samples per iteration with AVX2 gather. */
+TARGET_AVX2 static inline void MapRowU8_AVX2 (const uint8_t * in, unsigned int count, const uint32_t table[256], uint32_t * out) {
+    const int * base = reinterpret_cast<const int*>(table);
+
+    unsigned int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        const __m256i lo = _mm256_i32gather_epi32(base, _mm256_cvtepu8_epi32(samples), 4);
+        const __m256i hi = _mm256_i32gather_epi32(base, _mm256_cvtepu8_epi32(_mm_srli_si128(samples, 8)), 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8), hi);
+    }
+
+    MapRowU8_Scalar(in + i, count - i, table, out + i);
+}
+
+
+/** Query CPU support for AVX2 (including OS support for saving YMM registers). */
+static inline bool CpuSupportsAVX2 () {
+    unsigned int regs1[4] = {}, regs7[4] = {};
+#ifdef _MSC_VER
+    int tmp[4] = {};
+    __cpuid(tmp, 0);
+    if (tmp[0] < 7)
+        return false;
+    __cpuid(reinterpret_cast<int*>(regs1), 1);
+    __cpuidex(reinterpret_cast<int*>(regs7), 7, 0);
+#else
+    if (__get_cpuid_max(0, nullptr) < 7)
+        return false;
+    __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+    __cpuid_count(7, 0, regs7[0], regs7[1], regs7[2], regs7[3]);
+#endif
+    const bool osxsave = (regs1[2] & (1u << 27)) != 0;
+    const bool avx2    = (regs7[1] & (1u << 5)) != 0;
+    if (!osxsave || !avx2)
+        return false;
+
+    // check that the OS preserves XMM & YMM state
+#ifdef _MSC_VER
+    unsigned long long xcr0 = _xgetbv(0);
+#else
+    unsigned int xcr0_lo = 0, xcr0_hi = 0;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    unsigned long long xcr0 = xcr0_lo;
+#endif
+    return (xcr0 & 0x6) == 0x6;
+}
+
+/** Query CPU support for SSE4.1. */
+static inline bool CpuSupportsSSE41 () {
+    unsigned int regs1[4] = {};
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(regs1), 1);
+#else
+    __cpuid(1, regs1[0], regs1[1], regs1[2], regs1[3]);
+#endif
+    return (regs1[2] & (1u << 19)) != 0;
+}
+
+#endif // SAMPLE_SIMD_X86
+
+
+/** Pick the fastest nearest-neighbour row kernel supported by the CPU. Detection is only performed once. */
+static inline SampleRowU8Fn SelectSampleRowU8 () {
+    static const SampleRowU8Fn kernel = []() -> SampleRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SampleRowU8_AVX2;
+        if (CpuSupportsSSE41())
+            return SampleRowU8_SSE41;
+#endif
+        return SampleRowU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest trilinear row kernel supported by the CPU. Detection is only performed once. */
+static inline SampleRowU8Fn SelectSampleRowLinearU8 () {
+    static const SampleRowU8Fn kernel = []() -> SampleRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SampleRowLinearU8_AVX2;
+#endif
+        return SampleRowLinearU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest nearest-neighbour plane kernel supported by the CPU. Detection is only performed once. */
+static inline SamplePlaneRowU8Fn SelectSamplePlaneRowU8 () {
+    static const SamplePlaneRowU8Fn kernel = []() -> SamplePlaneRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SamplePlaneRowU8_AVX2;
+#endif
+        return SamplePlaneRowU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest bilinear plane kernel supported by the CPU. Detection is only performed once. */
+static inline SamplePlaneRowU8Fn SelectSamplePlaneRowLinearU8 () {
+    static const SamplePlaneRowU8Fn kernel = []() -> SamplePlaneRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SamplePlaneRowLinearU8_AVX2;
+#endif
+        return SamplePlaneRowLinearU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest nearest-neighbour row kernel for table-addressed volumes. Detection is only performed once. */
+static inline SampleRowU8Fn SelectSampleRowBrickedU8 () {
+    static const SampleRowU8Fn kernel = []() -> SampleRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SampleRowBrickedU8_AVX2;
+#endif
+        return SampleRowBrickedU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest trilinear row kernel for table-addressed volumes. Detection is only performed once. */
+static inline SampleRowU8Fn SelectSampleRowLinearBrickedU8 () {
+    static const SampleRowU8Fn kernel = []() -> SampleRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return SampleRowLinearBrickedU8_AVX2;
+#endif
+        return SampleRowLinearBrickedU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest 2x reduction kernel supported by the CPU. Detection is only performed once. */
+static inline Reduce2xRowU8Fn SelectReduce2xRowU8 () {
+    static const Reduce2xRowU8Fn kernel = []() -> Reduce2xRowU8Fn {
+#ifdef SAMPLE_SIMD_X86
+        if (CpuSupportsAVX2())
+            return Reduce2xRowU8_AVX2;
+        if (CpuSupportsSSE41())
+            return Reduce2xRowU8_SSE41;
+#endif
+        return Reduce2xRowU8_Scalar;
+    }();
+    return kernel;
+}
+
+/** Pick the fastest kernel for mapping samples through "table": Byte shuffles for tables where every channel is either the sample itself
+    or constant, and otherwise AVX2 gather. CPU detection is only performed once. */
+static inline MapRowU8Fn SelectMapRowU8 (const uint32_t table[256]) {
+#ifdef SAMPLE_SIMD_X86
+    static const bool sse41 = CpuSupportsSSE41();
+    static const bool avx2  = CpuSupportsAVX2();
+    if (sse41 && IsRampTable(table))
+        return MapRowRampU8_SSE41;
+    if (avx2)
+        return MapRowU8_AVX2;
+#else
+    (void)table;
+#endif
+    return MapRowU8_Scalar;
+}
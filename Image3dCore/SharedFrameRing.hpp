@@ -0,0 +1,256 @@
+/* Portable core of the "3D API" reference loader.
+Ring of frame slots in shared memory, for transferring frames between processes without marshalling copies.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#ifdef _WIN32
+  #ifndef NOMINMAX
+    #define NOMINMAX
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+
+/** Memory layout at the start of a shared ring section. Slots follow at offset HEADER_SIZE.
+    Must be kept unchanged, since loaders and clients might be built separately. */
+struct SharedRingHeader {
+    static const uint32_t MAGIC       = 0x52443349; ///< "I3DR"
+    static const uint32_t MAX_SLOTS   = 64;
+    static const uint32_t HEADER_SIZE = 4096;       ///< slots start at a page boundary
+    static const uint32_t SLOT_ALIGN  = 4096;       ///< slot size granularity [bytes]
+
+    uint32_t              magic;
+    uint32_t              slot_count;
+    uint32_t              slot_size;             ///< [bytes]
+    uint32_t              reserved;
+    std::atomic<uint32_t> sequence[MAX_SLOTS];   ///< per-slot sequence number. Odd while the slot is being written.
+};
+static_assert(sizeof(SharedRingHeader) <= SharedRingHeader::HEADER_SIZE, "SharedRingHeader too large");
+
+
+/** Named shared memory section. Created read-write, or opened read-only by other processes. */
+class SharedMemory {
+public:
+    /** Create a new section. Throws std::runtime_error on failure. */
+    SharedMemory (const std::string & name, size_t size) : m_name(name), m_size(size), m_owner(true) {
+#ifdef _WIN32
+        m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(uint64_t(size) >> 32), static_cast<DWORD>(size), name.c_str());
+        if (!m_handle || (GetLastError() == ERROR_ALREADY_EXISTS))
+            Fail("CreateFileMapping");
+        m_data = static_cast<uint8_t*>(MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if (!m_data)
+            Fail("MapViewOfFile");
+#else
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+            Fail("shm_open");
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            close(fd);
+            Fail("ftruncate");
+        }
+        void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); // mapping remains valid
+        if (ptr == MAP_FAILED)
+            Fail("mmap");
+        m_data = static_cast<uint8_t*>(ptr);
+#endif
+    }
+
+    /** Open an existing section read-only. Throws std::runtime_error on failure. */
+    explicit SharedMemory (const std::string & name) : m_name(name), m_owner(false) {
+#ifdef _WIN32
+        m_handle = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+        if (!m_handle)
+            Fail("OpenFileMapping");
+        m_data = static_cast<uint8_t*>(MapViewOfFile(m_handle, FILE_MAP_READ, 0, 0, 0)); // map whole section
+        if (!m_data)
+            Fail("MapViewOfFile");
+        MEMORY_BASIC_INFORMATION info = {};
+        VirtualQuery(m_data, &info, sizeof(info));
+        m_size = info.RegionSize;
+#else
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            Fail("shm_open");
+        struct stat st = {};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            Fail("fstat");
+        }
+        m_size = static_cast<size_t>(st.st_size);
+        void * ptr = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (ptr == MAP_FAILED)
+            Fail("mmap");
+        m_data = static_cast<uint8_t*>(ptr);
+#endif
+    }
+
+    ~SharedMemory () {
+        Release();
+    }
+
+    uint8_t * Data () const {
+        return m_data;
+    }
+    size_t Size () const {
+        return m_size;
+    }
+
+    /** Generate a section name that is unique within the machine. */
+    static std::string UniqueName () {
+        static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+        const unsigned long pid = GetCurrentProcessId();
+        const char * prefix = "Local\\Image3dAPI_";
+#else
+        const unsigned long pid = static_cast<unsigned long>(getpid());
+        const char * prefix = "/Image3dAPI_";
+#endif
+        return prefix + std::to_string(pid) + "_" + std::to_string(counter++);
+    }
+
+private:
+    SharedMemory (const SharedMemory &) = delete;
+    SharedMemory & operator = (const SharedMemory &) = delete;
+
+    void Release () {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_handle)
+            CloseHandle(m_handle);
+        m_handle = nullptr;
+#else
+        if (m_data)
+            munmap(m_data, m_size);
+        if (m_owner)
+            shm_unlink(m_name.c_str()); // already mapped views remain valid
+#endif
+        m_data = nullptr;
+    }
+
+    void Fail (const char * operation) {
+        Release();
+        throw std::runtime_error(std::string(operation) + " failed for shared memory section " + m_name);
+    }
+
+    std::string m_name;
+    size_t      m_size = 0;
+    bool        m_owner = false; ///< section created by this object
+    uint8_t   * m_data = nullptr;
+#ifdef _WIN32
+    HANDLE      m_handle = nullptr;
+#endif
+};
+
+
+/** Ring of fixed-size frame slots in shared memory.
+    The loader writes frames into slots in round-robin order and hands out (offset, sequence) pairs. Writers of the same slot are
+    serialized, so that concurrent writes can wrap around the ring. Clients map the section read-only, and use the sequence numbers
+    to detect slots that were overwritten while reading (seqlock). */
+class SharedFrameRing {
+public:
+    /** Location of a slot. Holds the slot write lock until EndWrite. A slot destroyed without EndWrite stays marked as being written. */
+    struct Slot {
+        uint8_t *                    data     = nullptr;
+        uint32_t                     index    = 0;
+        uint32_t                     offset   = 0; ///< from start of section [bytes]
+        uint32_t                     sequence = 0; ///< sequence number after EndWrite
+        std::unique_lock<std::mutex> lock;
+    };
+
+    /** Create a ring with "slot_count" slots of at least "slot_size" bytes (loader side). */
+    SharedFrameRing (const std::string & name, uint32_t slot_count, uint32_t slot_size) : m_mem(name, SectionSize(slot_count, slot_size)) {
+        m_header = reinterpret_cast<SharedRingHeader*>(m_mem.Data());
+        m_header->magic = SharedRingHeader::MAGIC;
+        m_header->slot_count = slot_count;
+        m_header->slot_size = static_cast<uint32_t>(RoundUp(slot_size));
+        m_header->reserved = 0;
+        for (auto & seq : m_header->sequence)
+            seq.store(0, std::memory_order_relaxed);
+    }
+
+    /** Open an existing ring read-only (client side). */
+    explicit SharedFrameRing (const std::string & name) : m_mem(name) {
+        m_header = reinterpret_cast<SharedRingHeader*>(m_mem.Data());
+        if ((m_mem.Size() < SharedRingHeader::HEADER_SIZE) || (m_header->magic != SharedRingHeader::MAGIC) || (m_header->slot_count == 0) || (m_header->slot_count > SharedRingHeader::MAX_SLOTS)
+            || (m_header->slot_size == 0) || (m_header->slot_size % SharedRingHeader::SLOT_ALIGN) || (m_mem.Size() < SectionSize(m_header->slot_count, m_header->slot_size)))
+            throw std::runtime_error("invalid shared frame ring " + name);
+    }
+
+    uint32_t SlotCount () const {
+        return m_header->slot_count;
+    }
+    uint32_t SlotSize () const {
+        return m_header->slot_size;
+    }
+
+    /** Claim the next slot for writing, and mark it as being written. Waits for another write of the same slot to complete. */
+    Slot BeginWrite () {
+        Slot slot;
+        slot.index = m_next++ % m_header->slot_count;
+        slot.lock = std::unique_lock<std::mutex>(m_write_mutex[slot.index]);
+        slot.offset = SharedRingHeader::HEADER_SIZE + slot.index*m_header->slot_size;
+        slot.data = m_mem.Data() + slot.offset;
+
+        // odd number while writing (also after a previously aborted write)
+        const uint32_t writing = (m_header->sequence[slot.index].load(std::memory_order_relaxed) + 1) | 1;
+        m_header->sequence[slot.index].store(writing, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.sequence = writing + 1;
+        return slot;
+    }
+
+    /** Publish a slot written after BeginWrite, and release it for the next writer. */
+    void EndWrite (Slot & slot) {
+        m_header->sequence[slot.index].store(slot.sequence, std::memory_order_release);
+        slot.lock.unlock();
+    }
+
+    /** Read-only pointer to slot data at "offset", or nullptr if the range [offset, offset+size) is not within a slot. */
+    const uint8_t * Data (uint32_t offset, size_t size) const {
+        if (offset < SharedRingHeader::HEADER_SIZE)
+            return nullptr;
+        const uint32_t rel = offset - SharedRingHeader::HEADER_SIZE;
+        if ((rel / m_header->slot_size >= m_header->slot_count) || (rel % m_header->slot_size + size > m_header->slot_size))
+            return nullptr;
+        return m_mem.Data() + offset;
+    }
+
+    /** Check if the slot at "offset" still contains the frame with sequence number "sequence".
+        Call after reading a frame, to detect if the loader overwrote it in the meantime. */
+    bool IsCurrent (uint32_t offset, uint32_t sequence) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!Data(offset, 0))
+            return false;
+        const uint32_t index = (offset - SharedRingHeader::HEADER_SIZE) / m_header->slot_size;
+        return m_header->sequence[index].load(std::memory_order_acquire) == sequence;
+    }
+
+private:
+    static uint64_t RoundUp (uint32_t size) {
+        return (uint64_t(size) + SharedRingHeader::SLOT_ALIGN - 1) / SharedRingHeader::SLOT_ALIGN * SharedRingHeader::SLOT_ALIGN;
+    }
+
+    static size_t SectionSize (uint32_t slot_count, uint32_t slot_size) {
+        const uint64_t size = SharedRingHeader::HEADER_SIZE + uint64_t(slot_count)*RoundUp(slot_size);
+        if ((slot_count == 0) || (slot_count > SharedRingHeader::MAX_SLOTS) || (slot_size == 0) || (size > 0xFFFFFFFFull))
+            throw std::invalid_argument("unsupported shared frame ring size");
+        return static_cast<size_t>(size);
+    }
+
+    SharedMemory               m_mem;
+    SharedRingHeader         * m_header = nullptr;
+    std::atomic<uint32_t>      m_next{0}; ///< next slot to write (loader side)
+    std::mutex                 m_write_mutex[SharedRingHeader::MAX_SLOTS]; ///< per-slot writer lock (loader side)
+};
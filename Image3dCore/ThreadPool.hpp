@@ -0,0 +1,232 @@
+/* Portable core of the "3D API" reference loader.
+Work-stealing thread pool for parallel resampling.
+Copyright (c) 2020, GE Healthcare, Ultrasound.      */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/** Loader-wide pool of worker threads with one task queue per worker.
+    Workers pop tasks from the back of their own queue and steal from the front of other queues when idle.
+    Threads waiting for a ParallelFor call to complete help out by stealing, so nested calls cannot deadlock. */
+class ThreadPool {
+public:
+    /** Range function called with [begin, end) sub-ranges. */
+    typedef std::function<void(unsigned int begin, unsigned int end)> RangeFn;
+
+    /** Create a pool that runs work on "thread_count" threads, including the calling thread. */
+    explicit ThreadPool (unsigned int thread_count) {
+        if (thread_count < 1)
+            thread_count = 1;
+
+        // the calling thread also participates, so one less worker is needed
+        m_queues.resize(thread_count - 1);
+        for (auto & queue : m_queues)
+            queue.reset(new Queue());
+        for (unsigned int i = 0; i + 1 < thread_count; ++i)
+            m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+    }
+
+    ~ThreadPool () {
+        {
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto & worker : m_workers)
+            worker.join();
+    }
+
+    /** Loader-wide pool shared by all image sources. Destroyed when the last user releases it,
+        so that worker threads are never joined while the DLL is being unloaded. */
+    static std::shared_ptr<ThreadPool> Shared () {
+        static std::mutex                mutex;
+        static std::weak_ptr<ThreadPool> instance;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<ThreadPool> pool = instance.lock();
+        if (!pool) {
+            pool = std::make_shared<ThreadPool>(DefaultThreadCount());
+            instance = pool;
+        }
+        return pool;
+    }
+
+    /** Defaults to the number of CPU cores. Can be overridden through the DUMMYLOADER_THREADS environment variable. */
+    static unsigned int DefaultThreadCount () {
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable: 4996) // function or variable may be unsafe
+#endif
+        const char * env = std::getenv("DUMMYLOADER_THREADS");
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+        if (env && (atoi(env) > 0))
+            return static_cast<unsigned int>(atoi(env));
+
+        unsigned int cores = std::thread::hardware_concurrency();
+        return cores ? cores : 1;
+    }
+
+    /** Number of threads that work is spread across (including the calling thread). */
+    unsigned int ThreadCount () const {
+        return static_cast<unsigned int>(m_workers.size()) + 1;
+    }
+
+    /** Split [0,count) into tiles of at least "grain" items, and process them in parallel.
+        Returns when all tiles are processed. Exceptions thrown by "fn" are re-thrown in the calling thread. */
+    void ParallelFor (unsigned int count, unsigned int grain, const RangeFn & fn) {
+        if (count == 0)
+            return;
+
+        // aim for several tiles per thread, so that threads finishing early can steal work
+        const unsigned int max_tiles = 4*ThreadCount();
+        const unsigned int tile_size = std::max(std::max(grain, 1u), (count + max_tiles - 1)/max_tiles);
+        const unsigned int tiles     = (count + tile_size - 1)/tile_size;
+        if (m_workers.empty() || (tiles < 2)) {
+            fn(0, count); // nothing to parallelize
+            return;
+        }
+
+        Job job(fn, tiles);
+        {
+            // count tasks before they become visible, so that "m_pending" never underflows
+            std::lock_guard<std::mutex> lock(m_wake_mutex);
+            m_pending += tiles;
+        }
+        {
+            // distribute tiles round-robin across worker queues
+            const size_t first = m_next_queue++;
+            for (unsigned int t = 0; t < tiles; ++t) {
+                Queue & queue = *m_queues[(first + t) % m_queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(Task{ &job, t*tile_size, std::min(count, (t + 1)*tile_size) });
+            }
+        }
+        m_wake.notify_all();
+
+        // help out until no more tasks can be found, then wait for tiles still in flight
+        Task task;
+        while ((job.remaining > 0) && TryPop(CurrentQueue(), task))
+            Run(task);
+
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.done.wait(lock, [&job]() { return job.remaining == 0; });
+        }
+
+        if (job.error)
+            std::rethrow_exception(job.error);
+    }
+
+private:
+    ThreadPool (const ThreadPool &) = delete;
+    ThreadPool & operator = (const ThreadPool &) = delete;
+
+    /** State shared by all tiles of one ParallelFor call. */
+    struct Job {
+        Job (const RangeFn & _fn, unsigned int tiles) : fn(_fn), remaining(tiles) {
+        }
+
+        const RangeFn &           fn;
+        std::atomic<unsigned int> remaining;
+        std::exception_ptr        error;   ///< first exception thrown (protected by mutex)
+        std::mutex                mutex;
+        std::condition_variable   done;
+    };
+
+    struct Task {
+        Job *        job;
+        unsigned int begin;
+        unsigned int end;
+    };
+
+    struct Queue {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    /** Index of the queue owned by the current thread, or -1 for non-worker threads. */
+    static int & CurrentQueue () {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    /** Pop from the back of our own queue, or steal from the front of another queue. */
+    bool TryPop (int own, Task & task) {
+        const size_t N = m_queues.size();
+        if (own >= 0) {
+            Queue & queue = *m_queues[own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+                --m_pending;
+                return true;
+            }
+        }
+        const size_t first = (own >= 0) ? own + 1 : 0;
+        for (size_t i = 0; i < N; ++i) {
+            Queue & victim = *m_queues[(first + i) % N];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                --m_pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void Run (const Task & task) {
+        Job & job = *task.job;
+        try {
+            job.fn(task.begin, task.end);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.error)
+                job.error = std::current_exception();
+        }
+
+        // decrement under lock, since the waiting thread destroys "job" as soon as it observes zero
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (--job.remaining == 0)
+            job.done.notify_all();
+    }
+
+    void WorkerLoop (unsigned int index) {
+        CurrentQueue() = static_cast<int>(index);
+
+        for (;;) {
+            Task task;
+            if (TryPop(static_cast<int>(index), task)) {
+                Run(task);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wake_mutex);
+            m_wake.wait(lock, [this]() { return m_stop || (m_pending > 0); });
+            if (m_stop)
+                return;
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread>            m_workers;
+    std::atomic<size_t>                 m_next_queue{0};
+    std::atomic<size_t>                 m_pending{0};  ///< number of queued tasks
+    std::mutex                          m_wake_mutex;
+    std::condition_variable             m_wake;
+    bool                                m_stop = false; ///< protected by m_wake_mutex
+};
@@ -0,0 +1,134 @@
+/* Tests of MetaImage (.mhd/.mha) header parsing & data file layout checks, run by ctest.
+Headers are parsed from memory, so that no files are needed. */
+#include "MetaImage.hpp"
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+
+static bool s_all_ok = true;
+
+static void Check (const char * name, bool ok) {
+    std::cout << "  " << std::left << std::setw(40) << name << (ok ? "OK" : "FAILED") << "\n";
+    s_all_ok &= ok;
+}
+
+/** Check that "fn" throws std::invalid_argument. */
+static void CheckThrows (const char * name, const std::function<void()> & fn) {
+    bool thrown = false;
+    try {
+        fn();
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    Check(name, thrown);
+}
+
+static MetaImageHeader Parse (const std::string & text, const std::wstring & path = L"dir/volume.mhd") {
+    return MetaImageHeader::Parse(text.data(), text.size(), path);
+}
+
+
+static void RunTests () {
+    const std::string VALID =
+        "ObjectType = Image\n"
+        "NDims = 3\n"
+        "DimSize = 4 3 2\n"
+        "ElementSpacing = 0.5 0.25 2\n"
+        "Offset = 1 2 3\n"
+        "ElementType = MET_USHORT\n"
+        "ElementDataFile = volume.raw\n";
+
+    std::cout << "Valid headers:\n";
+    {
+        const MetaImageHeader header = Parse(VALID);
+        Check("3D dims & format", (header.dims[0] == 4) && (header.dims[1] == 3) && (header.dims[2] == 2) && (header.frames == 1) && (header.format == FORMAT_U16));
+        Check("3D spacing & offset", (header.spacing[0] == 0.5) && (header.spacing[2] == 2) && (header.offset[2] == 3));
+        Check("data file relative to header", header.data_file == L"dir/volume.raw");
+        Check("data at start of file", (header.header_size == 0) && (header.DataOffset(header.FrameSize()) == 0));
+    }
+    {
+        const MetaImageHeader header = Parse("NDims = 4\r\nDimSize = 2 2 2 5\r\nElementSpacing = 1 1 1 0.04\r\nElementType = MET_UCHAR\r\nElementDataFile = /abs/seq.raw\r\n");
+        Check("4D sequence (CRLF)", (header.frames == 5) && (header.spacing[3] == 0.04) && (header.FrameSize() == 8));
+        Check("absolute data file", header.data_file == L"/abs/seq.raw");
+    }
+    {
+        // .mha with binary data (incl. NUL & newline bytes) following the header
+        std::string text = "NDims = 3\nDimSize = 4 2 2\nElementType = MET_UCHAR\nHeaderSize = 100\nElementDataFile = LOCAL\n";
+        const size_t header_end = text.size();
+        text += std::string("\0\n\xff=", 4) + std::string(12, '\0');
+        const MetaImageHeader header = Parse(text, L"dir/volume.mha");
+        Check("LOCAL data file is the header", header.data_file == L"dir/volume.mha");
+        Check("LOCAL data follows header", (header.header_size == static_cast<int64_t>(header_end)) && (header.DataOffset(text.size()) == header_end));
+    }
+    {
+        const MetaImageHeader header = Parse("NDims = 3\nDimSize = 4 3 2\nElementType = MET_FLOAT\nHeaderSize = -1\nElementDataFile = volume.raw\n");
+        Check("HeaderSize = -1 skips to data at end", (header.header_size == -1) && (header.DataOffset(96 + 20) == 20));
+        CheckThrows("HeaderSize = -1 with truncated file", [&]() { header.DataOffset(95); });
+    }
+    {
+        const MetaImageHeader header = Parse("NDims = 3\nDimSize = 4 3 2\nElementType = MET_USHORT\nHeaderSize = 16\nElementDataFile = volume.raw\n");
+        Check("HeaderSize skips bytes", header.DataOffset(16 + 48) == 16);
+    }
+
+    std::cout << "Malformed or unsupported headers:\n";
+    auto replace = [&VALID](const std::string & from, const std::string & to) {
+        std::string text = VALID;
+        text.replace(text.find(from), from.size(), to);
+        return text;
+    };
+    CheckThrows("empty header", []() { Parse(""); });
+    CheckThrows("missing NDims", [&]() { Parse(replace("NDims = 3\n", "")); });
+    CheckThrows("missing ElementDataFile", [&]() { Parse(replace("ElementDataFile = volume.raw\n", "")); });
+    CheckThrows("missing ElementType", [&]() { Parse(replace("ElementType = MET_USHORT\n", "")); });
+    CheckThrows("NDims = 2", [&]() { Parse(replace("NDims = 3", "NDims = 2")); });
+    CheckThrows("DimSize before NDims", []() { Parse("DimSize = 4 3 2\nNDims = 3\nElementType = MET_UCHAR\nElementDataFile = volume.raw\n"); });
+    CheckThrows("DimSize with too few values", [&]() { Parse(replace("DimSize = 4 3 2", "DimSize = 4 3")); });
+    CheckThrows("DimSize zero", [&]() { Parse(replace("DimSize = 4 3 2", "DimSize = 4 0 2")); });
+    CheckThrows("DimSize above 65535", [&]() { Parse(replace("DimSize = 4 3 2", "DimSize = 4 65536 2")); });
+    CheckThrows("DimSize fractional", [&]() { Parse(replace("DimSize = 4 3 2", "DimSize = 4 3.5 2")); });
+    CheckThrows("ElementSpacing not positive", [&]() { Parse(replace("ElementSpacing = 0.5 0.25 2", "ElementSpacing = 0.5 0 2")); });
+    CheckThrows("ElementType MET_SHORT", [&]() { Parse(replace("MET_USHORT", "MET_SHORT")); });
+    CheckThrows("big-endian data", [&]() { Parse(replace("ObjectType = Image\n", "BinaryDataByteOrderMSB = True\n")); });
+    CheckThrows("compressed data", [&]() { Parse(replace("ObjectType = Image\n", "CompressedData = True\n")); });
+    CheckThrows("multiple channels", [&]() { Parse(replace("ObjectType = Image\n", "ElementNumberOfChannels = 3\n")); });
+    CheckThrows("ObjectType not Image", [&]() { Parse(replace("ObjectType = Image", "ObjectType = Scene")); });
+    CheckThrows("line without '='", [&]() { Parse(replace("ObjectType = Image", "ObjectType Image")); });
+    CheckThrows("binary data before ElementDataFile", [&]() { Parse(replace("ObjectType = Image", std::string("Object\0Type = Image", 19))); });
+    CheckThrows("HeaderSize below -1", [&]() { Parse(replace("ObjectType = Image", "HeaderSize = -2")); });
+    CheckThrows("ElementDataFile = LIST", [&]() { Parse(replace("volume.raw", "LIST")); });
+    CheckThrows("ElementDataFile pattern", [&]() { Parse(replace("volume.raw", "slice%03d.raw 1 10 1")); });
+
+    std::cout << "Data file layout:\n";
+    {
+        const MetaImageHeader header = Parse(VALID); // 48 bytes
+        CheckThrows("truncated data file", [&]() { header.DataOffset(47); });
+        const MetaImageHeader skip = Parse(replace("ObjectType = Image", "HeaderSize = 3"));
+        CheckThrows("HeaderSize beyond file", [&]() { skip.DataOffset(2); });
+        CheckThrows("data misaligned to element size", [&]() { skip.DataOffset(3 + 48); });
+    }
+    {
+        // 2^34 bytes per frame times 2^30 frames wraps around to 0 in 64bit arithmetic
+        const MetaImageHeader header = Parse("NDims = 4\nDimSize = 16384 16384 16 1073741824\nElementType = MET_FLOAT\nElementDataFile = seq.raw\n");
+        CheckThrows("data size overflow", [&]() { header.DataOffset(uint64_t(1) << 40); });
+        CheckThrows("data size overflow (HeaderSize = -1)", [&]() {
+            MetaImageHeader end = header;
+            end.header_size = -1;
+            end.DataOffset(uint64_t(1) << 40);
+        });
+    }
+}
+
+
+int main () {
+    try {
+        RunTests();
+    } catch (const std::exception & err) {
+        std::cout << "FAILED with unexpected exception: " << err.what() << "\n";
+        s_all_ok = false;
+    }
+
+    std::cout << (s_all_ok ? "All tests passed\n" : "Some tests FAILED\n");
+    return s_all_ok ? 0 : 1;
+}
@@ -0,0 +1,1061 @@
+/* Micro-benchmark of the Image3dCore resampling kernels.
+Sweeps source sizes, output resolutions, geometry classes and interpolation modes,
+and reports throughput so that kernel changes can be compared across machines. */
+#include "MipPyramid.hpp"
+#include "../Image3dAPI/FrameCache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+
+/** Source volume geometry (same as DummyLoader). */
+static const Cart3dGeom SOURCE_GEOM = { -0.1f, 0,     -0.075f,// origin
+                                         0.20f,0,      0,     // dir1 (width)
+                                         0,    0.10f,  0,     // dir2 (depth)
+                                         0,    0,      0.15f};// dir3 (elevation)
+
+enum TestGeometry {
+    GEOM_ALIGNED,  ///< bounding box of the source
+    GEOM_SCALED,   ///< 2x zoom into the center of the source
+    GEOM_ZOOMOUT,  ///< 2x zoom out from the center of the source, so that most of the output falls outside
+    GEOM_OBLIQUE,  ///< bounding box rotated around its center
+    GEOM_PARTIAL,  ///< bounding box shifted so that parts of the output fall outside the source
+    GEOM_PLANE,    ///< single oblique plane through the center (dir3 empty)
+};
+
+static const char * ToString (TestGeometry geom) {
+    switch (geom) {
+    case GEOM_ALIGNED: return "aligned";
+    case GEOM_SCALED:  return "scaled";
+    case GEOM_ZOOMOUT: return "zoomout";
+    case GEOM_OBLIQUE: return "oblique";
+    case GEOM_PARTIAL: return "partial";
+    case GEOM_PLANE:   return "plane";
+    }
+    return "";
+}
+
+/** Rotate "v" around the unit vector "axis" by "angle" radians (Rodrigues' formula). */
+static vec3f Rotate (vec3f v, vec3f axis, float angle) {
+    float c = std::cos(angle), s = std::sin(angle);
+    return c*v + s*cross_prod(axis, v) + ((1 - c)*dot_prod(axis, v))*axis;
+}
+
+static Cart3dGeom MakeGeometry (TestGeometry geom_class) {
+    vec3f origin, dir1, dir2, dir3;
+    std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(SOURCE_GEOM);
+    const vec3f center = origin + 0.5f*(dir1 + dir2 + dir3);
+
+    switch (geom_class) {
+    case GEOM_ALIGNED:
+        break;
+    case GEOM_SCALED:
+    case GEOM_ZOOMOUT:
+    {
+        const float scale = (geom_class == GEOM_SCALED) ? 0.5f : 2.0f;
+        dir1 *= scale;
+        dir2 *= scale;
+        dir3 *= scale;
+        origin = center - 0.5f*(dir1 + dir2 + dir3);
+        break;
+    }
+    case GEOM_OBLIQUE:
+    case GEOM_PLANE:
+        dir1 = Rotate(Rotate(dir1, vec3f(0, 0, 1), 0.5f), vec3f(1, 0, 0), 0.35f);
+        dir2 = Rotate(Rotate(dir2, vec3f(0, 0, 1), 0.5f), vec3f(1, 0, 0), 0.35f);
+        dir3 = Rotate(Rotate(dir3, vec3f(0, 0, 1), 0.5f), vec3f(1, 0, 0), 0.35f);
+        if (geom_class == GEOM_PLANE) {
+            origin = center - 0.5f*(dir1 + dir2);
+            dir3 = vec3f(0, 0, 0);
+        } else {
+            origin = center - 0.5f*(dir1 + dir2 + dir3);
+        }
+        break;
+    case GEOM_PARTIAL:
+        origin += 0.5f*dir1 + 0.25f*dir2;
+        break;
+    }
+
+    return ToCart3dGeom(origin, dir1, dir2, dir3);
+}
+
+
+enum SliceOrientation {
+    SLICE_XY,      ///< rows along x, slices stepping along z (row-major order)
+    SLICE_XZ,      ///< rows along x, slices stepping along y
+    SLICE_YZ,      ///< rows along y, slices stepping along x (plane-strided in row-major order)
+    SLICE_OBLIQUE, ///< rotated bounding box
+};
+
+static const char * ToString (SliceOrientation orientation) {
+    switch (orientation) {
+    case SLICE_XY:      return "XY";
+    case SLICE_XZ:      return "XZ";
+    case SLICE_YZ:      return "YZ";
+    case SLICE_OBLIQUE: return "oblique";
+    }
+    return "";
+}
+
+/** Stack of slices covering the source bounding box. */
+static Cart3dGeom MakeSliceStack (SliceOrientation orientation) {
+    vec3f origin, dir1, dir2, dir3;
+    std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(SOURCE_GEOM);
+
+    switch (orientation) {
+    case SLICE_XY:      return ToCart3dGeom(origin, dir1, dir2, dir3);
+    case SLICE_XZ:      return ToCart3dGeom(origin, dir1, dir3, dir2);
+    case SLICE_YZ:      return ToCart3dGeom(origin, dir2, dir3, dir1);
+    case SLICE_OBLIQUE: return MakeGeometry(GEOM_OBLIQUE);
+    }
+    return SOURCE_GEOM;
+}
+
+/** Checkerboard with 8-voxel squares and a noise component, so that neither sampling nor compression is trivial. */
+static std::vector<uint8_t> MakeSource (unsigned short size) {
+    std::mt19937 rng(size);
+    std::vector<uint8_t> buf(static_cast<size_t>(size)*size*size);
+    for (size_t z = 0; z < size; ++z) {
+        for (size_t y = 0; y < size; ++y) {
+            for (size_t x = 0; x < size; ++x) {
+                bool odd = ((x/8) ^ (y/8) ^ (z/8)) & 1;
+                buf[x + y*size + z*size*size] = static_cast<uint8_t>((odd ? 192 : 64) + (rng() & 0x1F));
+            }
+        }
+    }
+    return buf;
+}
+
+/** Ultrasound-like source, with a checkerboard inside a 90 degree sector below the probe, and zeros outside. */
+static std::vector<uint8_t> MakeSectorSource (unsigned short size) {
+    std::vector<uint8_t> buf(static_cast<size_t>(size)*size*size, 0);
+    const float apex = 0.5f*size; // probe at the center of the top plane (y = 0)
+    for (size_t z = 0; z < size; ++z) {
+        for (size_t y = 0; y < size; ++y) {
+            for (size_t x = 0; x < size; ++x) {
+                const float lateral = std::hypot(x + 0.5f - apex, z + 0.5f - apex);
+                if (lateral > y + 0.5f)
+                    continue; // outside sector
+                bool odd = ((x/8) ^ (y/8) ^ (z/8)) & 1;
+                buf[x + y*size + z*size*size] = odd ? 192 : 64;
+            }
+        }
+    }
+    return buf;
+}
+
+
+/** Median duration of "reps" calls of "fn", after a single warmup call [seconds]. */
+static double MedianTime (unsigned int reps, const std::function<void()> & fn) {
+    std::vector<double> times;
+    fn(); // warmup
+    for (unsigned int i = 0; i < reps; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+
+/** Last-level cache miss counter for the calling thread, through Linux perf events.
+    Unavailable on other platforms, and when the kernel or hypervisor doesn't expose hardware counters. */
+class CacheMissCounter {
+public:
+    CacheMissCounter () {
+#ifdef __linux__
+        perf_event_attr attr = {};
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1; // permitted with perf_event_paranoid <= 2
+        attr.exclude_hv     = 1;
+        m_fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~CacheMissCounter () {
+#ifdef __linux__
+        if (m_fd >= 0)
+            close(m_fd);
+#endif
+    }
+
+    bool Available () const {
+        return m_fd >= 0;
+    }
+
+    /** Cache misses during "fn". Returns 0 if unavailable. */
+    uint64_t Measure (const std::function<void()> & fn) {
+        uint64_t count = 0;
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+            fn();
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+                count = 0;
+            return count;
+        }
+#endif
+        fn();
+        return count;
+    }
+
+private:
+    CacheMissCounter (const CacheMissCounter &) = delete;
+    CacheMissCounter & operator = (const CacheMissCounter &) = delete;
+
+    int m_fd = -1;
+};
+
+/** Compare all SIMD row kernels supported by the CPU against the scalar reference on random rows. */
+/** 256-entry R8G8B8A8 table. Either an opaque grayscale ramp (as returned by DummyLoader) or a tinted tissue map that requires lookups. */
+static std::vector<uint32_t> MakeColorTable (bool tinted) {
+    std::vector<uint32_t> table(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+        const uint32_t r = i, g = tinted ? i*i/255 : i, b = tinted ? (255 - i)/2 : i;
+        table[i] = r | (g << 8) | (b << 16) | (0xFFu << 24);
+    }
+    return table;
+}
+
+static bool VerifyKernels () {
+    struct Kernel {
+        const char *  name;
+        SampleRowU8Fn fn;
+        SampleRowU8Fn reference; ///< row-major scalar kernel
+        bool          bricked;
+        bool          interior;  ///< only run on the part of the row inside the volume
+    };
+    std::vector<Kernel> kernels;
+    kernels.push_back({ "nearest interior", SampleRowInteriorU8_Scalar, SampleRowU8_Scalar, false, true });
+    kernels.push_back({ "linear interior", SampleRowLinearInteriorU8_Scalar, SampleRowLinearU8_Scalar, false, true });
+    kernels.push_back({ "nearest bricked", SampleRowBrickedU8_Scalar, SampleRowU8_Scalar, true, false });
+    kernels.push_back({ "linear bricked", SampleRowLinearBrickedU8_Scalar, SampleRowLinearU8_Scalar, true, false });
+#ifdef SAMPLE_SIMD_X86
+    if (CpuSupportsSSE41())
+        kernels.push_back({ "nearest SSE4.1", SampleRowU8_SSE41, SampleRowU8_Scalar, false, false });
+    if (CpuSupportsAVX2()) {
+        kernels.push_back({ "nearest AVX2", SampleRowU8_AVX2, SampleRowU8_Scalar, false, false });
+        kernels.push_back({ "linear AVX2", SampleRowLinearU8_AVX2, SampleRowLinearU8_Scalar, false, false });
+        kernels.push_back({ "nearest brk AVX2", SampleRowBrickedU8_AVX2, SampleRowU8_Scalar, true, false });
+        kernels.push_back({ "linear brk AVX2", SampleRowLinearBrickedU8_AVX2, SampleRowLinearU8_Scalar, true, false });
+    }
+#endif
+
+    // random rows, including axis-parallel rows and rows starting exactly on voxel boundaries
+    auto random_row = [](std::mt19937 & rng, int row, int64_t pos[3], int64_t inc[3]) {
+        std::uniform_real_distribution<double> pos_dist(-10, 45), inc_dist(-2, 2);
+        for (int a = 0; a < 3; ++a) {
+            pos[a] = static_cast<int64_t>(pos_dist(rng)*vec3fixed::ONE);
+            inc[a] = static_cast<int64_t>(inc_dist(rng)*vec3fixed::ONE*((row % 4 == 0) ? 0.01 : 1.0));
+            if (row % 8 == 1)
+                pos[a] &= ~int64_t(0xFFFFFFFF);
+            if ((row % 8 == 3) && (a == row % 3))
+                inc[a] = 0;
+        }
+    };
+
+    std::mt19937 rng(42);
+    std::vector<uint8_t> vol(37*23*11 + 3);
+    for (auto & val : vol)
+        val = static_cast<uint8_t>(rng());
+
+    bool all_ok = true;
+    for (const Kernel & kernel : kernels) {
+        size_t mismatches = 0, samples = 0;
+        for (unsigned int misalign = 0; misalign < 4; ++misalign) {
+            // odd dimensions and misaligned start to exercise tails & gather edge cases
+            const VoxelGridU8 src = { vol.data() + misalign, {37, 23, 11}, 37, 37*23, {} };
+            const unsigned short dims[3] = { 37, 23, 11 };
+            const BrickedVolume bricked(Image3dView::Packed(0, FORMAT_U8, dims, vol.data() + misalign));
+            const VoxelGridU8 kernel_src = kernel.bricked ? bricked.Grid() : src;
+            for (int row = 0; row < 10000; ++row) {
+                int64_t pos[3], inc[3];
+                random_row(rng, row, pos, inc);
+                const unsigned int count = rng() % 100;
+                unsigned int begin = 0, end = count;
+                if (kernel.interior)
+                    ClipRow(src.dims, pos, inc, count, begin, end);
+
+                uint8_t ref[100], out[100];
+                const int64_t start[3] = { pos[0] + begin*inc[0], pos[1] + begin*inc[1], pos[2] + begin*inc[2] };
+                kernel.reference(src, pos, inc, count, OUTSIDE_VAL, ref);
+                kernel.fn(kernel_src, start, inc, end - begin, OUTSIDE_VAL, out + begin);
+                mismatches += (end - begin) - std::inner_product(ref + begin, ref + end, out + begin, size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+                samples += end - begin;
+            }
+        }
+        std::cout << "  " << std::left << std::setw(20) << kernel.name << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    {
+        // row clipping must agree exactly with the per-voxel bounds test
+        const unsigned int dims[3] = { 37, 23, 11 };
+        size_t mismatches = 0, samples = 0;
+        for (int row = 0; row < 40000; ++row) {
+            int64_t pos[3], inc[3];
+            random_row(rng, row, pos, inc);
+            const unsigned int count = rng() % 100;
+            unsigned int begin = 0, end = 0;
+            ClipRow(dims, pos, inc, count, begin, end);
+            for (unsigned int i = 0; i < count; ++i) {
+                bool inside = true;
+                for (int a = 0; a < 3; ++a)
+                    inside &= (static_cast<uint64_t>(pos[a] + i*inc[a]) >> 32) < dims[a];
+                mismatches += (inside != ((i >= begin) && (i < end)));
+            }
+            samples += count;
+        }
+        std::cout << "  " << std::left << std::setw(20) << "row clipping" << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    {
+        // row dispatch (clipping, strided copies & SIMD kernels) of row-major and bricked sources against the scalar kernels on the full row
+        const unsigned short dims[3] = { 37, 23, 11 };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, vol.data() + 2);
+        const BrickedVolume bricked(src);
+        const VoxelGridU8 grid = { src.data, {37, 23, 11}, 37, 37*23, {} };
+        size_t mismatches = 0, samples = 0;
+        for (int row = 0; row < 40000; ++row) {
+            const bool linear = (row % 2 == 1);
+            int64_t pos[3], inc[3];
+            random_row(rng, row/2, pos, inc);
+            const auto count = static_cast<unsigned short>(rng() % 100);
+
+            uint8_t ref[100], out[100];
+            (linear ? SampleRowLinearU8_Scalar : SampleRowU8_Scalar)(grid, pos, inc, count, OUTSIDE_VAL, ref);
+            vec3fixed p, d;
+            p.x = pos[0]; p.y = pos[1]; p.z = pos[2];
+            d.x = inc[0]; d.y = inc[1]; d.z = inc[2];
+            const InterpolationMode interp = linear ? INTERPOLATION_LINEAR : INTERPOLATION_NEAREST;
+            if (row % 4 < 2)
+                SampleRowFixed(src, p, d, count, interp, out);
+            else
+                SampleRowFixed(bricked, p, d, count, interp, out);
+            mismatches += count - std::inner_product(ref, ref + count, out, size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+            samples += count;
+        }
+        std::cout << "  " << std::left << std::setw(20) << "row dispatch" << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    // plane kernels, on rows clipped to the plane, against the scalar plane kernels
+    struct PlaneKernel {
+        const char *       name;
+        SamplePlaneRowU8Fn fn;
+        SamplePlaneRowU8Fn reference;
+    };
+    std::vector<PlaneKernel> plane_kernels;
+#ifdef SAMPLE_SIMD_X86
+    if (CpuSupportsAVX2()) {
+        plane_kernels.push_back({ "nearest plane AVX2", SamplePlaneRowU8_AVX2, SamplePlaneRowU8_Scalar });
+        plane_kernels.push_back({ "linear plane AVX2", SamplePlaneRowLinearU8_AVX2, SamplePlaneRowLinearU8_Scalar });
+    }
+#endif
+    for (const PlaneKernel & kernel : plane_kernels) {
+        size_t mismatches = 0, samples = 0;
+        for (unsigned int misalign = 0; misalign < 4; ++misalign) {
+            // transposed plane with non-unit strides along both axes
+            const PlaneGridU8 src = { vol.data() + misalign, {23, 37}, {37, 1} };
+            const unsigned int dims[3] = { 23, 37, 1 };
+            for (int row = 0; row < 10000; ++row) {
+                int64_t pos[3], inc[3];
+                random_row(rng, row, pos, inc);
+                pos[2] = inc[2] = 0;
+                const unsigned int count = rng() % 100;
+                unsigned int begin = 0, end = 0;
+                ClipRow(dims, pos, inc, count, begin, end);
+
+                uint8_t ref[100], out[100];
+                const int64_t start[2] = { pos[0] + begin*inc[0], pos[1] + begin*inc[1] };
+                kernel.reference(src, start, inc, end - begin, ref);
+                kernel.fn(src, start, inc, end - begin, out);
+                mismatches += (end - begin) - std::inner_product(ref, ref + (end - begin), out, size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+                samples += end - begin;
+            }
+        }
+        std::cout << "  " << std::left << std::setw(20) << kernel.name << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    {
+        // axis-aligned rows with integer steps, that are resampled by strided copies, against the scalar kernels
+        const unsigned short dims[3] = { 37, 23, 11 };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, vol.data() + 3);
+        const VoxelGridU8 grid = { src.data, {37, 23, 11}, 37, 37*23, {} };
+        std::uniform_real_distribution<double> pos_dist(-10, 45);
+        size_t mismatches = 0, samples = 0;
+        for (int row = 0; row < 20000; ++row) {
+            const bool linear = (row % 2 == 1);
+            int64_t pos[3], inc[3] = {0, 0, 0};
+            for (int a = 0; a < 3; ++a) {
+                pos[a] = static_cast<int64_t>(pos_dist(rng)*vec3fixed::ONE);
+                if (linear && (row % 4 != 3))
+                    pos[a] = (pos[a] & ~int64_t(0xFFFFFFFF)) | 0x80000000; // voxel centers (weights zero)
+            }
+            const int step = static_cast<int>(rng() % 7) - 3;
+            inc[(row/2) % 3] = int64_t(step ? step : 1) << 32;
+            const auto count = static_cast<unsigned short>(rng() % 100);
+
+            uint8_t ref[100], out[100];
+            (linear ? SampleRowLinearU8_Scalar : SampleRowU8_Scalar)(grid, pos, inc, count, OUTSIDE_VAL, ref);
+            vec3fixed p, d;
+            p.x = pos[0]; p.y = pos[1]; p.z = pos[2];
+            d.x = inc[0]; d.y = inc[1]; d.z = inc[2];
+            SampleRowFixed(src, p, d, count, linear ? INTERPOLATION_LINEAR : INTERPOLATION_NEAREST, out);
+            mismatches += count - std::inner_product(ref, ref + count, out, size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+            samples += count;
+        }
+
+        // identity & 2x decimation of the bounding box, against the source voxels
+        ThreadPool pool(2);
+        for (unsigned int factor = 1; factor <= 2; ++factor) {
+            const unsigned short out_dims[3] = { static_cast<unsigned short>(36/factor), static_cast<unsigned short>(22/factor), static_cast<unsigned short>(10/factor) };
+            Image3dView even = src; // cropped to even dimensions
+            even.dims[0] = 36;
+            even.dims[1] = 22;
+            even.dims[2] = 10;
+            std::vector<uint8_t> out_buf(static_cast<size_t>(out_dims[0])*out_dims[1]*out_dims[2]);
+            SampleFrame<uint8_t>(even, SOURCE_GEOM, SOURCE_GEOM, INTERPOLATION_NEAREST, pool, Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data()));
+            for (unsigned int z = 0; z < out_dims[2]; ++z)
+                for (unsigned int y = 0; y < out_dims[1]; ++y)
+                    for (unsigned int x = 0; x < out_dims[0]; ++x)
+                        mismatches += out_buf[x + (y + z*out_dims[1])*out_dims[0]] != src.data[factor*x + factor*y*src.stride0 + factor*z*src.stride1];
+            samples += out_buf.size();
+        }
+        std::cout << "  " << std::left << std::setw(20) << "aligned copy" << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    {
+        // single-slice path (incl. in-plane slices) against the first plane of a two-plane volume through the 3D path
+        ThreadPool pool(2);
+        const unsigned short dims[3] = { 37, 23, 11 };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, vol.data() + 1);
+        size_t mismatches = 0, samples = 0;
+        const SliceOrientation orientations[] = { SLICE_XY, SLICE_XZ, SLICE_YZ, SLICE_OBLIQUE };
+        const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+        for (SliceOrientation orientation : orientations) {
+            vec3f origin, dir1, dir2, dir3;
+            std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(MakeSliceStack(orientation));
+            for (int offset = -2; offset <= 2*dims[2] + 2; ++offset) {
+                // slices on voxel centers, between planes and outside the source
+                const Cart3dGeom geom = ToCart3dGeom(origin + (offset/(2.0f*dims[2]))*dir3 + 0.1f*dir1, 1.3f*dir1, 0.8f*dir2, dir3);
+                for (InterpolationMode interp : interps) {
+                    const unsigned short slice_dims[3] = { 45, 29, 1 }, stack_dims[3] = { 45, 29, 2 };
+                    std::vector<uint8_t> slice_buf(45*29), stack_buf(45*29*2);
+                    SampleFrame<uint8_t>(src, SOURCE_GEOM, geom, interp, pool, Image3dView::Packed(0, FORMAT_U8, slice_dims, slice_buf.data()));
+                    SampleFrame<uint8_t>(src, SOURCE_GEOM, geom, interp, pool, Image3dView::Packed(0, FORMAT_U8, stack_dims, stack_buf.data()));
+                    mismatches += slice_buf.size() - std::inner_product(slice_buf.begin(), slice_buf.end(), stack_buf.begin(), size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+                    samples += slice_buf.size();
+                }
+            }
+        }
+        std::cout << "  " << std::left << std::setw(20) << "single slice" << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    // 2x reduction kernels, on odd and even widths with misaligned rows
+    struct ReduceKernel {
+        const char *    name;
+        Reduce2xRowU8Fn fn;
+    };
+    std::vector<ReduceKernel> reduce_kernels;
+#ifdef SAMPLE_SIMD_X86
+    if (CpuSupportsSSE41())
+        reduce_kernels.push_back({ "reduce2x SSE4.1", Reduce2xRowU8_SSE41 });
+    if (CpuSupportsAVX2())
+        reduce_kernels.push_back({ "reduce2x AVX2", Reduce2xRowU8_AVX2 });
+#endif
+    for (const ReduceKernel & kernel : reduce_kernels) {
+        size_t mismatches = 0, samples = 0;
+        for (unsigned int src_width = 1; src_width < 200; ++src_width) {
+            const unsigned int out_width = (src_width + 1)/2;
+            const unsigned int misalign = src_width % 4;
+            const uint8_t * const rows[4] = { vol.data() + misalign, vol.data() + 211, vol.data() + 457 + misalign, vol.data() + 211 }; // incl. duplicated row
+            uint8_t ref[100], out[100];
+            Reduce2xRowU8_Scalar(rows, src_width, out_width, ref);
+            kernel.fn(rows, src_width, out_width, out);
+            mismatches += out_width - std::inner_product(ref, ref + out_width, out, size_t(0), std::plus<size_t>(), std::equal_to<uint8_t>());
+            samples += out_width;
+        }
+        std::cout << "  " << std::left << std::setw(20) << kernel.name << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+
+    // color table kernels, on a grayscale ramp and a tissue-like table, with misaligned rows
+    struct MapKernel {
+        const char * name;
+        MapRowU8Fn   fn;
+        bool         ramp_only; ///< only valid for tables that pass IsRampTable
+    };
+    std::vector<MapKernel> map_kernels;
+#ifdef SAMPLE_SIMD_X86
+    if (CpuSupportsSSE41())
+        map_kernels.push_back({ "colormap SSE4.1", MapRowRampU8_SSE41, true });
+    if (CpuSupportsAVX2())
+        map_kernels.push_back({ "colormap AVX2", MapRowU8_AVX2, false });
+#endif
+    const std::vector<uint32_t> gray = MakeColorTable(false), tissue = MakeColorTable(true);
+    for (const MapKernel & kernel : map_kernels) {
+        size_t mismatches = 0, samples = 0;
+        for (const std::vector<uint32_t> * table : { &gray, &tissue }) {
+            if (kernel.ramp_only && !IsRampTable(table->data()))
+                continue;
+            for (unsigned int count = 0; count < 200; ++count) {
+                const uint8_t * in = vol.data() + count % 16;
+                uint32_t ref[200], out[200];
+                MapRowU8_Scalar(in, count, table->data(), ref);
+                kernel.fn(in, count, table->data(), out);
+                mismatches += count - std::inner_product(ref, ref + count, out, size_t(0), std::plus<size_t>(), std::equal_to<uint32_t>());
+                samples += count;
+            }
+        }
+        std::cout << "  " << std::left << std::setw(20) << kernel.name << (mismatches ? "FAILED" : "OK") << " (" << mismatches << " of " << samples << " samples differ)\n";
+        all_ok &= (mismatches == 0);
+    }
+    return all_ok;
+}
+
+
+/** Compare coarse output sampled straight from the full-resolution source against sampling from the best pyramid level. */
+static void BenchmarkPyramid (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    std::cout << std::left << std::setw(8) << "source" << std::setw(14) << "output" << std::setw(7) << "level"
+              << std::right << std::setw(12) << "build ms" << std::setw(14) << "full-res ms" << std::setw(13) << "pyramid ms" << std::setw(10) << "speedup" << "\n";
+
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short src_dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+
+        for (unsigned short out_size = src_size/2; out_size >= 16; out_size /= 2) {
+            const unsigned short out_dims[3] = { out_size, out_size, out_size };
+            std::vector<uint8_t> out_buf(static_cast<size_t>(out_size)*out_size*out_size);
+            const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data());
+            const Cart3dGeom out_geom = MakeGeometry(GEOM_OBLIQUE);
+
+            // build time of the levels needed, measured on a fresh pyramid each time
+            unsigned int level = 0;
+            double build = MedianTime(reps, [&]() {
+                MipPyramid pyramid(src, SOURCE_GEOM);
+                level = pyramid.SelectLevel(out_geom, out.dims);
+                pyramid.Level(level, pool);
+            });
+            MipPyramid pyramid(src, SOURCE_GEOM);
+            pyramid.Level(level, pool);
+
+            double full = MedianTime(reps, [&]() { SampleFrame<uint8_t>(src, SOURCE_GEOM, out_geom, INTERPOLATION_LINEAR, pool, out); });
+            double coarse = MedianTime(reps, [&]() { SampleFrame(pyramid, out_geom, INTERPOLATION_LINEAR, pool, out); });
+
+            std::string out_str = std::to_string(out_size) + "^3 oblique";
+            std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(14) << out_str << std::setw(7) << level
+                      << std::right << std::fixed << std::setprecision(3) << std::setw(12) << 1e3*build << std::setw(14) << 1e3*full << std::setw(13) << 1e3*coarse
+                      << std::setprecision(2) << std::setw(9) << full/coarse << "x\n";
+        }
+    }
+}
+
+
+/** Compare row-major and bricked source layouts when resampling slice stacks of each orientation.
+    Cache misses are counted in a separate single-threaded pass, since the counter only covers the calling thread. */
+static void BenchmarkLayout (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    CacheMissCounter counter;
+    ThreadPool single(1);
+    if (!counter.Available())
+        std::cout << "(hardware cache-miss counters unavailable)\n\n";
+
+    const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+    const SliceOrientation orientations[] = { SLICE_XY, SLICE_XZ, SLICE_YZ, SLICE_OBLIQUE };
+
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, src_buf.data());
+
+        auto start = std::chrono::steady_clock::now();
+        const BrickedVolume bricked(src);
+        const double brick_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Source " << src_size << "^3: bricked in " << std::fixed << std::setprecision(1) << 1e3*brick_time << " ms (" << bricked.Size()/1e6 << " MB incl. padding)\n";
+        std::cout << std::left << std::setw(10) << "slices" << std::setw(9) << "interp" << std::setw(11) << "layout"
+                  << std::right << std::setw(11) << "ms/frame" << std::setw(11) << "Mvoxel/s" << std::setw(14) << "misses/kvox" << std::setw(10) << "speedup" << "\n";
+
+        std::vector<uint8_t> ref_buf(src_buf.size()), out_buf(src_buf.size());
+        const Image3dView ref = Image3dView::Packed(0, FORMAT_U8, dims, ref_buf.data());
+        const Image3dView out = Image3dView::Packed(0, FORMAT_U8, dims, out_buf.data());
+        const double voxels = static_cast<double>(out_buf.size());
+
+        for (SliceOrientation orientation : orientations) {
+            const Cart3dGeom out_geom = MakeSliceStack(orientation);
+            for (InterpolationMode interp : interps) {
+                const double row_time = MedianTime(reps, [&]() { SampleFrame<uint8_t>(src, SOURCE_GEOM, out_geom, interp, pool, ref); });
+                const double brick_time = MedianTime(reps, [&]() { SampleFrame<uint8_t>(bricked, SOURCE_GEOM, out_geom, interp, pool, out); });
+                const uint64_t row_misses = counter.Measure([&]() { SampleFrame<uint8_t>(src, SOURCE_GEOM, out_geom, interp, single, ref); });
+                const uint64_t brick_misses = counter.Measure([&]() { SampleFrame<uint8_t>(bricked, SOURCE_GEOM, out_geom, interp, single, out); });
+                const bool identical = (ref_buf == out_buf);
+
+                auto report = [&](const char * layout, double seconds, uint64_t misses) {
+                    std::cout << std::left << std::setw(10) << ToString(orientation) << std::setw(9) << ((interp == INTERPOLATION_LINEAR) ? "linear" : "nearest") << std::setw(11) << layout
+                              << std::right << std::fixed << std::setprecision(3) << std::setw(11) << 1e3*seconds
+                              << std::setprecision(1) << std::setw(11) << voxels/seconds*1e-6;
+                    if (counter.Available())
+                        std::cout << std::setprecision(2) << std::setw(14) << 1e3*misses/voxels;
+                    else
+                        std::cout << std::setw(14) << "n/a";
+                };
+                report("row-major", row_time, row_misses);
+                std::cout << "\n";
+                report("bricked", brick_time, brick_misses);
+                std::cout << std::setprecision(2) << std::setw(9) << row_time/brick_time << "x" << (identical ? "" : "  OUTPUT DIFFERS") << "\n";
+            }
+        }
+        std::cout << "\n";
+    }
+}
+
+/** Latency of single slices through the 2D slice path, compared to sampling them through the 3D path.
+    The 3D path is timed as half of a two-plane stack with the same plane spacing as the source. */
+static void BenchmarkSlices (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+    const SliceOrientation orientations[] = { SLICE_XY, SLICE_XZ, SLICE_YZ, SLICE_OBLIQUE };
+
+    std::cout << std::left << std::setw(8) << "source" << std::setw(10) << "slice" << std::setw(9) << "interp"
+              << std::right << std::setw(12) << "slice ms" << std::setw(12) << "3D ms" << std::setw(10) << "speedup" << "\n";
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, src_buf.data());
+
+        const unsigned short out_size = 512;
+        const unsigned short slice_dims[3] = { out_size, out_size, 1 }, stack_dims[3] = { out_size, out_size, 2 };
+        std::vector<uint8_t> out_buf(2*static_cast<size_t>(out_size)*out_size);
+
+        for (SliceOrientation orientation : orientations) {
+            // central slice, on a voxel center for the axis-aligned orientations
+            vec3f origin, dir1, dir2, dir3;
+            std::tie(origin, dir1, dir2, dir3) = FromCart3dGeom(MakeSliceStack(orientation));
+            const Cart3dGeom slice_geom = ToCart3dGeom(origin + ((src_size/2 + 0.5f)/src_size)*dir3, dir1, dir2, (2.0f/src_size)*dir3);
+
+            for (InterpolationMode interp : interps) {
+                const double slice = MedianTime(reps, [&]() { SampleFrame<uint8_t>(src, SOURCE_GEOM, slice_geom, interp, pool, Image3dView::Packed(0, FORMAT_U8, slice_dims, out_buf.data())); });
+                const double stack = MedianTime(reps, [&]() { SampleFrame<uint8_t>(src, SOURCE_GEOM, slice_geom, interp, pool, Image3dView::Packed(0, FORMAT_U8, stack_dims, out_buf.data())); });
+                std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(10) << ToString(orientation) << std::setw(9) << ((interp == INTERPOLATION_LINEAR) ? "linear" : "nearest")
+                          << std::right << std::fixed << std::setprecision(3) << std::setw(12) << 1e3*slice << std::setw(12) << 0.5e3*stack
+                          << std::setprecision(2) << std::setw(9) << 0.5*stack/slice << "x\n";
+            }
+        }
+    }
+}
+
+/** Compression ratio & cost of run-length compressed bricks, and the latency of resampling them with on-demand decompression.
+    "cold" requests start without decompressed bricks, whereas "warm" requests reuse the bricks decompressed by previous requests.
+    Output is compared against sampling the uncompressed bricked frame. */
+static void BenchmarkCompression (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    std::cout << std::left << std::setw(8) << "source" << std::setw(8) << "data" << std::right << std::setw(9) << "ratio" << std::setw(12) << "compress ms"
+              << std::setw(13) << "decode MB/s" << std::setw(9) << "output" << std::setw(10) << "touched" << std::setw(10) << "cold ms" << std::setw(10) << "warm ms" << std::setw(13) << "bricked ms" << "\n";
+
+    for (unsigned short src_size : src_sizes) {
+        const unsigned short dims[3] = { src_size, src_size, src_size };
+        const std::vector<uint8_t> sources[] = { MakeSource(src_size), MakeSectorSource(src_size) };
+        const char * names[] = { "noise", "sector" };
+        for (size_t s = 0; s < 2; ++s) {
+            const Image3dView src = Image3dView::Packed(0, FORMAT_U8, dims, const_cast<uint8_t*>(sources[s].data()));
+            const BrickedVolume bricked(src);
+            const double compress = MedianTime(reps, [&]() { CompressedVolume(src, pool); });
+            CompressedVolume compressed(src, pool);
+
+            std::vector<uint8_t> decoded_buf(sources[s].size());
+            const double decode = MedianTime(reps, [&]() { compressed.DecodeAll(pool, Image3dView::Packed(0, FORMAT_U8, dims, decoded_buf.data())); });
+            const bool roundtrip = (decoded_buf == sources[s]);
+
+            // single oblique slice & oblique volume
+            const unsigned short slice_dims[3] = { 512, 512, 1 };
+            const unsigned short * out_dims[] = { slice_dims, dims };
+            const Cart3dGeom out_geoms[] = { MakeGeometry(GEOM_PLANE), MakeGeometry(GEOM_OBLIQUE) };
+            for (size_t o = 0; o < 2; ++o) {
+                std::vector<uint8_t> ref_buf(static_cast<size_t>(out_dims[o][0])*out_dims[o][1]*out_dims[o][2]), out_buf(ref_buf.size());
+                const Image3dView ref = Image3dView::Packed(0, FORMAT_U8, out_dims[o], ref_buf.data());
+                const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims[o], out_buf.data());
+
+                const double cold = MedianTime(reps, [&]() {
+                    compressed.Discard();
+                    SampleFrame<uint8_t>(compressed, SOURCE_GEOM, out_geoms[o], INTERPOLATION_LINEAR, pool, out);
+                });
+                const double touched = static_cast<double>(compressed.DecodedSize())/compressed.UncompressedSize();
+                const double warm = MedianTime(reps, [&]() { SampleFrame<uint8_t>(compressed, SOURCE_GEOM, out_geoms[o], INTERPOLATION_LINEAR, pool, out); });
+                const double plain = MedianTime(reps, [&]() { SampleFrame<uint8_t>(bricked, SOURCE_GEOM, out_geoms[o], INTERPOLATION_LINEAR, pool, ref); });
+                const bool identical = roundtrip && (ref_buf == out_buf);
+
+                std::string out_str = (o == 0) ? "slice" : "volume";
+                std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(8) << names[s] << std::right << std::fixed
+                          << std::setprecision(1) << std::setw(8) << static_cast<double>(sources[s].size())/compressed.CompressedSize() << "x"
+                          << std::setprecision(2) << std::setw(12) << 1e3*compress
+                          << std::setprecision(0) << std::setw(13) << compressed.UncompressedSize()/decode*1e-6
+                          << std::setw(9) << out_str << std::setprecision(1) << std::setw(9) << 100*touched << "%"
+                          << std::setprecision(3) << std::setw(10) << 1e3*cold << std::setw(10) << 1e3*warm << std::setw(13) << 1e3*plain
+                          << (identical ? "" : "  OUTPUT DIFFERS") << "\n";
+            }
+        }
+    }
+}
+
+static const char * ToString (GeometryClass geom) {
+    switch (geom) {
+    case GEOMETRY_IDENTITY:     return "identity";
+    case GEOMETRY_AXIS_ALIGNED: return "aligned";
+    case GEOMETRY_SINGLE_SLICE: return "slice";
+    case GEOMETRY_OBLIQUE:      return "oblique";
+    case GEOMETRY_CLASS_COUNT:  break;
+    }
+    return "";
+}
+
+/** Copy of an 8bit source in another format, with gray levels scaled to the full 16bit range or to [0,1] for float. */
+template <class T>
+static std::vector<uint8_t> ConvertSource (const std::vector<uint8_t> & src) {
+    std::vector<uint8_t> buf(src.size()*sizeof(T));
+    T * out = reinterpret_cast<T*>(buf.data());
+    for (size_t i = 0; i < src.size(); ++i)
+        out[i] = std::numeric_limits<T>::is_integer ? static_cast<T>(src[i]*(std::numeric_limits<T>::max()/255)) : static_cast<T>(src[i]/255.0f);
+    return buf;
+}
+
+/** Throughput of the kernel picked from the kernel table for each format, interpolation & geometry, compared to the generic
+    row kernels (the oblique entry of the table). Output is compared against the row kernels. */
+static void BenchmarkFormats (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    const ImageFormat formats[] = { FORMAT_U8, FORMAT_U16, FORMAT_F32 };
+    const TestGeometry geometries[] = { GEOM_ALIGNED, GEOM_SCALED, GEOM_ZOOMOUT, GEOM_OBLIQUE, GEOM_PARTIAL, GEOM_PLANE };
+    const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+    const char * format_names[] = { "", "u8", "u16", "f32" };
+
+    std::cout << std::left << std::setw(8) << "source" << std::setw(8) << "format" << std::setw(9) << "geometry" << std::setw(9) << "interp" << std::setw(10) << "kernel"
+              << std::right << std::setw(12) << "kernel ms" << std::setw(10) << "rows ms" << std::setw(10) << "speedup" << "\n";
+    for (unsigned short src_size : src_sizes) {
+        const std::vector<uint8_t> src_u8 = MakeSource(src_size);
+        for (ImageFormat format : formats) {
+            const std::vector<uint8_t> src_buf = (format == FORMAT_U16) ? ConvertSource<uint16_t>(src_u8) : (format == FORMAT_F32) ? ConvertSource<float>(src_u8) : src_u8;
+            const unsigned short src_dims[3] = { src_size, src_size, src_size };
+            const Image3dView src = Image3dView::Packed(0, format, src_dims, const_cast<uint8_t*>(src_buf.data()));
+
+            for (TestGeometry geom_class : geometries) {
+                const Cart3dGeom out_geom = MakeGeometry(geom_class);
+                unsigned short out_dims[3] = { src_size, src_size, src_size };
+                if (geom_class == GEOM_PLANE) {
+                    out_dims[0] = out_dims[1] = static_cast<unsigned short>(4*src_size);
+                    out_dims[2] = 1;
+                }
+                const size_t out_size = static_cast<size_t>(out_dims[0])*out_dims[1]*out_dims[2]*ImageFormatSize(format);
+                std::vector<uint8_t> out_buf(out_size), ref_buf(out_size);
+                const Image3dView out = Image3dView::Packed(0, format, out_dims, out_buf.data());
+                const Image3dView ref = Image3dView::Packed(0, format, out_dims, ref_buf.data());
+                const VoxelTransform tr = OutputTransform(SOURCE_GEOM, src.dims, out_geom, out.dims);
+
+                for (InterpolationMode interp : interps) {
+                    const GeometryClass kernel_class = ClassifyGeometry(src, tr, interp, out);
+                    const FrameKernelFn kernel = SelectFrameKernel(format, interp, kernel_class);
+                    const FrameKernelFn rows = SelectFrameKernel(format, interp, GEOMETRY_OBLIQUE);
+                    const double kernel_time = MedianTime(reps, [&]() { kernel(src, tr, pool, out); });
+                    const double rows_time = MedianTime(reps, [&]() { rows(src, tr, pool, ref); });
+                    const bool identical = (out_buf == ref_buf);
+
+                    std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(8) << format_names[format] << std::setw(9) << ToString(geom_class)
+                              << std::setw(9) << ((interp == INTERPOLATION_LINEAR) ? "linear" : "nearest") << std::setw(10) << ToString(kernel_class)
+                              << std::right << std::fixed << std::setprecision(3) << std::setw(12) << 1e3*kernel_time << std::setw(10) << 1e3*rows_time
+                              << std::setprecision(2) << std::setw(9) << rows_time/kernel_time << "x" << (identical ? "" : "  OUTPUT DIFFERS") << "\n";
+                }
+            }
+        }
+    }
+}
+
+/** Color-mapped output written by the resampling pass, compared to resampling 8bit output followed by a separate client-side
+    color mapping pass (as done by TestViewer before Image3dAPI 1.11). Output is compared against the separate pass. */
+static void BenchmarkColorMap (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    const TestGeometry geometries[] = { GEOM_ALIGNED, GEOM_OBLIQUE, GEOM_PLANE };
+    const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+
+    std::cout << std::left << std::setw(8) << "source" << std::setw(9) << "geometry" << std::setw(9) << "interp" << std::setw(8) << "table"
+              << std::right << std::setw(12) << "fused ms" << std::setw(15) << "separate ms" << std::setw(10) << "speedup" << "\n";
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short src_dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+
+        for (TestGeometry geom_class : geometries) {
+            const Cart3dGeom out_geom = MakeGeometry(geom_class);
+            unsigned short out_dims[3] = { src_size, src_size, src_size };
+            if (geom_class == GEOM_PLANE) {
+                out_dims[0] = out_dims[1] = static_cast<unsigned short>(4*src_size);
+                out_dims[2] = 1;
+            }
+            std::vector<uint8_t> gray_buf(static_cast<size_t>(out_dims[0])*out_dims[1]*out_dims[2]);
+            const Image3dView gray = Image3dView::Packed(0, FORMAT_U8, out_dims, gray_buf.data());
+            std::vector<uint8_t> out_buf(Image3dView::Aligned(0, FORMAT_R8G8B8A8, out_dims, COLOR_ROW_ALIGNMENT, nullptr).Size()), ref_buf(out_buf.size());
+            const Image3dView out = Image3dView::Aligned(0, FORMAT_R8G8B8A8, out_dims, COLOR_ROW_ALIGNMENT, out_buf.data());
+            const Image3dView ref = Image3dView::Aligned(0, FORMAT_R8G8B8A8, out_dims, COLOR_ROW_ALIGNMENT, ref_buf.data());
+
+            for (bool tinted : { false, true }) {
+                const std::vector<uint32_t> table = MakeColorTable(tinted);
+                const ColorMap color_map(table.data(), FORMAT_R8G8B8A8);
+                for (InterpolationMode interp : interps) {
+                    const double fused_time = MedianTime(reps, [&]() { SampleFrame(src, SOURCE_GEOM, out_geom, interp, pool, out, &color_map); });
+                    const double separate_time = MedianTime(reps, [&]() {
+                        SampleFrame(src, SOURCE_GEOM, out_geom, interp, pool, gray);
+                        for (size_t row = 0; row < static_cast<size_t>(out_dims[1])*out_dims[2]; ++row)
+                            MapRowU8_Scalar(gray_buf.data() + row*gray.stride0, out_dims[0], table.data(), reinterpret_cast<uint32_t*>(ref_buf.data() + row*ref.stride0));
+                    });
+                    bool identical = true;
+                    for (size_t row = 0; row < static_cast<size_t>(out_dims[1])*out_dims[2]; ++row)
+                        identical &= std::equal(out_buf.data() + row*out.stride0, out_buf.data() + row*out.stride0 + 4*out_dims[0], ref_buf.data() + row*ref.stride0);
+
+                    std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(9) << ToString(geom_class)
+                              << std::setw(9) << ((interp == INTERPOLATION_LINEAR) ? "linear" : "nearest") << std::setw(8) << (tinted ? "tinted" : "gray")
+                              << std::right << std::fixed << std::setprecision(3) << std::setw(12) << 1e3*fused_time << std::setw(15) << 1e3*separate_time
+                              << std::setprecision(2) << std::setw(9) << separate_time/fused_time << "x" << (identical ? "" : "  OUTPUT DIFFERS") << "\n";
+                }
+            }
+        }
+    }
+}
+
+/** Scrubbing forth & back over a frame loop through a host-side FrameCache, with budgets that fit all or half of the frames,
+    compared to resampling on every request. Each run starts with an empty cache. Also checks that concurrent requests for the
+    same frames are collapsed into one load per frame. */
+static void BenchmarkCache (const std::vector<unsigned short> & src_sizes, ThreadPool & pool, unsigned int reps) {
+    typedef FrameCache<unsigned int, std::vector<uint8_t>> Cache;
+    const unsigned int FRAMES = 16, SWEEPS = 4;
+
+    std::cout << std::left << std::setw(8) << "source" << std::setw(10) << "budget"
+              << std::right << std::setw(14) << "ms/request" << std::setw(8) << "hits" << std::setw(12) << "evictions" << std::setw(10) << "speedup" << "\n";
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short src_dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+        const Cart3dGeom out_geom = MakeGeometry(GEOM_OBLIQUE);
+        const size_t frame_size = static_cast<size_t>(src_size)*src_size*src_size;
+
+        // frame index only selects the cache entry, since all frames are resampled from the same source
+        auto load = [&](size_t & bytes) {
+            auto frame = std::make_shared<std::vector<uint8_t>>(frame_size);
+            SampleFrame(src, SOURCE_GEOM, out_geom, INTERPOLATION_NEAREST, pool, Image3dView::Packed(0, FORMAT_U8, src_dims, frame->data()));
+            bytes = frame->size();
+            return std::shared_ptr<const std::vector<uint8_t>>(std::move(frame));
+        };
+
+        double uncached_time = 0;
+        for (unsigned int budget_frames : { 0u, FRAMES, FRAMES/2 }) {
+            Cache::Stats stats;
+            const double time = MedianTime(reps, [&]() {
+                Cache cache(budget_frames*frame_size);
+                for (unsigned int i = 0; i < SWEEPS*2*FRAMES; ++i) {
+                    const unsigned int pos = i % (2*FRAMES);
+                    const unsigned int frame = (pos < FRAMES) ? pos : 2*FRAMES - 1 - pos;
+                    if (budget_frames > 0)
+                        cache.Get(frame, load);
+                    else {
+                        size_t bytes = 0;
+                        load(bytes);
+                    }
+                }
+                stats = cache.GetStats();
+            }) / (SWEEPS*2*FRAMES);
+            if (budget_frames == 0)
+                uncached_time = time;
+
+            std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(10) << (budget_frames ? std::to_string(budget_frames) + " frames" : "uncached")
+                      << std::right << std::fixed << std::setprecision(3) << std::setw(14) << 1e3*time << std::setw(8) << stats.hits << std::setw(12) << stats.evictions
+                      << std::setprecision(2) << std::setw(9) << uncached_time/time << "x\n";
+        }
+
+        // concurrent viewers requesting the same frames should only trigger one load per frame
+        Cache cache(FRAMES*frame_size);
+        std::vector<std::thread> viewers;
+        for (unsigned int t = 0; t < 4; ++t) {
+            viewers.emplace_back([&]() {
+                for (unsigned int frame = 0; frame < FRAMES; ++frame)
+                    cache.Get(frame, load);
+            });
+        }
+        for (std::thread & viewer : viewers)
+            viewer.join();
+        const Cache::Stats stats = cache.GetStats();
+        std::cout << "  4 concurrent viewers: " << stats.misses << " loads, " << stats.collapsed << " collapsed, " << stats.hits << " hits"
+                  << ((stats.misses == FRAMES) ? "" : "  UNEXPECTED LOAD COUNT") << "\n";
+    }
+}
+
+struct Options {
+    unsigned int warmup  = 1;
+    unsigned int reps    = 5;
+    unsigned int threads = ThreadPool::DefaultThreadCount();
+    bool         quick   = false; ///< reduced sweep
+};
+
+static unsigned int ParseCount (int argc, char * argv[], int & i) {
+    if (i + 1 >= argc)
+        throw std::runtime_error(std::string("missing value for ") + argv[i]);
+    return static_cast<unsigned int>(std::stoul(argv[++i]));
+}
+
+
+int main (int argc, char * argv[]) {
+    Options opt;
+    bool verify = false;
+    bool pyramid = false;
+    bool layout = false;
+    bool slices = false;
+    bool compress = false;
+    bool formats = false;
+    bool color = false;
+    bool cache = false;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-warmup")
+                opt.warmup = ParseCount(argc, argv, i);
+            else if (arg == "-reps")
+                opt.reps = std::max(1u, ParseCount(argc, argv, i));
+            else if (arg == "-threads")
+                opt.threads = ParseCount(argc, argv, i);
+            else if (arg == "-quick")
+                opt.quick = true;
+            else if (arg == "-verify")
+                verify = true;
+            else if (arg == "-pyramid")
+                pyramid = true;
+            else if (arg == "-layout")
+                layout = true;
+            else if (arg == "-slice")
+                slices = true;
+            else if (arg == "-compress")
+                compress = true;
+            else if (arg == "-formats")
+                formats = true;
+            else if (arg == "-color")
+                color = true;
+            else if (arg == "-cache")
+                cache = true;
+            else
+                throw std::runtime_error("unknown argument " + arg);
+        }
+    } catch (const std::exception & err) {
+        std::cerr << "ERROR: " << err.what() << "\n";
+        std::cerr << "Usage:\n";
+        std::cerr << "ResampleBenchmark [-warmup N] [-reps N] [-threads N] [-quick] [-verify] [-pyramid] [-layout] [-slice] [-compress] [-formats] [-color] [-cache]" << std::endl;
+        return -1;
+    }
+
+    if (verify) {
+        std::cout << "Verifying SIMD kernels against scalar reference:\n";
+        return VerifyKernels() ? 0 : 1;
+    }
+
+    ThreadPool pool(opt.threads);
+    std::cout << "Threads: " << pool.ThreadCount() << ", warmup: " << opt.warmup << ", repetitions: " << opt.reps << " (median reported)\n\n";
+
+    const std::vector<unsigned short> src_sizes = opt.quick ? std::vector<unsigned short>{ 128 } : std::vector<unsigned short>{ 64, 128, 256 };
+    if (pyramid) {
+        BenchmarkPyramid(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (slices) {
+        BenchmarkSlices(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (compress) {
+        BenchmarkCompression(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (formats) {
+        BenchmarkFormats(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (color) {
+        BenchmarkColorMap(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (cache) {
+        BenchmarkCache(src_sizes, pool, opt.reps);
+        return 0;
+    }
+    if (layout) {
+        // larger sources, so that the row-major footprint of strided slices exceeds the caches
+        BenchmarkLayout(opt.quick ? std::vector<unsigned short>{ 256 } : std::vector<unsigned short>{ 128, 256, 512 }, pool, opt.reps);
+        return 0;
+    }
+
+    const std::vector<unsigned short> out_sizes = opt.quick ? std::vector<unsigned short>{ 64, 128 } : std::vector<unsigned short>{ 64, 128, 256, 512 };
+    const TestGeometry geometries[] = { GEOM_ALIGNED, GEOM_SCALED, GEOM_ZOOMOUT, GEOM_OBLIQUE, GEOM_PARTIAL, GEOM_PLANE };
+    const InterpolationMode interps[] = { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR };
+
+    std::cout << std::left << std::setw(8) << "source" << std::setw(9) << "geometry" << std::setw(14) << "output" << std::setw(9) << "interp"
+              << std::right << std::setw(11) << "ms/frame" << std::setw(11) << "Mvoxel/s" << std::setw(10) << "ns/voxel" << std::setw(10) << "MB/s" << "\n";
+
+    for (unsigned short src_size : src_sizes) {
+        std::vector<uint8_t> src_buf = MakeSource(src_size);
+        const unsigned short src_dims[3] = { src_size, src_size, src_size };
+        const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+
+        for (TestGeometry geom_class : geometries) {
+            const Cart3dGeom out_geom = MakeGeometry(geom_class);
+
+            for (unsigned short out_size : out_sizes) {
+                // single planes are swept at 4x the edge length, to get comparable voxel counts
+                unsigned short out_dims[3] = { out_size, out_size, out_size };
+                if (geom_class == GEOM_PLANE) {
+                    out_dims[0] = out_dims[1] = static_cast<unsigned short>(std::min(4*out_size, 4096));
+                    out_dims[2] = 1;
+                }
+                std::vector<uint8_t> out_buf(static_cast<size_t>(out_dims[0])*out_dims[1]*out_dims[2]);
+                const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data());
+
+                for (InterpolationMode interp : interps) {
+                    for (unsigned int i = 0; i < opt.warmup; ++i)
+                        SampleFrame<uint8_t>(src, SOURCE_GEOM, out_geom, interp, pool, out);
+
+                    std::vector<double> times; // [seconds]
+                    for (unsigned int i = 0; i < opt.reps; ++i) {
+                        auto start = std::chrono::steady_clock::now();
+                        SampleFrame<uint8_t>(src, SOURCE_GEOM, out_geom, interp, pool, out);
+                        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                    }
+                    std::sort(times.begin(), times.end());
+                    const double median = times[times.size()/2];
+                    const double voxels = static_cast<double>(out_buf.size());
+
+                    std::string out_str = std::to_string(out_dims[0]) + "x" + std::to_string(out_dims[1]) + "x" + std::to_string(out_dims[2]);
+                    std::cout << std::left << std::setw(8) << (std::to_string(src_size) + "^3") << std::setw(9) << ToString(geom_class) << std::setw(14) << out_str
+                              << std::setw(9) << ((interp == INTERPOLATION_LINEAR) ? "linear" : "nearest") << std::right << std::fixed
+                              << std::setprecision(3) << std::setw(11) << 1e3*median
+                              << std::setprecision(1) << std::setw(11) << voxels/median*1e-6
+                              << std::setprecision(3) << std::setw(10) << median/voxels*1e9
+                              << std::setprecision(1) << std::setw(10) << voxels*sizeof(uint8_t)/median*1e-6 << "\n";
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -1,12 +1,18 @@
 #include "../Image3dAPI/ComSupport.hpp"
 #include "../Image3dAPI/IImage3d.h"
 #include "../Image3dAPI/RegistryCheck.hpp"
+#include "../Image3dAPI/Image3dSourceCache.hpp"
+#include "../Image3dCore/SharedFrameRing.hpp"
 #include "LowIntegrity.hpp"
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <set>
+#include <stdexcept>
 #include <thread>
+#include <vector>
 
 
 class PerfTimer {
@@ -31,6 +37,40 @@ private:
 };
 
 
+/** Sum of all bytes in a buffer, to make sure that frame data is actually read. */
+static uint64_t Checksum (const uint8_t * data, size_t size) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; ++i)
+        sum += data[i];
+    return sum;
+}
+
+/** Follow a live acquisition like a live viewer would: Wait for new frames, and retrieve the most recent one. */
+static void FollowLiveSource (IImage3dSource8 & source, Cart3dGeom bbox, bool profile) {
+    const unsigned int MAX_FRAMES = 100;
+    unsigned int known = 0, first = 0, count = 0, received = 0, skipped = 0;
+    {
+        PerfTimer timer("WaitForFrames+GetFrame of live frames", profile);
+        while (received < MAX_FRAMES) {
+            HRESULT hr = source.WaitForFrames(known, 5000, &first, &count);
+            if (hr == S_FALSE)
+                break; // acquisition finished
+            if (hr == E_PENDING)
+                throw std::runtime_error("no new live frames within 5 seconds");
+            CHECK(hr);
+
+            skipped += count - 1 - known;
+            known = count;
+
+            unsigned short max_res[] = { 128, 128, 128 };
+            Image3d data;
+            CHECK(source.GetFrame(count - 1, bbox, max_res, &data));
+            ++received;
+        }
+    }
+    std::cout << "Live frames received: " << received << ", skipped: " << skipped << ", available: [" << first << ", " << count << ")\n";
+}
+
 void ParseSource (IImage3dSource & source, bool verbose, bool profile) {
     CComSafeArray<uint32_t> color_map;
     {
@@ -81,6 +121,16 @@ void ParseSource (IImage3dSource & source, bool verbose, bool profile) {
         }
     }
 
+    {
+        // live sources only keep the most recent frames
+        CComQIPtr<IImage3dSource8> source8(&source);
+        unsigned int first = 0, count = 0;
+        if (source8 && ((source8->WaitForFrames(frame_count, 0, &first, &count) != S_FALSE) || (first > 0))) {
+            FollowLiveSource(*source8, bbox, profile);
+            return;
+        }
+    }
+
     for (unsigned int frame = 0; frame < frame_count; ++frame) {
         unsigned short max_res[] = { 64, 64, 64 };
         if (profile) {
@@ -99,6 +149,306 @@ void ParseSource (IImage3dSource & source, bool verbose, bool profile) {
         if (frame == frame_count-1)
             std::cout << "Last frame time: " << data.time << "\n";
     }
+
+    if (profile) {
+        // compare the cost of trilinear against nearest-neighbour interpolation
+        CComQIPtr<IImage3dSource2> source2(&source);
+        if (source2) {
+            unsigned short max_res[] = { 128, 128, 128 };
+            for (InterpolationMode interp : { INTERPOLATION_NEAREST, INTERPOLATION_LINEAR }) {
+                PerfTimer timer((interp == INTERPOLATION_LINEAR) ? "GetFrameInterpolated(linear) of all frames" : "GetFrameInterpolated(nearest) of all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source2->GetFrameInterpolated(frame, bbox, max_res, interp, &data));
+                }
+            }
+        }
+
+        // scrubbing forth & back through a host-side cache, where the second pass should be served without calling the loader
+        {
+            unsigned short max_res[] = { 128, 128, 128 };
+            CComPtr<Image3dSourceCache> cache = Image3dSourceCache::Create(&source, 256*1024*1024);
+            {
+                PerfTimer timer("GetFrame through Image3dSourceCache, forth & back over all frames", profile);
+                for (unsigned int i = 0; i < 2*frame_count; ++i) {
+                    const unsigned int frame = (i < frame_count) ? i : 2*frame_count - 1 - i;
+                    Image3d data;
+                    CHECK(cache->GetFrame(frame, bbox, max_res, &data));
+                }
+            }
+            Image3dSourceCache::Cache::Stats stats = cache->GetStats();
+            std::cout << "Frame cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, " << stats.bytes/1024 << "kB cached\n";
+        }
+
+        // cine playback with buffer recycling (steady state should not allocate)
+        CComQIPtr<IImage3dSource3> source3(&source);
+        if (source3) {
+            unsigned short max_res[] = { 128, 128, 128 };
+            unsigned int alloc_before = 0, reuse_before = 0;
+            bool has_stats = SUCCEEDED(source3->GetBufferStats(&alloc_before, &reuse_before)); // optional
+            {
+                PerfTimer timer("GetFrame+RecycleFrame of all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source3->GetFrame(frame, bbox, max_res, &data));
+                    CHECK(source3->RecycleFrame(&data));
+                }
+            }
+            unsigned int alloc_after = 0, reuse_after = 0;
+            if (has_stats && SUCCEEDED(source3->GetBufferStats(&alloc_after, &reuse_after)))
+                std::cout << "Frame buffers during recycled playback: " << (alloc_after - alloc_before) << " allocated, " << (reuse_after - reuse_before) << " reused\n";
+        }
+
+        // whole loop in a single call (compare against GetFrameInterpolated(nearest) of all frames)
+        CComQIPtr<IImage3dSource4> source4(&source);
+        if (source4 && (frame_count > 0)) {
+            unsigned short max_res[] = { 128, 128, 128 };
+            PerfTimer timer("GetFrames of all frames", profile);
+            Image3dSeries data;
+            CHECK(source4->GetFrames(0, frame_count, bbox, max_res, INTERPOLATION_NEAREST, &data));
+        }
+
+        // three orthogonal center slices per frame, through separate GetFrame calls and through a single GetSlices call
+        CComQIPtr<IImage3dSource5> source5(&source);
+        if (source5) {
+            Cart3dGeom planes[3] = { bbox, bbox, bbox };
+            for (unsigned int i = 0; i < 3; ++i) {
+                float * geom = &planes[i].origin_x; // origin, dir1, dir2 & dir3
+                const unsigned int dropped = 3 - i; // dir3, dir2 & dir1 for the XY, XZ & ZY planes
+                for (unsigned int c = 0; c < 3; ++c) {
+                    geom[c] += 0.5f*geom[3*dropped + c]; // move origin to center along the dropped axis
+                    geom[3*dropped + c] = geom[9 + c];   // replace dropped axis by dir3
+                    geom[9 + c] = 0;
+                }
+            }
+
+            unsigned short slice_res[] = { 256, 256, 1 };
+            {
+                PerfTimer timer("GetFrame of 3 slices for all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    for (const Cart3dGeom & plane : planes) {
+                        Image3d data;
+                        CHECK(source5->GetFrame(frame, plane, slice_res, &data));
+                    }
+                }
+            }
+            {
+                CComSafeArray<float> plane_arr = ConvertToSafeArray(&planes[0].origin_x, 3*12);
+                PerfTimer timer("GetSlices of 3 slices for all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source5->GetSlices(frame, plane_arr, slice_res, INTERPOLATION_NEAREST, &data));
+                }
+            }
+
+            // same slices as display-ready BGRA pixels (compare against GetSlices followed by client-side color mapping)
+            CComQIPtr<IImage3dSource9> source9(&source);
+            if (source9) {
+                CComSafeArray<float> plane_arr = ConvertToSafeArray(&planes[0].origin_x, 3*12);
+                PerfTimer timer("GetSlicesColorMapped of 3 slices for all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source9->GetSlicesColorMapped(frame, plane_arr, slice_res, INTERPOLATION_NEAREST, FORMAT_B8G8R8A8, &data));
+                }
+            }
+        }
+
+        // frame transfer through marshalled SAFEARRAY buffers compared against a shared-memory ring (read & checksum every frame)
+        CComQIPtr<IImage3dSource6> source6(&source);
+        if (source6) {
+            unsigned short max_res[] = { 128, 128, 128 };
+            uint64_t checksum[2] = {};
+            {
+                PerfTimer timer("GetFrame with checksum of all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source6->GetFrame(frame, bbox, max_res, &data));
+                    checksum[0] += Checksum(static_cast<const uint8_t*>(data.data->pvData), data.stride1*data.dims[2]);
+                }
+            }
+
+            CComBSTR ring_name;
+            CHECK(source6->CreateSharedRing(4, max_res[0]*max_res[1]*max_res[2], &ring_name));
+            SharedFrameRing ring(std::string(CW2A(ring_name)));
+            {
+                PerfTimer timer("GetFrameShared with checksum of all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3dShared data = {};
+                    CHECK(source6->GetFrameShared(frame, bbox, max_res, INTERPOLATION_NEAREST, &data));
+                    const uint8_t * buffer = ring.Data(data.offset, static_cast<size_t>(data.stride1)*data.dims[2]);
+                    if (!buffer)
+                        throw std::runtime_error("GetFrameShared returned frame outside shared ring");
+                    checksum[1] += Checksum(buffer, data.stride1*data.dims[2]);
+                    if (!ring.IsCurrent(data.offset, data.sequence))
+                        throw std::runtime_error("shared ring slot overwritten while reading");
+                }
+            }
+            if (checksum[0] != checksum[1])
+                throw std::runtime_error("GetFrameShared mismatch against GetFrame");
+        }
+
+        // cine playback with the next frames prefetched in the background, and all frames requested up-front asynchronously
+        CComQIPtr<IImage3dSource7> source7(&source);
+        if (source7 && (frame_count > 0)) {
+            unsigned short max_res[] = { 128, 128, 128 };
+            {
+                PerfTimer timer("GetFrame+PrefetchFrames of all frames", profile);
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source7->GetFrame(frame, bbox, max_res, &data));
+                    CHECK(source7->PrefetchFrames(frame + 1, 2, bbox, max_res, INTERPOLATION_NEAREST));
+                }
+                CHECK(source7->PrefetchFrames(0, 0, bbox, max_res, INTERPOLATION_NEAREST)); // stop prefetching
+            }
+            {
+                PerfTimer timer("BeginGetFrame+EndGetFrame of all frames", profile);
+                std::vector<unsigned int> requests(frame_count);
+                for (unsigned int frame = 0; frame < frame_count; ++frame)
+                    CHECK(source7->BeginGetFrame(frame, bbox, max_res, INTERPOLATION_NEAREST, &requests[frame]));
+                for (unsigned int frame = 0; frame < frame_count; ++frame) {
+                    Image3d data;
+                    CHECK(source7->EndGetFrame(requests[frame], 0xFFFFFFFF, &data));
+                }
+            }
+        }
+    }
+}
+
+/** Fake image source with FRAMES tiny frames, that counts and delays GetFrame calls. For testing Image3dSourceCache without a loader. */
+class ATL_NO_VTABLE CountingSource :
+    public CComObjectRootEx<CComMultiThreadModel>,
+    public IImage3dSource {
+public:
+    static const unsigned int FRAMES = 4;
+
+    std::atomic<unsigned int> calls{0}; ///< GetFrame calls
+
+    HRESULT STDMETHODCALLTYPE GetFrameCount(/*out*/unsigned int *size) override {
+        *size = FRAMES;
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetFrameTimes(/*out*/SAFEARRAY * *frame_times) override {
+        CComSafeArray<double> times(FRAMES);
+        for (unsigned int i = 0; i < FRAMES; ++i)
+            times[static_cast<int>(i)] = i;
+        *frame_times = times.Detach();
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetFrame(unsigned int index, Cart3dGeom /*geom*/, unsigned short max_res[3], /*out*/Image3d *data) override {
+        ++calls;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50)); // slow load, so that concurrent requests overlap
+
+        Image3d img;
+        img.time = index;
+        img.format = FORMAT_U8;
+        for (size_t i = 0; i < 3; ++i)
+            img.dims[i] = max_res[i] ? max_res[i] : 1;
+        img.stride0 = img.dims[0];
+        img.stride1 = img.dims[1]*img.stride0;
+        img.data = SafeArrayCreateVector(VT_UI1, 0, img.stride1*img.dims[2]);
+        if (!img.data)
+            return E_OUTOFMEMORY;
+        memset(img.data->pvData, static_cast<int>(index), img.stride1*img.dims[2]);
+        *data = std::move(img);
+        return S_OK;
+    }
+    HRESULT STDMETHODCALLTYPE GetBoundingBox(/*out*/Cart3dGeom * /*geom*/) override {
+        return E_NOTIMPL;
+    }
+    HRESULT STDMETHODCALLTYPE GetColorMap(/*out*/SAFEARRAY ** /*map*/) override {
+        return E_NOTIMPL;
+    }
+    HRESULT STDMETHODCALLTYPE GetECG(/*out*/EcgSeries * /*ecg*/) override {
+        return E_NOTIMPL;
+    }
+    HRESULT STDMETHODCALLTYPE GetProbeInfo(/*out*/ProbeInfo * /*probe*/) override {
+        return E_NOTIMPL;
+    }
+    HRESULT STDMETHODCALLTYPE GetSopInstanceUID(/*out*/BSTR * /*uid_str*/) override {
+        return E_NOTIMPL;
+    }
+
+    BEGIN_COM_MAP(CountingSource)
+        COM_INTERFACE_ENTRY(IImage3dSource)
+    END_COM_MAP()
+};
+
+/** Verify that Image3dSourceCache collapses concurrent identical requests into one loader call, and keeps its byte budget.
+    Throws std::runtime_error on failure. */
+static void TestSourceCache () {
+    auto expect = [](bool ok, const char * what) {
+        if (!ok)
+            throw std::runtime_error(std::string("Image3dSourceCache: ") + what);
+    };
+    const Cart3dGeom geom = {};
+    const size_t frame_bytes = sizeof(Image3d) + 16*16*16; // as accounted by Image3dSourceCache
+
+    CComPtr<CountingSource> source = CreateLocalInstance<CountingSource>();
+    CComPtr<Image3dSourceCache> cache = Image3dSourceCache::Create(source, 2*frame_bytes);
+
+    // N concurrent identical requests
+    const unsigned int THREADS = 8;
+    std::atomic<unsigned int> failures(0);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < THREADS; ++i) {
+        threads.emplace_back([&]() {
+            unsigned short max_res[] = { 16, 16, 16 };
+            Image3d data;
+            if (FAILED(cache->GetFrame(1, geom, max_res, &data)) || (static_cast<const uint8_t*>(data.data->pvData)[0] != 1))
+                ++failures;
+        });
+    }
+    for (std::thread & thread : threads)
+        thread.join();
+    expect(failures == 0, "concurrent GetFrame failed");
+    expect(source->calls == 1, "concurrent identical GetFrame calls not collapsed into one loader call");
+
+    // exceed the budget of two frames
+    for (unsigned int frame = 0; frame < CountingSource::FRAMES; ++frame) {
+        unsigned short max_res[] = { 16, 16, 16 };
+        Image3d data;
+        CHECK(cache->GetFrame(frame, geom, max_res, &data));
+    }
+    Image3dSourceCache::Cache::Stats stats = cache->GetStats();
+    expect(source->calls == CountingSource::FRAMES, "cached frame not served from the cache");
+    expect((stats.evictions > 0) && (stats.bytes <= 2*frame_bytes), "byte budget exceeded");
+
+    std::cout << "Image3dSourceCache: " << THREADS << " concurrent requests served by 1 loader call, " << stats.evictions << " evictions within budget\n";
+}
+
+/** Print the loader-side performance counters, if supported by the loader. */
+static void PrintStats (IImage3dSource & source) {
+    CComQIPtr<IImage3dStats> stats(&source);
+    if (!stats)
+        return;
+
+    const std::pair<Image3dMethod, const char*> methods[] = {
+        { METHOD_GET_FRAME,               "GetFrame" },
+        { METHOD_GET_FRAMES,              "GetFrames" },
+        { METHOD_GET_SLICES,              "GetSlices" },
+        { METHOD_GET_FRAME_SHARED,        "GetFrameShared" },
+        { METHOD_END_GET_FRAME,           "EndGetFrame" },
+        { METHOD_GET_FRAME_COLOR_MAPPED,  "GetFrameColorMapped" },
+        { METHOD_GET_SLICES_COLOR_MAPPED, "GetSlicesColorMapped" },
+        { METHOD_BEGIN_GET_FRAME,         "BeginGetFrame" },
+        { METHOD_PREFETCH_FRAMES,         "PrefetchFrames" },
+    };
+    std::cout << "Loader statistics:\n";
+    std::cout << "  " << std::left << std::setw(22) << "method" << std::right << std::setw(8) << "calls"
+              << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << "\n";
+    for (const auto & method : methods) {
+        MethodStats ms = {};
+        CHECK(stats->GetMethodStats(method.first, &ms));
+        if (ms.calls == 0)
+            continue;
+        std::cout << "  " << std::left << std::setw(22) << method.second << std::right << std::setw(8) << ms.calls << std::fixed << std::setprecision(2)
+                  << std::setw(10) << ms.latency_p50 << std::setw(10) << ms.latency_p95 << std::setw(10) << ms.latency_p99 << std::setw(10) << ms.latency_max << "\n";
+    }
+
+    ResourceStats rs = {};
+    CHECK(stats->GetResourceStats(&rs));
+    std::cout << "  Produced " << rs.bytes_produced/(1024*1024) << "MB in " << rs.voxels_resampled << " resampled voxels, peak frame memory "
+              << rs.peak_frame_memory/1024 << "kB, frame buffers " << rs.buffer_allocations << " allocated & " << rs.buffer_reuses << " reused\n";
 }
 
 CComPtr<IImage3dFileLoader> CreateLoader(const CComBSTR &progid, const CLSID clsid, const bool profile)
@@ -174,6 +524,9 @@ int wmain(int argc, wchar_t *argv[]) {
 
     ComInitialize com(COINIT_APARTMENTTHREADED);
 
+    // host-side cache test against a fake source, independent of the loader
+    TestSourceCache();
+
     CLSID clsid = {};
     if (FAILED(CLSIDFromProgID(progid, &clsid))) {
         std::wcerr << L"ERRORR: Unknown progid " << progid.m_str << L"\n";
@@ -258,6 +611,8 @@ int wmain(int argc, wchar_t *argv[]) {
         PerfTimer timer("ParseSource", profile);
         ParseSource(*source, verbose, profile);
     }
+    if (profile)
+        PrintStats(*source);
 
     return 0;
 }
@@ -0,0 +1,233 @@
+/* Benchmark of live frame streaming through a LiveFrameRing.
+A producer thread acquires frames at a fixed volume rate, while consumer threads wait for new frames and resample the most recent one,
+as a live 4D viewer would. Reports producer write time, consumer wake-up latency after publishing, and end-to-end latency from start of
+acquisition until the resampled frame is ready. Every consumed frame is checked against the frame index stamped by the producer. */
+#include "Resample.hpp"
+#include "LiveFrameRing.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/** Source volume geometry (same as DummyLoader). Also used as output geometry. */
+static const Cart3dGeom SOURCE_GEOM = { -0.1f, 0,     -0.075f,// origin
+                                         0.20f,0,      0,     // dir1 (width)
+                                         0,    0.10f,  0,     // dir2 (depth)
+                                         0,    0,      0.15f};// dir3 (elevation)
+
+using Clock = std::chrono::steady_clock;
+
+
+struct Options {
+    unsigned short src_size  = 128;
+    unsigned short out_size  = 128;
+    double         seconds   = 3;
+    unsigned int   window    = 8;
+    unsigned int   consumers = 1;
+    bool           poll      = false; ///< poll every millisecond instead of waiting
+    std::vector<unsigned int> rates = { 30, 45, 60 }; ///< [volumes/second]
+    unsigned int   threads   = ThreadPool::DefaultThreadCount();
+};
+
+
+/** Checkerboard with 8-voxel squares and a gradient (same as TransportBenchmark). */
+static std::vector<uint8_t> MakeSource (unsigned short size) {
+    std::vector<uint8_t> buf(static_cast<size_t>(size)*size*size);
+    for (size_t z = 0; z < size; ++z)
+        for (size_t y = 0; y < size; ++y)
+            for (size_t x = 0; x < size; ++x)
+                buf[x + y*size + z*size*size] = static_cast<uint8_t>(((((x/8) ^ (y/8) ^ (z/8)) & 1) ? 192 : 64) + x + y + z);
+    return buf;
+}
+
+static double Seconds (Clock::time_point start, Clock::time_point time) {
+    return std::chrono::duration<double>(time - start).count();
+}
+
+/** Percentile of unsorted samples [ms]. */
+static double Percentile (std::vector<double> samples, double fraction) {
+    if (samples.empty())
+        return 0;
+    const size_t idx = std::min(samples.size() - 1, static_cast<size_t>(fraction*samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return 1e3*samples[idx];
+}
+
+
+/** Statistics of one run. */
+struct Stats {
+    unsigned int        produced = 0;
+    unsigned int        dropped  = 0; ///< all slots being read
+    unsigned int        consumed = 0;
+    unsigned int        skipped  = 0; ///< superseded by a newer frame before the consumer got to it
+    unsigned int        evicted  = 0; ///< overwritten before the consumer could acquire it
+    std::vector<double> write;        ///< producer write time [s]
+    std::vector<double> wake;         ///< publish -> consumer acquires frame [s]
+    std::vector<double> latency;      ///< start of acquisition -> resampled frame ready [s]
+};
+
+
+/** Consumer thread: wait for new frames, and resample the most recent one. */
+static void Consume (const Options & opt, const LiveFrameRing & ring, const std::vector<double> & published, Clock::time_point start, ThreadPool & pool, Stats & stats) {
+    const unsigned short out_dims[3] = { opt.out_size, opt.out_size, opt.out_size };
+    std::vector<uint8_t> out_buf(static_cast<size_t>(opt.out_size)*opt.out_size*opt.out_size);
+    const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data());
+    unsigned int known = 0;
+    for (;;) {
+        unsigned int count = 0;
+        if (opt.poll) {
+            while (((count = ring.Count()) <= known) && !ring.Closed())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } else {
+            count = ring.Wait(known, 0xFFFFFFFF);
+        }
+        if (count <= known)
+            break; // closed
+
+        // only the most recent frame is displayed
+        const unsigned int index = count - 1;
+        stats.skipped += index - known;
+        known = count;
+        LiveFrameRing::Frame frame;
+        if (!ring.Acquire(index, frame)) {
+            ++stats.evicted;
+            continue;
+        }
+        stats.wake.push_back(Seconds(start, Clock::now()) - published[index]);
+
+        uint32_t stamp = 0;
+        memcpy(&stamp, frame.view.data, sizeof(stamp));
+        SampleFrame<uint8_t>(frame.view, SOURCE_GEOM, SOURCE_GEOM, INTERPOLATION_LINEAR, pool, out);
+        ring.Release(frame);
+        if (stamp != index)
+            throw std::runtime_error("consumed frame doesn't match its index");
+        stats.latency.push_back(Seconds(start, Clock::now()) - frame.view.time);
+        ++stats.consumed;
+    }
+}
+
+
+static Stats Run (const Options & opt, unsigned int rate, const Image3dView & src, ThreadPool & pool) {
+    const unsigned int frames = static_cast<unsigned int>(opt.seconds*rate);
+    LiveFrameRing ring(FORMAT_U8, src.dims, opt.window);
+    std::vector<double> published(frames, 0); // publish time of each frame [s] (written before publishing)
+    Stats stats;
+    std::string error;
+    std::mutex stats_mutex; // also protects "error"
+    const Clock::time_point start = Clock::now();
+
+    std::vector<std::thread> consumers;
+    for (unsigned int c = 0; c < opt.consumers; ++c) {
+        consumers.emplace_back([&] {
+            Stats local;
+            try {
+                Consume(opt, ring, published, start, pool, local);
+            } catch (const std::exception & err) {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                error = err.what();
+            }
+
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats.consumed += local.consumed;
+            stats.skipped += local.skipped;
+            stats.evicted += local.evicted;
+            stats.wake.insert(stats.wake.end(), local.wake.begin(), local.wake.end());
+            stats.latency.insert(stats.latency.end(), local.latency.begin(), local.latency.end());
+        });
+    }
+
+    // producer: copy the source frame at every acquisition time, stamped with the frame index
+    for (unsigned int i = 0; i < frames; ++i) {
+        std::this_thread::sleep_until(start + std::chrono::microseconds(1000000ull*i/rate));
+        const Clock::time_point begin = Clock::now();
+        const Image3dView view = ring.BeginWrite(Seconds(start, begin));
+        if (!view.data) {
+            ++stats.dropped;
+            continue;
+        }
+        const unsigned int index = ring.Count();
+        memcpy(view.data, src.data, src.Size());
+        memcpy(view.data, &index, sizeof(index));
+        stats.write.push_back(Seconds(begin, Clock::now()));
+        published[index] = Seconds(start, Clock::now());
+        ring.EndWrite(LiveFrameRing::EcgChunk());
+        ++stats.produced;
+    }
+    ring.Close();
+
+    for (std::thread & consumer : consumers)
+        consumer.join();
+    if (!error.empty())
+        throw std::runtime_error(error);
+    return stats;
+}
+
+
+static unsigned int ParseCount (int argc, char * argv[], int & i) {
+    if (i + 1 >= argc)
+        throw std::runtime_error(std::string("missing value for ") + argv[i]);
+    return static_cast<unsigned int>(std::stoul(argv[++i]));
+}
+
+
+int main (int argc, char * argv[]) {
+    Options opt;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-source")
+                opt.src_size = static_cast<unsigned short>(std::min(std::max(2u, ParseCount(argc, argv, i)), 1024u));
+            else if (arg == "-output")
+                opt.out_size = static_cast<unsigned short>(std::min(std::max(1u, ParseCount(argc, argv, i)), 1024u));
+            else if (arg == "-seconds")
+                opt.seconds = std::max(1u, ParseCount(argc, argv, i));
+            else if (arg == "-window")
+                opt.window = std::max(1u, ParseCount(argc, argv, i));
+            else if (arg == "-consumers")
+                opt.consumers = std::max(1u, ParseCount(argc, argv, i));
+            else if (arg == "-rate")
+                opt.rates = { std::min(std::max(1u, ParseCount(argc, argv, i)), 1000u) };
+            else if (arg == "-poll")
+                opt.poll = true;
+            else if (arg == "-threads")
+                opt.threads = ParseCount(argc, argv, i);
+            else
+                throw std::runtime_error("unknown argument " + arg);
+        }
+    } catch (const std::exception & err) {
+        std::cerr << "ERROR: " << err.what() << "\n";
+        std::cerr << "Usage:\n";
+        std::cerr << "StreamBenchmark [-source N] [-output N] [-seconds N] [-window N] [-consumers N] [-rate N] [-poll] [-threads N]" << std::endl;
+        return -1;
+    }
+
+    std::vector<uint8_t> src_buf = MakeSource(opt.src_size);
+    const unsigned short src_dims[3] = { opt.src_size, opt.src_size, opt.src_size };
+    const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+    ThreadPool pool(opt.threads);
+
+    std::cout << "Source: " << opt.src_size << "^3, output: " << opt.out_size << "^3 (linear), window: " << opt.window << ", consumers: " << opt.consumers
+              << (opt.poll ? " (polling)" : " (waiting)") << ", threads: " << opt.threads << "\n\n";
+    std::cout << std::right << std::setw(6) << "vol/s" << std::setw(9) << "produced" << std::setw(9) << "dropped" << std::setw(9) << "consumed" << std::setw(9) << "skipped" << std::setw(9) << "evicted"
+              << std::setw(10) << "write ms" << std::setw(10) << "wake p50" << std::setw(10) << "wake p99" << std::setw(10) << "e2e p50" << std::setw(10) << "e2e p99" << std::setw(10) << "e2e max" << "\n";
+    try {
+        for (unsigned int rate : opt.rates) {
+            Stats stats = Run(opt, rate, src, pool);
+            std::cout << std::setw(6) << rate << std::setw(9) << stats.produced << std::setw(9) << stats.dropped << std::setw(9) << stats.consumed << std::setw(9) << stats.skipped << std::setw(9) << stats.evicted
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(10) << Percentile(stats.write, 0.5) << std::setw(10) << Percentile(stats.wake, 0.5) << std::setw(10) << Percentile(stats.wake, 0.99)
+                      << std::setw(10) << Percentile(stats.latency, 0.5) << std::setw(10) << Percentile(stats.latency, 0.99) << std::setw(10) << Percentile(stats.latency, 1.0) << "\n";
+        }
+    } catch (const std::exception & err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -6,10 +6,10 @@ import numpy as np
 import SimpleITK as sitk
 from utils import SafeArrayToNumpy
 from utils import FrameTo3dArray
+from utils import SeriesTo4dArray
 
-def SaveITKImage(imgFrame, bbox, outputFilename):
-    array = FrameTo3dArray(imgFrame)
-    itk_img = sitk.GetImageFromArray(array.astype("float64"))
+def SaveITKImage(array, bbox, outputFilename):
+    itk_img = sitk.GetImageFromArray(array.astype("uint8")) # 8bit MET_UCHAR, that the DummyLoader can map back
 
     m2mm = 1000
 
@@ -18,9 +18,9 @@ def SaveITKImage(imgFrame, bbox, outputFilename):
     dir3   = [bbox.dir3_x,   bbox.dir3_y,   bbox.dir3_z]
 
     # all units from Image3dAPI are in meters according to https://github.com/MedicalUltrasound/Image3dAPI/wiki#image-geometry
-    spacingX = np.linalg.norm(dir1) / imgFrame.dims[0] * m2mm # convert from meters to millimeters
-    spacingY = np.linalg.norm(dir2) / imgFrame.dims[1] * m2mm
-    spacingZ = np.linalg.norm(dir3) / imgFrame.dims[2] * m2mm
+    spacingX = np.linalg.norm(dir1) / array.shape[0] * m2mm # convert from meters to millimeters
+    spacingY = np.linalg.norm(dir2) / array.shape[1] * m2mm
+    spacingZ = np.linalg.norm(dir3) / array.shape[2] * m2mm
 
 
     dir1 = dir1 / np.linalg.norm(dir1)
@@ -59,8 +59,14 @@ if __name__=="__main__":
     print("Color-map length: "+str(len(color_map)))
 
     frame_count = source.GetFrameCount()
+    max_res = np.ctypeslib.as_ctypes(np.array([64, 64, 64], dtype=np.ushort))
+    try:
+        # retrieve all frames in a single call (Image3dAPI 1.5)
+        source4 = source.QueryInterface(Image3dAPI.IImage3dSource4)
+        frames = SeriesTo4dArray(source4.GetFrames(0, frame_count, bbox, max_res, Image3dAPI.INTERPOLATION_NEAREST))
+    except comtypes.COMError:
+        # fallback for older loaders
+        frames = [FrameTo3dArray(source.GetFrame(i, bbox, max_res)) for i in range(frame_count)]
+
     for i in range(frame_count):
-        max_res = np.ctypeslib.as_ctypes(np.array([64, 64, 64], dtype=np.ushort))
-        frame = source.GetFrame(i, bbox, max_res)
-        data = FrameTo3dArray(frame)
-        SaveITKImage(frame, bbox, "image3DAPIDummOutput" + str(i) + ".mhd")
+        SaveITKImage(frames[i], bbox, "image3DAPIDummOutput" + str(i) + ".mhd")
@@ -53,3 +53,12 @@ def FrameTo3dArray (frame):
     arr_3d = np.lib.stride_tricks.as_strided(arr_1d, shape=frame.dims, strides=(1, frame.stride0, frame.stride1))
     return np.copy(arr_3d) 
 
+
+def SeriesTo4dArray (series):
+    """Convert Image3dSeries data into a numpy 4D array, indexed by [frame, x, y, z]"""
+    arr_1d = SafeArrayToNumpy(series.data, copy=False)
+    assert(arr_1d.dtype == np.uint8) # only tested with 1byte/elm
+
+    frame_count = len(SafeArrayToNumpy(series.times, copy=False))
+    arr_4d = np.lib.stride_tricks.as_strided(arr_1d, shape=(frame_count,)+tuple(series.dims), strides=(series.stride2, 1, series.stride0, series.stride1))
+    return np.copy(arr_4d)
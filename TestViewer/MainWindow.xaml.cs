@@ -332,22 +332,54 @@ namespace TestViewer
             const ushort HORIZONTAL_RES = 256;
             const ushort VERTICAL_RES = 256;
 
+            IImage3dSource9 source9 = m_source as IImage3dSource9;
+            if (source9 != null) {
+                // get all planes as display-ready BGRA pixels in a single call (Image3dAPI 1.11)
+                float[] planes = GeomToFloats(m_bboxXY).Concat(GeomToFloats(m_bboxXZ)).Concat(GeomToFloats(m_bboxZY)).ToArray();
+                Image3d slices = source9.GetSlicesColorMapped(frame, planes, new ushort[] { HORIZONTAL_RES, VERTICAL_RES }, InterpolationMode.INTERPOLATION_NEAREST, ImageFormat.FORMAT_B8G8R8A8);
+                ImageXY.Source = GenerateColorBitmap(slices, 0);
+                ImageXZ.Source = GenerateColorBitmap(slices, 1);
+                ImageZY.Source = GenerateColorBitmap(slices, 2);
+
+                FrameTime.Text = "Frame time: " + slices.time;
+                return;
+            }
+
+            IImage3dSource5 source5 = m_source as IImage3dSource5;
+            if (source5 != null) {
+                // get all planes in a single call (Image3dAPI 1.6)
+                float[] planes = GeomToFloats(m_bboxXY).Concat(GeomToFloats(m_bboxXZ)).Concat(GeomToFloats(m_bboxZY)).ToArray();
+                Image3d slices = source5.GetSlices(frame, planes, new ushort[] { HORIZONTAL_RES, VERTICAL_RES }, InterpolationMode.INTERPOLATION_NEAREST);
+                ImageXY.Source = GenerateBitmap(slices, color_map, 0);
+                ImageXZ.Source = GenerateBitmap(slices, color_map, 1);
+                ImageZY.Source = GenerateBitmap(slices, color_map, 2);
+
+                FrameTime.Text = "Frame time: " + slices.time;
+                return;
+            }
+
             // get XY plane (assumes 1st axis is "X" and 2nd is "Y")
             Image3d imageXY = m_source.GetFrame(frame, m_bboxXY, new ushort[] { HORIZONTAL_RES, VERTICAL_RES, 1 });
-            ImageXY.Source = GenerateBitmap(imageXY, color_map);
+            ImageXY.Source = GenerateBitmap(imageXY, color_map, 0);
 
             // get XZ plane (assumes 1st axis is "X" and 3rd is "Z")
             Image3d imageXZ = m_source.GetFrame(frame, m_bboxXZ, new ushort[] { HORIZONTAL_RES, VERTICAL_RES, 1 });
-            ImageXZ.Source = GenerateBitmap(imageXZ, color_map);
+            ImageXZ.Source = GenerateBitmap(imageXZ, color_map, 0);
 
             // get ZY plane (assumes 2nd axis is "Y" and 3rd is "Z")
             Image3d imageZY = m_source.GetFrame(frame, m_bboxZY, new ushort[] { HORIZONTAL_RES, VERTICAL_RES, 1 });
-            ImageZY.Source = GenerateBitmap(imageZY, color_map);
+            ImageZY.Source = GenerateBitmap(imageZY, color_map, 0);
 
             FrameTime.Text = "Frame time: " + imageXY.time;
         }
 
-        private WriteableBitmap GenerateBitmap(Image3d t_img, uint[] t_map)
+        /** Flatten geometry to the float layout expected by GetSlices. */
+        static float[] GeomToFloats(Cart3dGeom g)
+        {
+            return new float[] { g.origin_x, g.origin_y, g.origin_z, g.dir1_x, g.dir1_y, g.dir1_z, g.dir2_x, g.dir2_y, g.dir2_z, g.dir3_x, g.dir3_y, g.dir3_z };
+        }
+
+        private WriteableBitmap GenerateBitmap(Image3d t_img, uint[] t_map, int plane)
         {
             Debug.Assert(t_img.format == ImageFormat.FORMAT_U8);
 
@@ -356,7 +388,7 @@ namespace TestViewer
             unsafe {
                 for (int y = 0; y < bitmap.Height; ++y) {
                     for (int x = 0; x < bitmap.Width; ++x) {
-                        byte t_val = t_img.data[x + y * t_img.stride0];
+                        byte t_val = t_img.data[x + y * t_img.stride0 + plane * t_img.stride1];
 
                         // lookup tissue color
                         byte[] channels = BitConverter.GetBytes(t_map[t_val]);
@@ -375,6 +407,16 @@ namespace TestViewer
             return bitmap;
         }
 
+        /** Copy a plane of color-mapped pixels into a bitmap as a single block, without any per-pixel pass. */
+        private static WriteableBitmap GenerateColorBitmap(Image3d t_img, int plane)
+        {
+            Debug.Assert(t_img.format == ImageFormat.FORMAT_B8G8R8A8);
+
+            WriteableBitmap bitmap = new WriteableBitmap(t_img.dims[0], t_img.dims[1], 96.0, 96.0, PixelFormats.Bgra32, null);
+            bitmap.WritePixels(new Int32Rect(0, 0, t_img.dims[0], t_img.dims[1]), t_img.data, (int)t_img.stride0, plane * (int)t_img.stride1);
+            return bitmap;
+        }
+
         static void SwapVals(ref float v1, ref float v2)
         {
             float tmp = v1;
@@ -0,0 +1,277 @@
+/* Benchmark of frame transfer from an out-of-process loader.
+Compares resampling in the client process against a loader process that either copies each frame
+through a socket (stand-in for marshalled SAFEARRAY buffers) or writes it to a SharedFrameRing
+and only sends the slot location. The client reads & checksums every frame in all modes. */
+#include "Resample.hpp"
+#include "SharedFrameRing.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+
+/** Source volume geometry (same as DummyLoader). Also used as output geometry. */
+static const Cart3dGeom SOURCE_GEOM = { -0.1f, 0,     -0.075f,// origin
+                                         0.20f,0,      0,     // dir1 (width)
+                                         0,    0.10f,  0,     // dir2 (depth)
+                                         0,    0,      0.15f};// dir3 (elevation)
+
+static const uint32_t QUIT_REQUEST = 0xFFFFFFFF;
+
+
+struct Options {
+    unsigned short src_size = 128;
+    unsigned short out_size = 256;
+    unsigned int   frames   = 50;
+    unsigned int   threads  = ThreadPool::DefaultThreadCount();
+};
+
+
+/** Checkerboard with 8-voxel squares and a gradient, so that shifted frames differ. */
+static std::vector<uint8_t> MakeSource (unsigned short size) {
+    std::vector<uint8_t> buf(static_cast<size_t>(size)*size*size);
+    for (size_t z = 0; z < size; ++z)
+        for (size_t y = 0; y < size; ++y)
+            for (size_t x = 0; x < size; ++x)
+                buf[x + y*size + z*size*size] = static_cast<uint8_t>(((((x/8) ^ (y/8) ^ (z/8)) & 1) ? 192 : 64) + x + y + z);
+    return buf;
+}
+
+/** Sum of all bytes in a buffer, to make sure that frame data is actually read. */
+static uint64_t Checksum (const uint8_t * data, size_t size) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < size; ++i)
+        sum += data[i];
+    return sum;
+}
+
+static void WriteAll (int fd, const void * data, size_t size) {
+    auto * ptr = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n <= 0)
+            throw std::runtime_error("socket write failed");
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+/** Returns false on end-of-stream before the first byte. */
+static bool ReadAll (int fd, void * data, size_t size) {
+    auto * ptr = static_cast<uint8_t*>(data);
+    bool first = true;
+    while (size > 0) {
+        ssize_t n = read(fd, ptr, size);
+        if ((n == 0) && first)
+            return false;
+        if (n <= 0)
+            throw std::runtime_error("socket read failed");
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        first = false;
+    }
+    return true;
+}
+
+
+/** Loader process that resamples on request. Thread pool is created after fork, since threads are not inherited. */
+class LoaderProcess {
+public:
+    using ServeFn = std::function<void(int fd, ThreadPool & pool)>;
+
+    LoaderProcess (unsigned int threads, ServeFn serve) {
+        int fds[2] = {};
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            throw std::runtime_error("socketpair failed");
+
+        m_pid = fork();
+        if (m_pid < 0)
+            throw std::runtime_error("fork failed");
+        if (m_pid == 0) {
+            close(fds[0]);
+            int status = 0;
+            try {
+                ThreadPool pool(threads);
+                serve(fds[1], pool);
+            } catch (const std::exception & err) {
+                std::cerr << "ERROR (loader process): " << err.what() << std::endl;
+                status = 1;
+            }
+            _exit(status); // skip parent cleanup
+        }
+
+        close(fds[1]);
+        m_fd = fds[0];
+    }
+
+    ~LoaderProcess () {
+        uint32_t quit = QUIT_REQUEST;
+        ssize_t ignored = write(m_fd, &quit, sizeof(quit));
+        (void)ignored;
+        close(m_fd);
+        waitpid(m_pid, nullptr, 0);
+    }
+
+    int Socket () const {
+        return m_fd;
+    }
+
+private:
+    LoaderProcess (const LoaderProcess &) = delete;
+    LoaderProcess & operator = (const LoaderProcess &) = delete;
+
+    pid_t m_pid = 0;
+    int   m_fd = -1;
+};
+
+
+/** Time "count" calls of "fetch(frame)", after a single warmup call. Returns [seconds]. */
+static double TimeFrames (unsigned int count, const std::function<void(unsigned int)> & fetch) {
+    fetch(0);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < count; ++i)
+        fetch(i);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void Report (const char * mode, double seconds, unsigned int frames, size_t frame_size) {
+    std::cout << std::left << std::setw(16) << mode << std::right << std::fixed
+              << std::setprecision(3) << std::setw(11) << 1e3*seconds/frames
+              << std::setprecision(1) << std::setw(10) << frames/seconds
+              << std::setprecision(1) << std::setw(10) << frame_size*frames/seconds*1e-6 << "\n";
+}
+
+
+static unsigned int ParseCount (int argc, char * argv[], int & i) {
+    if (i + 1 >= argc)
+        throw std::runtime_error(std::string("missing value for ") + argv[i]);
+    return static_cast<unsigned int>(std::stoul(argv[++i]));
+}
+
+
+int main (int argc, char * argv[]) {
+    Options opt;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-source")
+                opt.src_size = static_cast<unsigned short>(std::min(std::max(1u, ParseCount(argc, argv, i)), 1024u));
+            else if (arg == "-output")
+                opt.out_size = static_cast<unsigned short>(std::min(std::max(1u, ParseCount(argc, argv, i)), 1024u));
+            else if (arg == "-frames")
+                opt.frames = std::max(1u, ParseCount(argc, argv, i));
+            else if (arg == "-threads")
+                opt.threads = ParseCount(argc, argv, i);
+            else
+                throw std::runtime_error("unknown argument " + arg);
+        }
+    } catch (const std::exception & err) {
+        std::cerr << "ERROR: " << err.what() << "\n";
+        std::cerr << "Usage:\n";
+        std::cerr << "TransportBenchmark [-source N] [-output N] [-frames N] [-threads N]" << std::endl;
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN); // report failed writes as errors instead
+
+    // frames are resampled from slightly different geometries, so that every frame has new content
+    std::vector<uint8_t> src_buf = MakeSource(opt.src_size);
+    const unsigned short src_dims[3] = { opt.src_size, opt.src_size, opt.src_size };
+    const Image3dView src = Image3dView::Packed(0, FORMAT_U8, src_dims, src_buf.data());
+    const unsigned short out_dims[3] = { opt.out_size, opt.out_size, opt.out_size };
+    const size_t frame_size = static_cast<size_t>(opt.out_size)*opt.out_size*opt.out_size;
+    auto frame_geom = [](unsigned int frame) {
+        Cart3dGeom geom = SOURCE_GEOM;
+        geom.origin_x += 0.001f*(frame % 8);
+        return geom;
+    };
+
+    std::cout << "Source: " << opt.src_size << "^3, output: " << opt.out_size << "^3 (" << frame_size/1e6 << " MB), frames: " << opt.frames << ", threads: " << opt.threads << "\n\n";
+    std::cout << std::left << std::setw(16) << "transport" << std::right << std::setw(11) << "ms/frame" << std::setw(10) << "frames/s" << std::setw(10) << "MB/s" << "\n";
+
+    uint64_t checksums[3] = {};
+    try {
+        {
+            // resample in the client process (lower bound)
+            ThreadPool pool(opt.threads); // destroyed before forking
+            std::vector<uint8_t> out_buf(frame_size);
+            const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data());
+            double seconds = TimeFrames(opt.frames, [&](unsigned int frame) {
+                SampleFrame<uint8_t>(src, SOURCE_GEOM, frame_geom(frame), INTERPOLATION_NEAREST, pool, out);
+                checksums[0] += Checksum(out_buf.data(), frame_size);
+            });
+            Report("in-process", seconds, opt.frames, frame_size);
+        }
+        {
+            // loader process copies every frame through a socket
+            LoaderProcess loader(opt.threads, [&](int fd, ThreadPool & pool) {
+                std::vector<uint8_t> out_buf(frame_size);
+                const Image3dView out = Image3dView::Packed(0, FORMAT_U8, out_dims, out_buf.data());
+                uint32_t frame = 0;
+                while (ReadAll(fd, &frame, sizeof(frame)) && (frame != QUIT_REQUEST)) {
+                    SampleFrame<uint8_t>(src, SOURCE_GEOM, frame_geom(frame), INTERPOLATION_NEAREST, pool, out);
+                    WriteAll(fd, out_buf.data(), frame_size);
+                }
+            });
+
+            std::vector<uint8_t> in_buf(frame_size);
+            double seconds = TimeFrames(opt.frames, [&](unsigned int frame) {
+                uint32_t request = frame;
+                WriteAll(loader.Socket(), &request, sizeof(request));
+                if (!ReadAll(loader.Socket(), in_buf.data(), frame_size))
+                    throw std::runtime_error("loader process terminated");
+                checksums[1] += Checksum(in_buf.data(), frame_size);
+            });
+            Report("copy (socket)", seconds, opt.frames, frame_size);
+        }
+        {
+            // loader process writes frames to a shared ring, and only sends their location
+            const std::string ring_name = SharedMemory::UniqueName();
+            LoaderProcess loader(opt.threads, [&](int fd, ThreadPool & pool) {
+                SharedFrameRing ring(ring_name, 4, static_cast<uint32_t>(frame_size));
+                uint32_t frame = 0;
+                WriteAll(fd, &frame, sizeof(frame)); // signal that ring is created
+                while (ReadAll(fd, &frame, sizeof(frame)) && (frame != QUIT_REQUEST)) {
+                    SharedFrameRing::Slot slot = ring.BeginWrite();
+                    SampleFrame<uint8_t>(src, SOURCE_GEOM, frame_geom(frame), INTERPOLATION_NEAREST, pool, Image3dView::Packed(0, FORMAT_U8, out_dims, slot.data));
+                    ring.EndWrite(slot);
+                    const uint32_t location[2] = { slot.offset, slot.sequence };
+                    WriteAll(fd, location, sizeof(location));
+                }
+            });
+
+            uint32_t ready = 0;
+            if (!ReadAll(loader.Socket(), &ready, sizeof(ready)))
+                throw std::runtime_error("loader process failed to create shared ring");
+            const SharedFrameRing ring(ring_name);
+            double seconds = TimeFrames(opt.frames, [&](unsigned int frame) {
+                uint32_t request = frame, location[2] = {};
+                WriteAll(loader.Socket(), &request, sizeof(request));
+                if (!ReadAll(loader.Socket(), location, sizeof(location)))
+                    throw std::runtime_error("loader process terminated");
+                const uint8_t * data = ring.Data(location[0], frame_size);
+                if (!data)
+                    throw std::runtime_error("frame outside shared ring");
+                checksums[2] += Checksum(data, frame_size);
+                if (!ring.IsCurrent(location[0], location[1]))
+                    throw std::runtime_error("shared ring slot overwritten while reading");
+            });
+            Report("shared memory", seconds, opt.frames, frame_size);
+        }
+    } catch (const std::exception & err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        return 1;
+    }
+
+    if ((checksums[0] != checksums[1]) || (checksums[0] != checksums[2])) {
+        std::cerr << "ERROR: frame content differs between transports" << std::endl;
+        return 1;
+    }
+    return 0;
+}